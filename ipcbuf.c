@@ -42,7 +42,9 @@
 #endif
 
 #include <arpa/inet.h>
+#include <netdb.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #ifdef __OpenBSD__
 #include <netinet/ip_var.h>
@@ -51,39 +53,158 @@
 #endif
 
 #include <sys/ioctl.h>
+#include <sys/ipc.h>
+#include <sys/mman.h>
+#include <sys/msg.h>
 #include <sys/param.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/un.h>
+#include <sys/utsname.h>
 #include <sys/wait.h>
 
 #if !defined(__sun) && !defined(__linux)
 #include <sys/sysctl.h>
 #endif
 
+#ifdef __FreeBSD__
+#include <sys/cpuset.h>
+#endif
+
+#ifdef __linux
+#include <linux/futex.h>
+#include <mqueue.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+/* A mqd_t is a file descriptor. */
+#define HAVE_MQUEUE
+#define HAVE_EPOLL
+#endif
+
+#if defined(__FreeBSD__) || defined(__NetBSD__) || defined(__OpenBSD__) || \
+    defined(__APPLE__)
+#include <sys/event.h>
+#define HAVE_KQUEUE
+#endif
+
+/* Bytes currently in a SysV message queue; not in POSIX. */
+#if defined(__linux)
+#define MSG_CBYTES(ds) ((ds)->__msg_cbytes)
+#elif defined(__NetBSD__)
+#define MSG_CBYTES(ds) ((ds)->_msg_cbytes)
+#elif defined(__FreeBSD__) || defined(__OpenBSD__) || defined(__APPLE__)
+#define MSG_CBYTES(ds) ((ds)->msg_cbytes)
+#endif
+
+#if defined(__linux) || defined(__FreeBSD__)
+#define HAVE_AFFINITY
+#endif
+
+#if defined(__linux) || defined(__FreeBSD__) || defined(__NetBSD__)
+#define HAVE_MMSG
+#endif
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+/* For '-u', a clock not subject to NTP slewing, where
+ * available. */
+#ifdef CLOCK_MONOTONIC_RAW
+#define TIMING_CLOCK CLOCK_MONOTONIC_RAW
+#else
+#define TIMING_CLOCK CLOCK_MONOTONIC
+#endif
+
+#include <dirent.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#ifdef __linux
+#include <sched.h>
+#endif
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 #include <unistd.h>
 
+#ifdef __linux
+/* Needs struct timespec. */
+#include <linux/errqueue.h>
+#include <linux/inet_diag.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/sock_diag.h>
+#endif
+
+#if defined(MSG_ZEROCOPY) && defined(SO_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY)
+#define HAVE_ZEROCOPY
+#endif
+
+#if defined(__linux) && defined(SO_MEMINFO)
+#define HAVE_MEMINFO
+#endif
+
+#ifdef __linux
+#include <linux/io_uring.h>
+#  ifdef IORING_FEAT_EXT_ARG
+#define HAVE_URING
+#  endif
+#endif
+
+#ifdef __linux
+#include <linux/perf_event.h>
+#define HAVE_PERF
+#endif
+
+#ifdef __linux
+#include <netinet/udp.h>
+#  if defined(UDP_SEGMENT) && defined(UDP_GRO)
+#define HAVE_GSO
+#  endif
+#  if defined(TCP_INFO) && defined(SIOCOUTQNSD)
+#define HAVE_TCPINFO
+#  endif
+#endif
+
+/* Linux corks, the BSDs don't push. */
+#if defined(TCP_CORK)
+#define TCP_CORK_OPT TCP_CORK
+#elif defined(TCP_NOPUSH)
+#define TCP_CORK_OPT TCP_NOPUSH
+#endif
+
 enum {
 	LOOP,
-	CHUNK
+	CHUNK,
+	THROUGHPUT,
+	LATENCY,
+	PROBE,
+	TUNE,
+	FANOUT,
+	SUBPAGE,
+	CHAIN,
+	BACKPRESSURE
 };
 
 enum {
 	IPC_PIPE,
 	IPC_FIFO,
 	IPC_SOCKETPAIR,
-	IPC_SOCKET
+	IPC_SOCKET,
+	IPC_SHM,
+	IPC_MQUEUE,
+	IPC_MSGQ
 };
 
 int IPC_TYPE = IPC_PIPE;
@@ -91,19 +212,214 @@ int MODE = LOOP;
 int CHUNK1 = 1;
 int CHUNK2 = -1;
 int TOTAL = 0;
+int WRITES = 0;
 int NUM_CHUNKS = 1;
 int LARGEST_CHUNK = 0;
+int MSGSIZE = -1;
+int MSGSIZE_FITS = 0;	/* largest datagram known to fit */
+
+int ALIGN = 0;
+int SPLICE = 0;
+int VMSPLICE = 0;
+int BATCH = 0;
+int MMSG = 0;
+int VECTORED = 0;
+int WRITEV = 0;
+#define URING_MAX 4096
+int URING_DEPTH = 0;
+int URING = 0;
+
+/* '-g': UDP segmentation offload, sending datagrams of
+ * many GSO_SIZE segments each, received coalesced. */
+int GSO_SIZE = 0;
+int GSO = 0;
+long long GSO_SEGS = 0;
+
+/* '-O' options for TCP sockets. */
+#define OPT_NODELAY	0x1
+#define OPT_CORK	0x2
+#define OPT_ZEROCOPY	0x4
+int TCP_OPTS = 0;
+long long ZC_SENDS = 0;
+long long ZC_DONE = 0;
+long long ZC_COPIED = 0;
+long long WRITE_NS = 0;
+int DEVNULL = -1;
+char *ARENA = NULL;
+size_t ARENA_SIZE = 0;
 int QUIET = 0;
+int WAKEUP = 0;
+int TIMING = 0;
+int EVENTS = 0;
+int THREADED = 0;
+
+/* '-f': drain without FIONREAD before every read; '-Q'
+ * samples the queue every this many reads. */
+int FAST_DRAIN = 0;
+int SAMPLE_EVERY = 0;
+#define DRAIN_BATCH 64
+
+enum {
+	FMT_TEXT,
+	FMT_CSV,
+	FMT_JSON
+};
+
+int FORMAT = FMT_TEXT;
+
+/* Comma separated lists or ranges given for a sweep;
+ * NULL if the option was given (at most) a single value. */
+char *SWEEP_TYPES = NULL;
+char *SWEEP_SOCKTYPES = NULL;
+char *SWEEP_PIPEBUFS = NULL;
+char *SWEEP_RCVBUFS = NULL;
+char *SWEEP_SNDBUFS = NULL;
+char *SWEEP_RCVLOWATS = NULL;
+char *SWEEP_SNDLOWATS = NULL;
+char *SWEEP_TCPOPTS = NULL;
+char *SWEEP_CHUNKS1 = NULL;
+char *SWEEP_CHUNKS2 = NULL;
+char *SWEEP_WORKERS = NULL;
+
+int DURATION = 1;
+
+/* '-N': in fanout mode, open this many channels; in
+ * chain mode, connect this many hops.  '-P a:b:c' gives
+ * every hop of the chain its own pipe size. */
+int CHANNELS = 1000;
+int HOPS = 3;
+int *HOP_PIPEBUFS = NULL;
+int NUM_HOP_PIPEBUFS = 0;
+
+/* '-X' and '-Z': in backpressure mode, the writer
+ * produces at WRITE_RATE bytes per second while the
+ * reader only consumes at READ_RATE, or stalls for
+ * STALL_MS every STALL_EVERY ms, the way a consumer does
+ * during a GC pause or on a slow disk; 0 means as fast
+ * as possible. */
+int WRITE_RATE = 10000000;
+int READ_RATE = -1;
+int STALL_MS = 0;
+int STALL_EVERY = 1000;
+
+/* '-r' and '-w': run the test this many times on fresh
+ * channels, after discarding this many warm-up runs. */
+int TRIALS = 1;
+int WARMUP = 0;
+int TRIAL = 0;
+int WRITERS = 1;
+int READERS = 1;
+int INDEPENDENT = 0;
+int *WRITER_CPUS = NULL;
+int NUM_WRITER_CPUS = 0;
+int *READER_CPUS = NULL;
+int NUM_READER_CPUS = 0;
+int BYTE_LIMIT = -1;
+int ITERATIONS = 10000;
+int TUNE_PCT = 95;
 
 int SET_RCVBUF = -1;
 int SET_SNDBUF = -1;
 int SET_PIPEBUF = -1;
+int SET_RCVLOWAT = -1;
+int SET_SNDLOWAT = -1;
 
 char *SET_SOCKTYPE = "DGRAM";
 int SOCK_TYPE = SOCK_DGRAM;
 char *SET_SOCKDOMAIN = "PF_LOCAL";
 int SOCK_DOMAIN = PF_LOCAL;
 
+uint16_t PORT = 12345;
+
+/* '-D' and '-H': run as the receiving end on one host,
+ * or test against it at REMOTE ("host[:port]") from
+ * another, so that the data crosses a real NIC, qdisc,
+ * and TCP autotuning instead of the loopback. */
+int DAEMON = 0;
+char *REMOTE = NULL;
+
+/* '-Y': in throughput mode over TCP, sample the writer's
+ * buffers and TCP_INFO every SERIES_MS ms, to see how
+ * quickly autotuning gets a new connection up to
+ * speed. */
+struct tcpSample {
+	long long t;		/* ns since the first write */
+	long long acked;	/* written minus SIOCOUTQ */
+	int sndbuf;
+	int rcvbuf;		/* the peer's; -1 if unknown */
+	int cwnd;		/* in bytes */
+	int rtt;		/* us */
+	int unacked;
+	int notsent;
+};
+int SERIES_MS = 0;
+struct tcpSample *SERIES = NULL;
+int NUM_SERIES = 0;
+
+/* '-E': perf_event_open(2) counters for the write or
+ * the read phase of a test; -1 if not available. */
+enum {
+	PERF_CSW,
+	PERF_CYCLES,
+	PERF_INSTRS,
+	PERF_MISSES,
+	PERF_FAULTS,
+	NUM_PERF
+};
+
+struct perfCounts {
+	long long v[NUM_PERF];
+	int fd[NUM_PERF];
+	int kernel;		/* kernel space counted, too */
+};
+
+int PERF = 0;
+
+struct xferStats {
+	long long bytes;
+	long long ops;
+	long long msgs;
+	long long eagain;
+	long long wakeups;
+	long long wake[2];	/* p50, p99 from wakeup to read */
+	long long parked;	/* io_uring requests that had to wait */
+	double elapsed;
+	struct perfCounts perf;
+};
+
+/* The numbers of a single test, for structured
+ * output; -1 means not applicable. */
+struct result {
+	long long total;
+	int iterations;
+	int largest;
+	int msgsize;
+	int maxwrite;
+	int writes;
+	long long kmem;		/* kernel memory charged for 'total' */
+	struct xferStats w;
+	struct xferStats r;
+	long long rtt[4];	/* p50, p99, p99.9, max */
+	long long drained;	/* '-f' bytes read and time to empty */
+	long long drain_ns;
+	int channels;		/* fanout: channels opened, */
+	int chan_min;		/* the smallest and largest */
+	int chan_max;		/* capacity of any of them, */
+	int shrink_at;		/* and the first that got less */
+	int slots;		/* subpage: page-sized pipe slots, */
+	int packet;		/* and the capacity in packet mode */
+	int fullest;		/* chain: the hop with the longest queue */
+	long long full_ns;	/* backpressure: until the writer blocked, */
+	int stalls;		/* how often it did, */
+	long long stall[3];	/* for how long (p50, p99, max), */
+	int peak;		/* and the most that was queued */
+	long long steady_ns;	/* '-Y': until within 90% of steady, */
+	int peak_sndbuf;	/* and the largest buffers */
+	int peak_rcvbuf;
+	struct perfCounts wperf;
+	struct perfCounts rperf;
+} RESULT;
+
 #define PROGNAME "ipcbuf"
 
 #ifdef __OpenBSD__
@@ -134,10 +450,66 @@ sysctlbyname(const char *sname, void *oldp, size_t *oldlenp,
 }
 #endif
 
+int
+isDgram() {
+	return ((IPC_TYPE == IPC_SOCKET) || (IPC_TYPE == IPC_SOCKETPAIR)) &&
+		(SOCK_TYPE == SOCK_DGRAM);
+}
+
+/* Whether every write is read back as one message, with
+ * an empty one marking the end of the data. */
+int
+isMessages() {
+	return isDgram() || (IPC_TYPE == IPC_MQUEUE) || (IPC_TYPE == IPC_MSGQ);
+}
+
+/* Whether '-P' sets the size of the buffer. */
+int
+isSizable() {
+	return (IPC_TYPE == IPC_PIPE) || (IPC_TYPE == IPC_SHM) || (IPC_TYPE == IPC_MSGQ);
+}
+
+/* Whether the channel can be a hop in chain mode. */
+int
+isChainable() {
+	return (IPC_TYPE == IPC_PIPE) || (IPC_TYPE == IPC_FIFO) ||
+		((IPC_TYPE == IPC_SOCKETPAIR) && (SOCK_TYPE == SOCK_STREAM));
+}
+
+int
+isUdp() {
+	return (IPC_TYPE == IPC_SOCKET) && (SOCK_TYPE == SOCK_DGRAM) &&
+		(SOCK_DOMAIN != PF_LOCAL);
+}
+
+int
+isTcp() {
+	return (IPC_TYPE == IPC_SOCKET) && (SOCK_TYPE == SOCK_STREAM) &&
+		(SOCK_DOMAIN != PF_LOCAL);
+}
+
+int
+isZerocopy() {
+	return (TCP_OPTS & OPT_ZEROCOPY) && isTcp();
+}
+
+int printRingSize(int fd, const char *which);
+int printMsgQueueSize(int fd, const char *which);
+const char *ipcTypeName();
+const char *modeName();
+void reportPerf(const char *which, struct perfCounts *p, long long bytes, long long ops);
+int cmpDouble(const void *a, const void *b);
+
 int
 printFdQueueSize(int fd, const char *which) {
 	unsigned long req;
 
+	if (IPC_TYPE == IPC_SHM) {
+		return printRingSize(fd, which);
+	} else if ((IPC_TYPE == IPC_MQUEUE) || (IPC_TYPE == IPC_MSGQ)) {
+		return printMsgQueueSize(fd, which);
+	}
+
 	/* We may not have any of these at all, so
 	 * let's silence compiler warnings about
 	 * unused variables. */
@@ -196,15 +568,25 @@ printFdQueueSize(int fd, const char *which) {
 	return n;
 }
 
+int
+sockOpt(int fd, int opt) {
+	int n;
+	socklen_t s = sizeof(n);
+
+	if (getsockopt(fd, SOL_SOCKET, opt, (void *)&n, &s) < 0) {
+		err(EXIT_FAILURE, "getsockopt");
+		/* NOTREACHED */
+	}
+	return n;
+}
+
 void
 printSockOpt(int fd, int opt) {
 	if (QUIET) {
 		return;
 	}
 
-	int n;
 	char *sopt;
-	unsigned int s = sizeof(n);
 	
 	switch(opt) {
 	case SO_SNDBUF:
@@ -216,733 +598,9172 @@ printSockOpt(int fd, int opt) {
 	case SO_RCVBUF:
 		sopt = "SO_RCVBUF";
 		break;
+	case SO_RCVLOWAT:
+		sopt = "SO_RCVLOWAT";
+		break;
 	default:
 		return;
 	}
 
-	if (getsockopt(fd, SOL_SOCKET, opt, (void *)&n, &s) < 0) {
-		err(EXIT_FAILURE, "getsockopt");
-		/* NOTREACHED */
-	}
+	(void)printf("%-15s: %8d\n", sopt, sockOpt(fd, opt));
+}
 
-	(void)printf("%-15s: %8d\n", sopt, n);
+#ifdef HAVE_MEMINFO
+/* What the kernel charges a socket for the data it
+ * holds, skb overhead and all: received data counts
+ * against the receiver, sent data until it is freed
+ * (AF_LOCAL: read) or acknowledged (TCP) against the
+ * sender. */
+long long
+sumMeminfo(uint32_t *mem) {
+	return (long long)mem[SK_MEMINFO_RMEM_ALLOC] +
+		mem[SK_MEMINFO_WMEM_ALLOC] + mem[SK_MEMINFO_WMEM_QUEUED];
 }
 
-int
-writeChunk(int fd, int count) {
-	char *buf;
-	int n, wanted, failed = 0;
+long long
+sockMeminfo(int fd) {
+	uint32_t mem[SK_MEMINFO_VARS];
+	socklen_t len = sizeof(mem);
 
-	wanted = count;
-	if ((buf = malloc(count)) == NULL) {
-		err(EXIT_FAILURE, "malloc");
+	if (getsockopt(fd, SOL_SOCKET, SO_MEMINFO, mem, &len) < 0) {
+		return -1;
 	}
-	memset(buf, 'x', count);
-	again:
-	if ((n = write(fd, buf, count)) < 0) {
-		/* EAGAIN / EWOULDBLOCK: I/O would have been blocked;
-		 * EMSGSIZE:             chunk > internal buffer size;
-		 * ENOBUFS:              buffer queue is full */
-		if ((errno == EMSGSIZE) || (errno == ENOBUFS)) {
-			count--;
-			if (count < 1) {
-				(void)fprintf(stderr, "Unable to write even a single byte: %s\n", strerror(errno));
-				free(buf);
-				return -1;
-			}
-			failed = 1;
-			goto again;
-		}
-		if (errno == EAGAIN) {
-			if (failed && !QUIET) {
-				(void)printf("%-15s: %8d\n", "MSGSIZE", count);
-			}
-			free(buf);
-			(void)fprintf(stderr, "Unable to write %d more byte%s: %s\n",
-					count, count > 1 ? "s" : "", strerror(errno));
-			return -1;
-		} else {
-			err(EXIT_FAILURE, "write");
-		}
+	return sumMeminfo(mem);
+}
+
+/* A NETLINK_SOCK_DIAG socket kept open for a series of
+ * lookups; see openDiag(). */
+int DIAG_FD = -1;
+
+/* The SK_MEMINFO_VARS of the other end of a TCP
+ * connection that lives in another process, looked up
+ * via NETLINK_SOCK_DIAG.  Returns -1 if not found. */
+int
+peerSkmeminfo(int fd, uint32_t *mem) {
+	struct sockaddr_storage local, remote;
+	socklen_t llen = sizeof(local), rlen = sizeof(remote);
+	struct {
+		struct nlmsghdr nlh;
+		struct inet_diag_req_v2 req;
+	} msg;
+	char buf[8192];
+	int found = -1;
+	ssize_t n;
+	int nfd;
+
+	if ((getsockname(fd, (struct sockaddr *)&local, &llen) < 0) ||
+	    (getpeername(fd, (struct sockaddr *)&remote, &rlen) < 0)) {
+		return -1;
 	}
 
-	TOTAL += n;
-	if (!QUIET) {
-		(void)printf("Wrote %8d out of %8d byte%s. %s(Total: %8d)\n",
-				n, wanted,
-				wanted > 1 ? "s" : "",
-				wanted > 1 ? "" : " ",
-				TOTAL);
+	memset(&msg, 0, sizeof(msg));
+	msg.nlh.nlmsg_len = sizeof(msg);
+	msg.nlh.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+	msg.nlh.nlmsg_flags = NLM_F_REQUEST;
+	msg.req.sdiag_family = local.ss_family;
+	msg.req.sdiag_protocol = IPPROTO_TCP;
+	msg.req.idiag_ext = 1 << (INET_DIAG_SKMEMINFO - 1);
+	msg.req.idiag_states = ~0U;
+	msg.req.id.idiag_cookie[0] = INET_DIAG_NOCOOKIE;
+	msg.req.id.idiag_cookie[1] = INET_DIAG_NOCOOKIE;
+	/* The peer's source is our destination. */
+	if (local.ss_family == AF_INET) {
+		struct sockaddr_in *l = (struct sockaddr_in *)&local;
+		struct sockaddr_in *r = (struct sockaddr_in *)&remote;
+		msg.req.id.idiag_sport = r->sin_port;
+		msg.req.id.idiag_dport = l->sin_port;
+		memcpy(msg.req.id.idiag_src, &r->sin_addr, sizeof(r->sin_addr));
+		memcpy(msg.req.id.idiag_dst, &l->sin_addr, sizeof(l->sin_addr));
+	} else {
+		struct sockaddr_in6 *l = (struct sockaddr_in6 *)&local;
+		struct sockaddr_in6 *r = (struct sockaddr_in6 *)&remote;
+		msg.req.id.idiag_sport = r->sin6_port;
+		msg.req.id.idiag_dport = l->sin6_port;
+		memcpy(msg.req.id.idiag_src, &r->sin6_addr, sizeof(r->sin6_addr));
+		memcpy(msg.req.id.idiag_dst, &l->sin6_addr, sizeof(l->sin6_addr));
 	}
-	free(buf);
 
-	if (n > LARGEST_CHUNK) {
-		LARGEST_CHUNK = n;
+	if (((nfd = DIAG_FD) < 0) &&
+	    ((nfd = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_SOCK_DIAG)) < 0)) {
+		return -1;
 	}
-	return n;
-}
+	if ((send(nfd, &msg, sizeof(msg), 0) == sizeof(msg)) &&
+	    ((n = recv(nfd, buf, sizeof(buf), 0)) > 0)) {
+		struct nlmsghdr *h = (struct nlmsghdr *)buf;
 
-void
-writeLoop(int fd, int count, int inc) {
-	int i = 0;
-	while (1) {
-		int n;
+		if (NLMSG_OK(h, (size_t)n) && (h->nlmsg_type == SOCK_DIAG_BY_FAMILY)) {
+			struct inet_diag_msg *d = NLMSG_DATA(h);
+			struct rtattr *a = (struct rtattr *)(d + 1);
+			int len = h->nlmsg_len - NLMSG_LENGTH(sizeof(*d));
 
-		n = writeChunk(fd, count);
-		if ((n != count) || (n < 0)) {
-			if (n > 0) {
-				i++;
+			for (; RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+				if ((a->rta_type == INET_DIAG_SKMEMINFO) &&
+				    (RTA_PAYLOAD(a) >= (int)(SK_MEMINFO_VARS * sizeof(uint32_t)))) {
+					memcpy(mem, RTA_DATA(a), SK_MEMINFO_VARS * sizeof(uint32_t));
+					found = 0;
+				}
 			}
-			break;
-		}
-
-		if (inc == -1) {
-			count *= 2;
-		} else {
-			count += inc;
 		}
-		i++;
 	}
-	if (!QUIET) {
-		(void)printf("%-15s: %8d\n", "Iterations", i);
+	if (nfd != DIAG_FD) {
+		(void)close(nfd);
 	}
+	return found;
 }
 
-void
-usage() {
-	(void)fprintf(stderr,
-	    "usage: %s [-chlq] [-[PRS] bufsiz] [-n num] [-s type] [-t type]"
-	    " [chunk] [chunk|inc]\n"
-	    "-P size      try to set the pipe's size to this many bytes"
-	    " (Linux only)\n"
-	    "-R size      try to set the SO_RCVBUF size to this many bytes\n"
-	    "             (socket/socketpair only)\n"
-	    "-S size      try to set the SO_SNDBUF size to this many bytes\n"
-	    "             (socket/socketpair only)\n"
-	    "-c           write two consecutive chunks\n"
-	    "-h           print this help\n"
-	    "-l           write in a loop\n"
-	    "-n num       write this many additional chunks\n"
-	    "-q           be quiet and only print the final number\n"
-	    "-s type      use this type of socket"
-	    " ([inet[6]-]dgram or [inet[6]-]stream)\n"
-	    "-t type      use this type of IPC"
-	    " (fifo, pipe, socket, socketpair)\n"
-	    "[chunk]      initial chunk size; 1 if not given\n"
-	    "[chunk|inc]  second chunk size or loop increment\n"
-	    "             if not given, use first chunk size in chunk mode,\n"
-	    "             double first chunk size in loop mode\n",
-	    PROGNAME);
+long long
+peerMeminfo(int fd) {
+	uint32_t mem[SK_MEMINFO_VARS];
+
+	if (peerSkmeminfo(fd, mem) < 0) {
+		return -1;
+	}
+	return sumMeminfo(mem);
 }
+#endif
 
+/* '-Y' looks up the peer's SO_RCVBUF with every sample;
+ * have those share a single diag socket for the test
+ * rather than open one each. */
 void
-setPipeSize(int fd) {
-	if (SET_PIPEBUF == -1) {
-		/* '-P size' not given */
-		return;
+openDiag() {
+#ifdef HAVE_MEMINFO
+	if (DIAG_FD < 0) {
+		/* If this fails, every lookup tries on its own. */
+		DIAG_FD = socket(AF_NETLINK, SOCK_DGRAM, NETLINK_SOCK_DIAG);
 	}
+#endif
+}
 
-#ifndef F_SETPIPE_SZ
-	(void)fd;
-	(void)fprintf(stderr, "Sorry, setting the pipe size is not supported on this platform.\n");
-	exit(EXIT_FAILURE);
-	/* NOTREACHED */
-#else
-	if ((fcntl(fd, F_SETPIPE_SZ, SET_PIPEBUF)) < 0) {
-		err(EXIT_FAILURE, "fcntl(F_SETPIPE_SZ)");
-		/* NOTREACHED */
+void
+closeDiag() {
+#ifdef HAVE_MEMINFO
+	if (DIAG_FD >= 0) {
+		(void)close(DIAG_FD);
+		DIAG_FD = -1;
 	}
 #endif
 }
 
+/* The SO_RCVBUF of the other end of a TCP connection,
+ * or -1 if it's not on this host. */
 int
-inputNumber(const char *in, int threshold, const char *what) {
-	int n;
-	char *endptr;
-	if (((n = (int)strtol(in, &endptr, 10)) < threshold) ||
-	    (*endptr != '\0')) {
-		(void)fprintf(stderr, "Please provide a number >= %d for %s.\n",
-		    threshold, what);
-		exit(EXIT_FAILURE);
-		/* NOTREACHED */
+peerRcvbuf(int fd) {
+#ifdef HAVE_MEMINFO
+	uint32_t mem[SK_MEMINFO_VARS];
+
+	if (peerSkmeminfo(fd, mem) == 0) {
+		return mem[SK_MEMINFO_RCVBUF];
 	}
-	return n;
+#else
+	(void)fd;
+#endif
+	return -1;
 }
 
+/* The kernel memory charged for the data in a socket
+ * channel, both ends; 'rfd' is -1 if the reader lives
+ * in another process.  Returns -1 if we can't tell. */
+long long
+kernelMemory(int wfd, int rfd) {
+#ifdef HAVE_MEMINFO
+	long long total, peer = 0;
+
+	if ((IPC_TYPE != IPC_SOCKET) && (IPC_TYPE != IPC_SOCKETPAIR)) {
+		return -1;
+	}
+	if ((total = sockMeminfo(wfd)) < 0) {
+		return -1;
+	}
+	if ((rfd >= 0) && (rfd != wfd)) {
+		peer = sockMeminfo(rfd);
+	} else if ((rfd < 0) && isTcp()) {
+		peer = peerMeminfo(wfd);
+	}
+	if (peer < 0) {
+		return -1;
+	}
+	return total + peer;
+#else
+	/* The BSDs keep sb_mbcnt to themselves. */
+	(void)wfd; (void)rfd;
+	return -1;
+#endif
+}
+
+#ifdef HAVE_PERF
+struct {
+	uint32_t type;
+	uint64_t config;
+} PERF_EVENTS[NUM_PERF] = {
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+};
+#endif
+
+/* Count the events of the calling thread from here on.
+ * If perf_event_paranoid doesn't let us count in the
+ * kernel, where all the copying happens, we settle for
+ * user space; counters the hardware (or hypervisor)
+ * doesn't have are left out. */
 void
-parseArgs(int argc, char **argv) {
-	extern char *optarg;
-	extern int optind;
-	int ch;
-	int sflag = 0;
+perfStart(struct perfCounts *p) {
+	int i;
 
-	char *type = NULL;
+	for (i = 0; i < NUM_PERF; i++) {
+		p->v[i] = -1;
+		p->fd[i] = -1;
+	}
+	p->kernel = 0;
+	if (!PERF) {
+		return;
+	}
 
-	while ((ch = getopt(argc, argv, "P:R:S:chln:qs:t:")) != -1) {
-		switch(ch) {
-		case 'P':
-			SET_PIPEBUF = inputNumber(optarg, 1, "-P");
-			break;
-		case 'R':
-			SET_RCVBUF = inputNumber(optarg, 1, "-R");
-			break;
-		case 'S':
-			SET_SNDBUF = inputNumber(optarg, 1, "-S");
-			break;
-		case 'c':
-			MODE = CHUNK;
+#ifdef HAVE_PERF
+	p->kernel = 1;
+	for (i = 0; i < NUM_PERF; i++) {
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_EVENTS[i].type;
+		attr.config = PERF_EVENTS[i].config;
+		attr.disabled = 1;
+		attr.exclude_hv = 1;
+		attr.exclude_kernel = !p->kernel;
+		p->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if ((p->fd[i] < 0) && p->kernel && ((errno == EACCES) || (errno == EPERM))) {
+			/* Start over, user space only. */
+			while (--i >= 0) {
+				if (p->fd[i] >= 0) {
+					(void)close(p->fd[i]);
+				}
+			}
+			p->kernel = 0;
+			continue;
+		}
+	}
+	for (i = 0; i < NUM_PERF; i++) {
+		if (p->fd[i] >= 0) {
+			(void)ioctl(p->fd[i], PERF_EVENT_IOC_RESET, 0);
+			(void)ioctl(p->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+#endif
+}
+
+void
+perfStop(struct perfCounts *p) {
+	int i;
+
+	for (i = 0; i < NUM_PERF; i++) {
+		if (p->fd[i] >= 0) {
+			(void)ioctl(p->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+		}
+	}
+	for (i = 0; i < NUM_PERF; i++) {
+		long long v;
+
+		if (p->fd[i] < 0) {
+			continue;
+		}
+		if (read(p->fd[i], &v, sizeof(v)) == sizeof(v)) {
+			p->v[i] = v;
+		}
+		(void)close(p->fd[i]);
+		p->fd[i] = -1;
+	}
+}
+
+long long
+nsecs() {
+	struct timespec ts;
+
+	if (clock_gettime(TIMING ? TIMING_CLOCK : CLOCK_MONOTONIC, &ts) < 0) {
+		err(EXIT_FAILURE, "clock_gettime");
+		/* NOTREACHED */
+	}
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct hist {
+	long long *samples;
+	size_t n;
+	size_t size;
+};
+
+void
+histInit(struct hist *h, size_t size) {
+	if (size < 1) {
+		size = 1;
+	}
+	h->n = 0;
+	h->size = size;
+	if ((h->samples = calloc(size, sizeof(*h->samples))) == NULL) {
+		err(EXIT_FAILURE, "calloc");
+		/* NOTREACHED */
+	}
+}
+
+void
+histAdd(struct hist *h, long long v) {
+	if (h->n == h->size) {
+		h->size *= 2;
+		if ((h->samples = realloc(h->samples, h->size * sizeof(*h->samples))) == NULL) {
+			err(EXIT_FAILURE, "realloc");
+			/* NOTREACHED */
+		}
+	}
+	h->samples[h->n++] = v;
+}
+
+int
+cmpLongLong(const void *a, const void *b) {
+	long long x = *(const long long *)a;
+	long long y = *(const long long *)b;
+	return (x > y) - (x < y);
+}
+
+/* Nearest-rank percentile; samples must be sorted. */
+long long
+histPercentile(struct hist *h, double p) {
+	size_t i;
+
+	if (h->n == 0) {
+		return 0;
+	}
+	i = (size_t)((p / 100.0) * h->n + 0.5);
+	if (i > 0) {
+		i--;
+	}
+	if (i >= h->n) {
+		i = h->n - 1;
+	}
+	return h->samples[i];
+}
+
+/* With '-u', we time every read(2) and write(2) in
+ * chunk and loop mode and keep one histogram per size. */
+struct sizeHist {
+	int size;
+	struct hist h;
+};
+
+struct timings {
+	struct sizeHist *sizes;
+	int num;
+} WRITE_TIMES, READ_TIMES;
+
+void
+addTiming(struct timings *t, int size, long long ns) {
+	int i;
+
+	if (!TIMING) {
+		return;
+	}
+
+	for (i = 0; i < t->num; i++) {
+		if (t->sizes[i].size == size) {
+			break;
+		}
+	}
+	if (i == t->num) {
+		if ((t->sizes = realloc(t->sizes, (t->num + 1) * sizeof(*t->sizes))) == NULL) {
+			err(EXIT_FAILURE, "realloc");
+			/* NOTREACHED */
+		}
+		t->sizes[i].size = size;
+		histInit(&t->sizes[i].h, 16);
+		t->num++;
+	}
+	histAdd(&t->sizes[i].h, ns);
+}
+
+int
+cmpSizeHist(const void *a, const void *b) {
+	return ((const struct sizeHist *)a)->size - ((const struct sizeHist *)b)->size;
+}
+
+/* One line per size, smallest first; a jump in p50
+ * or p99 from one size to the next shows where the
+ * kernel has to do more work, e.g. allocate a new
+ * page or skb instead of appending to an existing one. */
+void
+reportTimings(const char *what, struct timings *t) {
+	int i;
+
+	if (TIMING && !QUIET && (t->num > 0)) {
+		qsort(t->sizes, t->num, sizeof(*t->sizes), cmpSizeHist);
+		(void)printf("\n%s(2) time by size (ns):\n", what);
+		(void)printf("%8s %8s %8s %8s %8s %8s\n",
+				"bytes", "calls", "min", "p50", "p99", "max");
+		for (i = 0; i < t->num; i++) {
+			struct hist *h = &t->sizes[i].h;
+
+			qsort(h->samples, h->n, sizeof(*h->samples), cmpLongLong);
+			(void)printf("%8d %8zu %8lld %8lld %8lld %8lld\n",
+					t->sizes[i].size, h->n, h->samples[0],
+					histPercentile(h, 50), histPercentile(h, 99),
+					h->samples[h->n - 1]);
+		}
+		(void)printf("\n");
+	}
+
+	for (i = 0; i < t->num; i++) {
+		free(t->sizes[i].h.samples);
+	}
+	free(t->sizes);
+	t->sizes = NULL;
+	t->num = 0;
+}
+
+/* All reads and writes share a single buffer, so that
+ * we measure the syscalls, not malloc(3) and page faults.
+ * It only ever grows (at least doubling), and we touch
+ * every page right away.  With '-a', it is page aligned. */
+char *
+getArena(size_t size) {
+	if (size <= ARENA_SIZE) {
+		return ARENA;
+	}
+
+	if (size < 2 * ARENA_SIZE) {
+		size = 2 * ARENA_SIZE;
+	}
+
+	free(ARENA);
+	if (ALIGN) {
+		size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+		int e;
+
+		size = (size + pagesize - 1) / pagesize * pagesize;
+		if ((e = posix_memalign((void **)&ARENA, pagesize, size)) != 0) {
+			errno = e;
+			err(EXIT_FAILURE, "posix_memalign");
+			/* NOTREACHED */
+		}
+	} else if ((ARENA = malloc(size)) == NULL) {
+		err(EXIT_FAILURE, "malloc");
+		/* NOTREACHED */
+	}
+	memset(ARENA, 'x', size);
+	ARENA_SIZE = size;
+
+	return ARENA;
+}
+
+/* In fanout mode, running out of channels is what we
+ * measure rather than an error: with SOFT_OPEN set, a
+ * channel that can't be opened notes the call that
+ * failed and its errno, and openChannel() returns with
+ * neither end open. */
+int SOFT_OPEN = 0;
+const char *OPEN_FAILED = NULL;
+int OPEN_ERRNO = 0;
+
+void
+openFailed(const char *what) {
+	if (!SOFT_OPEN) {
+		err(EXIT_FAILURE, "%s", what);
+		/* NOTREACHED */
+	}
+	OPEN_FAILED = what;
+	OPEN_ERRNO = errno;
+}
+
+/* With '-t shm', the channel is a single-producer,
+ * single-consumer ring in POSIX shared memory.  The
+ * producer only ever moves 'head', the consumer only
+ * 'tail', each on its own cache line; both are byte
+ * counts that only grow, so 'head - tail' is the number
+ * of bytes in the ring.  With '-F', a side that finds
+ * the ring full (or empty) sleeps on a futex(2) instead
+ * of spinning, and the other side wakes it up. */
+#define CACHELINE 64
+
+struct ring {
+	uint64_t head;
+	uint32_t wseq;		/* bumped to wake up the reader */
+	uint32_t rwait;		/* reader is asleep */
+	char pad1[CACHELINE - 16];
+	uint64_t tail;
+	uint32_t rseq;		/* bumped to wake up the writer */
+	uint32_t wwait;		/* writer is asleep */
+	char pad2[CACHELINE - 16];
+	uint32_t closed;
+	uint32_t size;
+	char pad3[CACHELINE - 8];
+	char data[];
+};
+
+/* Both ends of a ring, indexed by file descriptor, and
+ * whether each end is non-blocking, so that an empty
+ * read doesn't have to ask fcntl(2); see setFlags(). */
+struct ring **RINGS = NULL;
+char *RING_NONBLOCK = NULL;
+int NUM_RINGS = 0;
+
+struct ring *
+ringOf(int fd) {
+	if ((fd < 0) || (fd >= NUM_RINGS)) {
+		return NULL;
+	}
+	return RINGS[fd];
+}
+
+int
+ringSize() {
+	return (SET_PIPEBUF > 0) ? SET_PIPEBUF : 65536;
+}
+
+void
+openRing(int fd[2]) {
+	char name[PATH_MAX];
+	struct ring *r;
+	size_t len;
+	static int n = 0;
+	int i;
+
+	len = sizeof(*r) + ringSize();
+	(void)snprintf(name, sizeof(name), "/%s.%ld.%d", PROGNAME, (long)getpid(), n++);
+	if ((fd[0] = shm_open(name, O_RDWR|O_CREAT|O_EXCL, 0600)) < 0) {
+		openFailed("shm_open");
+		return;
+	}
+	(void)shm_unlink(name);
+	if (ftruncate(fd[0], len) < 0) {
+		openFailed("ftruncate");
+		(void)close(fd[0]);
+		return;
+	}
+	if ((r = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd[0], 0)) == MAP_FAILED) {
+		openFailed("mmap");
+		(void)close(fd[0]);
+		return;
+	}
+	r->size = ringSize();
+
+	/* The other end just needs a descriptor of its own. */
+	if ((fd[1] = dup(fd[0])) < 0) {
+		openFailed("dup");
+		(void)munmap(r, len);
+		(void)close(fd[0]);
+		return;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (fd[i] >= NUM_RINGS) {
+			int num = fd[i] + 1;
+			if (((RINGS = realloc(RINGS, num * sizeof(*RINGS))) == NULL) ||
+			    ((RING_NONBLOCK = realloc(RING_NONBLOCK, num)) == NULL)) {
+				err(EXIT_FAILURE, "realloc");
+				/* NOTREACHED */
+			}
+			memset(RINGS + NUM_RINGS, 0, (num - NUM_RINGS) * sizeof(*RINGS));
+			memset(RING_NONBLOCK + NUM_RINGS, 0, num - NUM_RINGS);
+			NUM_RINGS = num;
+		}
+		RINGS[fd[i]] = r;
+		RING_NONBLOCK[fd[i]] = 0;
+	}
+}
+
+/* fcntl(F_SETFL), keeping track of O_NONBLOCK for the
+ * ends of a ring.  Both ends share a file description,
+ * but each is meant to act on its own, like a pipe's. */
+int
+setFlags(int fd, int flags) {
+	if (ringOf(fd) != NULL) {
+		RING_NONBLOCK[fd] = (flags & O_NONBLOCK) != 0;
+	}
+	return fcntl(fd, F_SETFL, flags);
+}
+
+/* Both ends share one mapping, which goes with the last
+ * of them, so that a later fd with the same number is not
+ * taken for a ring. */
+void
+closeRing(int fd) {
+	struct ring *r = ringOf(fd);
+	int i;
+
+	if (r == NULL) {
+		return;
+	}
+	RINGS[fd] = NULL;
+	for (i = 0; i < NUM_RINGS; i++) {
+		if (RINGS[i] == r) {
+			return;
+		}
+	}
+	(void)munmap(r, sizeof(*r) + r->size);
+}
+
+int
+ringUsed(struct ring *r) {
+	return (int)(__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) -
+			__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE));
+}
+
+void
+futexWait(uint32_t *word, uint32_t val, int msecs) {
+#ifdef __linux
+	struct timespec ts;
+
+	ts.tv_sec = msecs / 1000;
+	ts.tv_nsec = (msecs % 1000) * 1000000L;
+	(void)syscall(SYS_futex, word, FUTEX_WAIT, val, &ts, NULL, 0);
+#else
+	(void)word; (void)val; (void)msecs;
+#endif
+}
+
+void
+futexWake(uint32_t *word) {
+#ifdef __linux
+	(void)syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#else
+	(void)word;
+#endif
+}
+
+/* Wait for the ring to have data (or be closed) or to
+ * have room, like poll(2) with POLLIN or POLLOUT.
+ * Returns 1 if it does, 0 after 'msecs'. */
+int
+ringPoll(struct ring *r, short events, int msecs) {
+	long long end = nsecs() + (long long)msecs * 1000000;
+
+	while (1) {
+		uint32_t *seq = (events & POLLIN) ? &r->wseq : &r->rseq;
+		uint32_t *waiting = (events & POLLIN) ? &r->rwait : &r->wwait;
+		uint32_t val = __atomic_load_n(seq, __ATOMIC_SEQ_CST);
+		int used = ringUsed(r);
+
+		if ((events & POLLIN) ? ((used > 0) || __atomic_load_n(&r->closed, __ATOMIC_ACQUIRE)) :
+		    ((uint32_t)used < r->size)) {
+			return 1;
+		}
+		if (nsecs() >= end) {
+			return 0;
+		}
+		if (WAKEUP) {
+			__atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+			used = ringUsed(r);
+			if ((events & POLLIN) ?
+			    ((used == 0) && !__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE)) :
+			    ((uint32_t)used == r->size)) {
+				futexWait(seq, val, msecs);
+			}
+			__atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+		} else {
+			(void)sched_yield();
+		}
+	}
+}
+
+/* Like write(2) on a non-blocking pipe: write as much
+ * as fits, or fail with EAGAIN if nothing does. */
+ssize_t
+ringWrite(struct ring *r, const char *buf, size_t count) {
+	uint64_t head = r->head;
+	uint64_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	size_t room = r->size - (head - tail);
+	size_t off = head % r->size;
+	size_t n;
+
+	if (room == 0) {
+		errno = EAGAIN;
+		return -1;
+	}
+	if (count > room) {
+		count = room;
+	}
+	n = r->size - off;
+	if (n > count) {
+		n = count;
+	}
+	memcpy(r->data + off, buf, n);
+	memcpy(r->data, buf + n, count - n);
+	__atomic_store_n(&r->head, head + count, __ATOMIC_SEQ_CST);
+
+	if (WAKEUP && __atomic_load_n(&r->rwait, __ATOMIC_SEQ_CST)) {
+		__atomic_add_fetch(&r->wseq, 1, __ATOMIC_SEQ_CST);
+		futexWake(&r->wseq);
+	}
+	return count;
+}
+
+/* Like read(2) on a pipe: wait for data unless the fd is
+ * non-blocking, return 0 once the writer is done and the
+ * ring is empty. */
+ssize_t
+ringRead(int fd, struct ring *r, char *buf, size_t count) {
+	uint64_t tail = r->tail;
+	uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	size_t off, n;
+
+	while (head == tail) {
+		if (__atomic_load_n(&r->closed, __ATOMIC_ACQUIRE)) {
+			/* The writer may have squeezed in more. */
+			if ((head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) == tail) {
+				return 0;
+			}
+			break;
+		}
+		if (RING_NONBLOCK[fd]) {
+			errno = EAGAIN;
+			return -1;
+		}
+		(void)ringPoll(r, POLLIN, 1000);
+		head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	}
+
+	if (count > head - tail) {
+		count = head - tail;
+	}
+	off = tail % r->size;
+	n = r->size - off;
+	if (n > count) {
+		n = count;
+	}
+	memcpy(buf, r->data + off, n);
+	memcpy(buf + n, r->data, count - n);
+	__atomic_store_n(&r->tail, tail + count, __ATOMIC_SEQ_CST);
+
+	if (WAKEUP && __atomic_load_n(&r->wwait, __ATOMIC_SEQ_CST)) {
+		__atomic_add_fetch(&r->rseq, 1, __ATOMIC_SEQ_CST);
+		futexWake(&r->rseq);
+	}
+	return count;
+}
+
+/* The ring's answer to FIONREAD, FIONSPACE, and
+ * FIONWRITE; see printFdQueueSize(). */
+int
+printRingSize(int fd, const char *which) {
+	struct ring *r = ringOf(fd);
+	int n;
+
+	if (r == NULL) {
+		return -1;
+	}
+	n = ringUsed(r);
+	if (strcmp(which, "space") == 0) {
+		n = r->size - n;
+		which = "Ring free";
+	} else {
+		which = "Ring used";
+	}
+	if (!QUIET) {
+		(void)printf("%-15s: %8d\n", which, n);
+	}
+	return n;
+}
+
+/* The writer is done; see endStream(). */
+void
+ringClose(struct ring *r) {
+	__atomic_store_n(&r->closed, 1, __ATOMIC_SEQ_CST);
+	if (WAKEUP) {
+		__atomic_add_fetch(&r->wseq, 1, __ATOMIC_SEQ_CST);
+		futexWake(&r->wseq);
+	}
+}
+
+/* With '-t mqueue', the channel is a POSIX message queue.
+ * On Linux, a mqd_t is a file descriptor that we can
+ * poll(2) and make non-blocking via fcntl(2), so only
+ * reading and writing need special treatment.  Note that
+ * mq_receive(3) insists on a buffer of at least
+ * mq_msgsize bytes. */
+long MQ_MSGSIZE = 0;
+char *MQ_BUF = NULL;
+
+void
+openMqueue(int fd[2]) {
+#ifdef HAVE_MQUEUE
+	char name[PATH_MAX];
+	struct mq_attr attr;
+	static int n = 0;
+
+	(void)snprintf(name, sizeof(name), "/%s.%ld.%d", PROGNAME, (long)getpid(), n++);
+	if ((fd[0] = mq_open(name, O_RDONLY|O_CREAT|O_EXCL, 0600, NULL)) < 0) {
+		openFailed("mq_open");
+		return;
+	}
+	if ((fd[1] = mq_open(name, O_WRONLY)) < 0) {
+		openFailed("mq_open");
+		(void)mq_close(fd[0]);
+		(void)mq_unlink(name);
+		return;
+	}
+	(void)mq_unlink(name);
+
+	if (mq_getattr(fd[0], &attr) < 0) {
+		err(EXIT_FAILURE, "mq_getattr");
+		/* NOTREACHED */
+	}
+	if (attr.mq_msgsize > MQ_MSGSIZE) {
+		MQ_MSGSIZE = attr.mq_msgsize;
+		if ((MQ_BUF = realloc(MQ_BUF, MQ_MSGSIZE)) == NULL) {
+			err(EXIT_FAILURE, "realloc");
+			/* NOTREACHED */
+		}
+	}
+#else
+	(void)fd;
+	errx(EXIT_FAILURE, "POSIX message queues are not supported on this platform.");
+	/* NOTREACHED */
+#endif
+}
+
+ssize_t
+mqWrite(int fd, const char *buf, size_t count) {
+#ifdef HAVE_MQUEUE
+	if (mq_send(fd, buf, count, 0) < 0) {
+		return -1;
+	}
+	return count;
+#else
+	(void)fd; (void)buf; (void)count;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+ssize_t
+mqRead(int fd, char *buf, size_t count) {
+#ifdef HAVE_MQUEUE
+	ssize_t n;
+
+	if ((long)count >= MQ_MSGSIZE) {
+		return mq_receive(fd, buf, count, NULL);
+	}
+	if ((n = mq_receive(fd, MQ_BUF, MQ_MSGSIZE, NULL)) > (ssize_t)count) {
+		/* Truncate, like a datagram socket would. */
+		n = count;
+	}
+	if (n > 0) {
+		memcpy(buf, MQ_BUF, n);
+	}
+	return n;
+#else
+	(void)fd; (void)buf; (void)count;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* With '-t msgq', the channel is a System V message
+ * queue.  Its id is not a file descriptor, so each end
+ * gets a descriptor for /dev/null to stand in for it
+ * (and to carry O_NONBLOCK), and every message needs a
+ * 'long' type in front of the data. */
+struct msgq {
+	int id;
+	pid_t owner;
+	size_t qbytes;
+	struct msgq *next;	/* on OWNED_MSGQS */
+};
+
+struct msgq **MSGQS = NULL;
+struct msgq *OWNED_MSGQS = NULL;
+int NUM_MSGQS = 0;
+char *MSGQ_BUF = NULL;
+size_t MSGQ_BUF_SIZE = 0;
+
+struct msgq *
+msgqOf(int fd) {
+	if ((fd < 0) || (fd >= NUM_MSGQS)) {
+		return NULL;
+	}
+	return MSGQS[fd];
+}
+
+void
+openMsgq(int fd[2]) {
+	struct msqid_ds ds;
+	struct msgq *q;
+	int i;
+
+	if ((q = malloc(sizeof(*q))) == NULL) {
+		err(EXIT_FAILURE, "malloc");
+		/* NOTREACHED */
+	}
+	if ((q->id = msgget(IPC_PRIVATE, IPC_CREAT|0600)) < 0) {
+		openFailed("msgget");
+		free(q);
+		return;
+	}
+	q->owner = getpid();
+
+	if (msgctl(q->id, IPC_STAT, &ds) < 0) {
+		err(EXIT_FAILURE, "msgctl(IPC_STAT)");
+		/* NOTREACHED */
+	}
+	if (SET_PIPEBUF > 0) {
+		ds.msg_qbytes = SET_PIPEBUF;
+		if (msgctl(q->id, IPC_SET, &ds) < 0) {
+			err(EXIT_FAILURE, "msgctl(IPC_SET)");
+			/* NOTREACHED */
+		}
+	}
+	q->qbytes = ds.msg_qbytes;
+
+	if ((fd[0] = open("/dev/null", O_RDWR)) < 0) {
+		openFailed("open");
+		(void)msgctl(q->id, IPC_RMID, NULL);
+		free(q);
+		return;
+	}
+	if ((fd[1] = dup(fd[0])) < 0) {
+		openFailed("dup");
+		(void)close(fd[0]);
+		(void)msgctl(q->id, IPC_RMID, NULL);
+		free(q);
+		return;
+	}
+
+	for (i = 0; i < 2; i++) {
+		if (fd[i] >= NUM_MSGQS) {
+			int num = fd[i] + 1;
+			if ((MSGQS = realloc(MSGQS, num * sizeof(*MSGQS))) == NULL) {
+				err(EXIT_FAILURE, "realloc");
+				/* NOTREACHED */
+			}
+			memset(MSGQS + NUM_MSGQS, 0, (num - NUM_MSGQS) * sizeof(*MSGQS));
+			NUM_MSGQS = num;
+		}
+		MSGQS[fd[i]] = q;
+	}
+	q->next = OWNED_MSGQS;
+	OWNED_MSGQS = q;
+}
+
+void
+freeMsgq(struct msgq *q) {
+	struct msgq **p;
+
+	for (p = &OWNED_MSGQS; *p != NULL; p = &(*p)->next) {
+		if (*p == q) {
+			*p = q->next;
+			break;
+		}
+	}
+	free(q);
+}
+
+/* Only the process that created a queue removes it, so
+ * that children exiting don't pull it out from under us.
+ * Closing one end of a queue that other processes still
+ * use ('remove' unset) leaves it to cleanup(). */
+void
+closeMsgq(int fd, int remove) {
+	struct msgq *q = msgqOf(fd);
+	int i;
+
+	if (q == NULL) {
+		return;
+	}
+	MSGQS[fd] = NULL;
+	for (i = 0; i < NUM_MSGQS; i++) {
+		if (MSGQS[i] == q) {
+			return;
+		}
+	}
+	if (q->owner != getpid()) {
+		freeMsgq(q);
+	} else if (remove) {
+		(void)msgctl(q->id, IPC_RMID, NULL);
+		freeMsgq(q);
+	}
+}
+
+char *
+msgqBuf(size_t count) {
+	if (sizeof(long) + count > MSGQ_BUF_SIZE) {
+		MSGQ_BUF_SIZE = sizeof(long) + count;
+		if ((MSGQ_BUF = realloc(MSGQ_BUF, MSGQ_BUF_SIZE)) == NULL) {
+			err(EXIT_FAILURE, "realloc");
+			/* NOTREACHED */
+		}
+	}
+	return MSGQ_BUF;
+}
+
+/* Never blocks, like a write to a non-blocking pipe. */
+ssize_t
+msgqWrite(struct msgq *q, const char *buf, size_t count) {
+	char *m = msgqBuf(count);
+	long type = 1;
+
+	if (count > q->qbytes) {
+		/* This would never fit. */
+		errno = EMSGSIZE;
+		return -1;
+	}
+	memcpy(m, &type, sizeof(type));
+	memcpy(m + sizeof(type), buf, count);
+	if (msgsnd(q->id, m, count, IPC_NOWAIT) < 0) {
+		if (errno == EINVAL) {
+			/* Larger than msgmax. */
+			errno = EMSGSIZE;
+		}
+		return -1;
+	}
+	return count;
+}
+
+ssize_t
+msgqRead(int fd, struct msgq *q, char *buf, size_t count) {
+	char *m = msgqBuf(count);
+	ssize_t n;
+
+	if (((n = msgrcv(q->id, m, count, 0, IPC_NOWAIT|MSG_NOERROR)) < 0) &&
+	    (errno == ENOMSG)) {
+		int flags;
+
+		if (((flags = fcntl(fd, F_GETFL, 0)) >= 0) && (flags & O_NONBLOCK)) {
+			errno = EAGAIN;
+			return -1;
+		}
+		n = msgrcv(q->id, m, count, 0, MSG_NOERROR);
+	}
+	if ((n < 0) && ((errno == EIDRM) || (errno == EINVAL))) {
+		/* The owner removed the queue: as good as EOF. */
+		return 0;
+	}
+	if (n > 0) {
+		memcpy(buf, m + sizeof(long), n);
+	}
+	return n;
+}
+
+/* There is nothing to poll(2) for a SysV message queue,
+ * so keep checking. */
+int
+msgqPoll(struct msgq *q, short events, int msecs) {
+	long long end = nsecs() + (long long)msecs * 1000000;
+
+	while (1) {
+		struct msqid_ds ds;
+		int ready = 1;
+
+		if (msgctl(q->id, IPC_STAT, &ds) < 0) {
+			err(EXIT_FAILURE, "msgctl(IPC_STAT)");
+			/* NOTREACHED */
+		}
+		if (events & POLLIN) {
+			ready = (ds.msg_qnum > 0);
+#ifdef MSG_CBYTES
+		} else {
+			ready = (MSG_CBYTES(&ds) < ds.msg_qbytes);
+#endif
+		}
+		if (ready) {
+			return 1;
+		}
+		if (nsecs() >= end) {
+			return 0;
+		}
+		(void)sched_yield();
+	}
+}
+
+/* See printFdQueueSize(): the number of messages in the
+ * queue, or, for "space", how many more bytes (SysV) or
+ * messages (POSIX) the queue can hold. */
+int
+printMsgQueueSize(int fd, const char *which) {
+	const char *name = "msg_qnum";
+	int n = -1;
+
+	if (IPC_TYPE == IPC_MSGQ) {
+		struct msgq *q;
+		struct msqid_ds ds;
+
+		if ((q = msgqOf(fd)) == NULL) {
+			return -1;
+		}
+		if (msgctl(q->id, IPC_STAT, &ds) < 0) {
+			err(EXIT_FAILURE, "msgctl(IPC_STAT)");
+			/* NOTREACHED */
+		}
+		n = ds.msg_qnum;
+		if (strcmp(which, "space") == 0) {
+			name = "msg_qbytes";
+			n = ds.msg_qbytes;
+#ifdef MSG_CBYTES
+			name = "msg_qbytes free";
+			n -= MSG_CBYTES(&ds);
+#endif
+		}
+	}
+#ifdef HAVE_MQUEUE
+	if (IPC_TYPE == IPC_MQUEUE) {
+		struct mq_attr attr;
+
+		if (mq_getattr(fd, &attr) < 0) {
+			err(EXIT_FAILURE, "mq_getattr");
+			/* NOTREACHED */
+		}
+		name = "mq_curmsgs";
+		n = attr.mq_curmsgs;
+		if (strcmp(which, "space") == 0) {
+			name = "mq free msgs";
+			n = attr.mq_maxmsg - attr.mq_curmsgs;
+		}
+	}
+#endif
+	if (!QUIET && (n >= 0)) {
+		(void)printf("%-15s: %8d\n", name, n);
+	}
+	return n;
+}
+
+/* With '-O zerocopy', TCP writes use MSG_ZEROCOPY and
+ * the kernel tells us on the error queue when it's done
+ * with our pages, and whether it had to copy them after
+ * all (as it does on loopback). */
+void
+reapZerocopy(int fd) {
+#ifdef HAVE_ZEROCOPY
+	char control[128];
+	struct msghdr msg;
+	struct cmsghdr *cm;
+
+	while (1) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE) < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				break;
+			}
+			err(EXIT_FAILURE, "recvmsg(MSG_ERRQUEUE)");
+			/* NOTREACHED */
+		}
+		for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+			struct sock_extended_err *ee;
+			long long range;
+
+			if (!((cm->cmsg_level == SOL_IP) && (cm->cmsg_type == IP_RECVERR)) &&
+			    !((cm->cmsg_level == SOL_IPV6) && (cm->cmsg_type == IPV6_RECVERR))) {
+				continue;
+			}
+			ee = (struct sock_extended_err *)CMSG_DATA(cm);
+			if ((ee->ee_errno != 0) || (ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)) {
+				continue;
+			}
+			/* Completions come as a range of sends. */
+			range = (long long)ee->ee_data - ee->ee_info + 1;
+			ZC_DONE += range;
+			if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+				ZC_COPIED += range;
+			}
+		}
+	}
+#else
+	(void)fd;
+#endif
+}
+
+/* Wait (a little) for the reader to release all pages
+ * before we close the socket. */
+void
+drainZerocopy(int fd) {
+	struct pollfd pfd;
+	int tries = 10;
+
+	pfd.fd = fd;
+	pfd.events = 0;
+	reapZerocopy(fd);
+	while ((ZC_DONE < ZC_SENDS) && (tries-- > 0)) {
+		/* The error queue always polls as POLLERR. */
+		(void)poll(&pfd, 1, 100);
+		reapZerocopy(fd);
+	}
+}
+
+void
+reportZerocopy() {
+	if (QUIET || !isZerocopy()) {
+		return;
+	}
+	(void)printf("%-15s: %8lld\n", "Zerocopy sends", ZC_SENDS);
+	(void)printf("%-15s: %8lld\n", "Zerocopy done", ZC_DONE);
+	(void)printf("%-15s: %8lld\n", "Zerocopy copied", ZC_COPIED);
+}
+
+/* poll(2), which for a ring or SysV message queue means
+ * waiting on the ring or queue. */
+int
+doPoll(struct pollfd *pfd, int msecs) {
+	struct ring *r;
+	struct msgq *q;
+
+	if ((r = ringOf(pfd->fd)) != NULL) {
+		return ringPoll(r, pfd->events, msecs);
+	} else if ((q = msgqOf(pfd->fd)) != NULL) {
+		return msgqPoll(q, pfd->events, msecs);
+	} else if (isZerocopy() && (pfd->events & POLLOUT)) {
+		/* Else pending completions keep us from sleeping. */
+		reapZerocopy(pfd->fd);
+	}
+	return poll(pfd, 1, msecs);
+}
+
+/* With '-e', readers wait for data via epoll(7) or
+ * kqueue(2) instead of poll(2), the way event driven
+ * servers do; both honor SO_RCVLOWAT where the kernel
+ * does. */
+int
+openEvents(int fd) {
+	int efd = -1;
+#if defined(HAVE_EPOLL)
+	struct epoll_event ev;
+
+	if ((efd = epoll_create1(0)) < 0) {
+		err(EXIT_FAILURE, "epoll_create1");
+		/* NOTREACHED */
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		err(EXIT_FAILURE, "epoll_ctl");
+		/* NOTREACHED */
+	}
+#elif defined(HAVE_KQUEUE)
+	struct kevent ev;
+
+	if ((efd = kqueue()) < 0) {
+		err(EXIT_FAILURE, "kqueue");
+		/* NOTREACHED */
+	}
+	EV_SET(&ev, fd, EVFILT_READ, EV_ADD, 0, 0, 0);
+	if (kevent(efd, &ev, 1, NULL, 0, NULL) < 0) {
+		err(EXIT_FAILURE, "kevent");
+		/* NOTREACHED */
+	}
+#else
+	(void)fd;
+#endif
+	return efd;
+}
+
+/* Returns 1 if the descriptor is readable, 0 if it
+ * didn't become readable within 'msecs'. */
+int
+waitEvents(int efd, int msecs) {
+	int n = 0;
+#if defined(HAVE_EPOLL)
+	struct epoll_event ev;
+
+	while (((n = epoll_wait(efd, &ev, 1, msecs)) < 0) && (errno == EINTR)) {
+		;
+	}
+	if (n < 0) {
+		err(EXIT_FAILURE, "epoll_wait");
+		/* NOTREACHED */
+	}
+#elif defined(HAVE_KQUEUE)
+	struct kevent ev;
+	struct timespec ts;
+
+	ts.tv_sec = msecs / 1000;
+	ts.tv_nsec = (msecs % 1000) * 1000000L;
+	while (((n = kevent(efd, NULL, 0, &ev, 1, &ts)) < 0) && (errno == EINTR)) {
+		;
+	}
+	if (n < 0) {
+		err(EXIT_FAILURE, "kevent");
+		/* NOTREACHED */
+	}
+#else
+	(void)efd;
+	(void)msecs;
+#endif
+	return n > 0;
+}
+
+/* With '-V', pipes are written to via vmsplice(2),
+ * mapping the arena's pages into the pipe rather than
+ * copying them, and drained by splice(2)ing them into
+ * /dev/null.  We don't gift the pages to the kernel
+ * (SPLICE_F_GIFT): the next write reuses the arena, so
+ * they aren't ours to give away. */
+#ifdef HAVE_ZEROCOPY
+/* A MSG_ZEROCOPY send of 'num' iovecs, for write(2)
+ * and writev(2) alike. */
+ssize_t
+zerocopySend(int fd, struct iovec *iov, int num) {
+	struct msghdr m;
+	ssize_t n;
+
+	memset(&m, 0, sizeof(m));
+	m.msg_iov = iov;
+	m.msg_iovlen = num;
+	if (((n = sendmsg(fd, &m, MSG_ZEROCOPY)) < 0) && (errno == ENOBUFS)) {
+		/* Too many completions pending; wait for
+		 * at least one rather than spin. */
+		struct pollfd pfd = { fd, 0, 0 };
+		long long done = ZC_DONE;
+
+		reapZerocopy(fd);
+		if (ZC_DONE == done) {
+			(void)poll(&pfd, 1, 1000);
+			reapZerocopy(fd);
+		}
+		n = sendmsg(fd, &m, MSG_ZEROCOPY);
+	}
+	if (n > 0) {
+		ZC_SENDS++;
+	} else if ((n < 0) && (errno == ENOBUFS)) {
+		/* Our pages are still in flight, which
+		 * for us is as good as a full buffer. */
+		errno = EAGAIN;
+	}
+	return n;
+}
+#endif
+
+ssize_t
+doWrite(int fd, const char *buf, size_t count) {
+	struct ring *r;
+	struct msgq *q;
+
+	if ((r = ringOf(fd)) != NULL) {
+		return ringWrite(r, buf, count);
+	} else if ((q = msgqOf(fd)) != NULL) {
+		return msgqWrite(q, buf, count);
+	} else if (IPC_TYPE == IPC_MQUEUE) {
+		return mqWrite(fd, buf, count);
+	}
+#ifdef HAVE_ZEROCOPY
+	if (isZerocopy()) {
+		struct iovec iov;
+
+		iov.iov_base = (void *)buf;
+		iov.iov_len = count;
+		return zerocopySend(fd, &iov, 1);
+	}
+#endif
+#ifdef SPLICE_F_NONBLOCK
+	if (SPLICE) {
+		struct iovec iov;
+
+		iov.iov_base = (void *)buf;
+		iov.iov_len = count;
+		return vmsplice(fd, &iov, 1, SPLICE_F_NONBLOCK);
+	}
+#endif
+	return write(fd, buf, count);
+}
+
+ssize_t
+doWritev(int fd, struct iovec *iov, int num) {
+#ifdef HAVE_ZEROCOPY
+	if (isZerocopy()) {
+		return zerocopySend(fd, iov, num);
+	}
+#endif
+	return writev(fd, iov, num);
+}
+
+ssize_t
+doRead(int fd, char *buf, size_t count) {
+	struct ring *r;
+	struct msgq *q;
+
+	if ((r = ringOf(fd)) != NULL) {
+		return ringRead(fd, r, buf, count);
+	} else if ((q = msgqOf(fd)) != NULL) {
+		return msgqRead(fd, q, buf, count);
+	} else if (IPC_TYPE == IPC_MQUEUE) {
+		return mqRead(fd, buf, count);
+	}
+#ifdef SPLICE_F_NONBLOCK
+	if (SPLICE) {
+		if ((DEVNULL < 0) &&
+		    ((DEVNULL = open("/dev/null", O_WRONLY)) < 0)) {
+			err(EXIT_FAILURE, "open");
+			/* NOTREACHED */
+		}
+		return splice(fd, NULL, DEVNULL, NULL, count,
+				SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+	}
+#endif
+	return read(fd, buf, count);
+}
+
+/* With '-b', datagrams are sent and received 'BATCH'
+ * at a time via sendmmsg(2) and recvmmsg(2).  We never
+ * look at the data, so every message points to the same
+ * 'count' bytes of the arena. */
+#ifdef HAVE_MMSG
+struct mmsghdr *MSGS = NULL;
+struct iovec *IOVS = NULL;
+int NUM_MSGS = 0;
+int BATCH_EOF = 0;	/* we've read an empty datagram we didn't return yet */
+
+void
+initBatch(char *buf, size_t count, int num) {
+	int i;
+
+	if (num > NUM_MSGS) {
+		if (((MSGS = realloc(MSGS, num * sizeof(*MSGS))) == NULL) ||
+		    ((IOVS = realloc(IOVS, num * sizeof(*IOVS))) == NULL)) {
+			err(EXIT_FAILURE, "realloc");
+			/* NOTREACHED */
+		}
+		NUM_MSGS = num;
+	}
+	for (i = 0; i < num; i++) {
+		IOVS[i].iov_base = buf;
+		IOVS[i].iov_len = count;
+		memset(&MSGS[i], 0, sizeof(MSGS[i]));
+		MSGS[i].msg_hdr.msg_iov = &IOVS[i];
+		MSGS[i].msg_hdr.msg_iovlen = 1;
+	}
+}
+#endif
+
+/* Send up to 'num' (at most BATCH) datagrams of 'count'
+ * bytes each in a single call; returns the number of
+ * datagrams sent, like sendmmsg(2). */
+int
+writeBatch(int fd, size_t count, int num) {
+#ifdef HAVE_MMSG
+	if (num > BATCH) {
+		num = BATCH;
+	}
+	initBatch(getArena(count), count, num);
+	return sendmmsg(fd, MSGS, num, MSG_DONTWAIT);
+#else
+	(void)fd; (void)count; (void)num;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* Receive up to 'num' datagrams of at most 'count'
+ * bytes each in a single call; returns the number of
+ * bytes received, or 0 if we got an empty datagram.  An
+ * empty datagram after others is returned on the next
+ * call. */
+ssize_t
+readBatch(int fd, size_t count, int num, long long *msgs) {
+#ifdef HAVE_MMSG
+	ssize_t total = 0;
+	int i, n;
+
+	if (BATCH_EOF) {
+		BATCH_EOF = 0;
+		return 0;
+	}
+	initBatch(getArena(count), count, num);
+	if ((n = recvmmsg(fd, MSGS, num, MSG_DONTWAIT, NULL)) < 0) {
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (MSGS[i].msg_len == 0) {
+			if (i == 0) {
+				return 0;
+			}
+			BATCH_EOF = 1;
+			break;
+		}
+		total += MSGS[i].msg_len;
+	}
+	*msgs += i;
+	return total;
+#else
+	(void)fd; (void)count; (void)num; (void)msgs;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* With '-I', data is written and read via io_uring(7),
+ * submitting up to 'URING_DEPTH' requests of the same
+ * size at a time and waiting for all of them to
+ * complete.  We talk to the kernel directly rather than
+ * via liburing.  A request that doesn't fit doesn't
+ * fail with -EAGAIN like write(2) would, even though
+ * the channel is non-blocking, but is parked until it
+ * does (see uringIO()); requests use the arena as a
+ * registered, fixed buffer if the kernel lets us. */
+#ifdef HAVE_URING
+struct uring {
+	pid_t pid;		/* the ring's owner; forks set up their own */
+	int fd;
+	unsigned *sqtail, *sqmask, *sqarray;
+	unsigned *cqhead, *cqtail, *cqmask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sqring, *cqring;
+	size_t sqlen, cqlen, sqeslen;
+	char *regbase;		/* the arena as registered, if it is */
+	size_t regsize;
+	int fixed;
+	int eof;		/* we've read an EOF we didn't return yet */
+	int *res;
+	long long enters;
+	long long parked;	/* requests that didn't complete right away */
+	long long cancelled;	/* and that we gave up on */
+} RING;
+
+void
+uringSetup() {
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	if (RING.pid == getpid()) {
+		return;
+	}
+	if (RING.pid != 0) {
+		/* Our parent's ring; leave it alone. */
+		(void)munmap(RING.sqes, RING.sqeslen);
+		if (RING.cqring != RING.sqring) {
+			(void)munmap(RING.cqring, RING.cqlen);
+		}
+		(void)munmap(RING.sqring, RING.sqlen);
+		(void)close(RING.fd);
+		free(RING.res);
+	}
+	memset(&RING, 0, sizeof(RING));
+
+	memset(&p, 0, sizeof(p));
+	if ((RING.fd = syscall(__NR_io_uring_setup, URING_DEPTH, &p)) < 0) {
+		err(EXIT_FAILURE, "io_uring_setup");
+		/* NOTREACHED */
+	}
+	RING.pid = getpid();
+
+	RING.sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	RING.cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) && (RING.cqlen > RING.sqlen)) {
+		RING.sqlen = RING.cqlen;
+	}
+	if ((RING.sqring = mmap(NULL, RING.sqlen, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, RING.fd, IORING_OFF_SQ_RING)) == MAP_FAILED) {
+		err(EXIT_FAILURE, "mmap");
+		/* NOTREACHED */
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		RING.cqring = RING.sqring;
+	} else if ((RING.cqring = mmap(NULL, RING.cqlen, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, RING.fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+		err(EXIT_FAILURE, "mmap");
+		/* NOTREACHED */
+	}
+	RING.sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+	if ((RING.sqes = mmap(NULL, RING.sqeslen, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_POPULATE, RING.fd, IORING_OFF_SQES)) == MAP_FAILED) {
+		err(EXIT_FAILURE, "mmap");
+		/* NOTREACHED */
+	}
+
+	sq = RING.sqring;
+	cq = RING.cqring;
+	RING.sqtail = (unsigned *)(sq + p.sq_off.tail);
+	RING.sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+	RING.sqarray = (unsigned *)(sq + p.sq_off.array);
+	RING.cqhead = (unsigned *)(cq + p.cq_off.head);
+	RING.cqtail = (unsigned *)(cq + p.cq_off.tail);
+	RING.cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+	RING.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	if ((RING.res = calloc(URING_DEPTH, sizeof(*RING.res))) == NULL) {
+		err(EXIT_FAILURE, "calloc");
+		/* NOTREACHED */
+	}
+}
+
+/* (Re-)register the arena whenever it has moved or
+ * grown.  Registered buffers count against
+ * RLIMIT_MEMLOCK on older kernels, so if we can't, we
+ * fall back to plain reads and writes. */
+void
+uringRegister() {
+	struct iovec iov;
+
+	if ((RING.regbase == ARENA) && (RING.regsize == ARENA_SIZE)) {
+		return;
+	}
+	if (RING.fixed) {
+		(void)syscall(__NR_io_uring_register, RING.fd,
+				IORING_UNREGISTER_BUFFERS, NULL, 0);
+	}
+	iov.iov_base = ARENA;
+	iov.iov_len = ARENA_SIZE;
+	RING.fixed = (syscall(__NR_io_uring_register, RING.fd,
+				IORING_REGISTER_BUFFERS, &iov, 1) == 0);
+	RING.regbase = ARENA;
+	RING.regsize = ARENA_SIZE;
+}
+/* Queue an SQE; returns it so the caller can fill it in. */
+struct io_uring_sqe *
+uringSqe(unsigned *tail) {
+	unsigned idx = *tail & *RING.sqmask;
+	struct io_uring_sqe *sqe = &RING.sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	RING.sqarray[idx] = idx;
+	(*tail)++;
+	return sqe;
+}
+
+/* Submit whatever we queued and wait up to 'ms'
+ * milliseconds for 'want' completions, then collect the
+ * results of our requests.  Returns how many we got. */
+int
+uringEnter(int submit, int want, int ms) {
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned head;
+	int n = 0;
+
+	memset(&arg, 0, sizeof(arg));
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	arg.ts = (unsigned long)&ts;
+
+	RING.enters++;
+	if ((syscall(__NR_io_uring_enter, RING.fd, submit, ms > 0 ? want : 0,
+			IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+			&arg, sizeof(arg)) < 0) && (errno != ETIME) && (errno != EINTR)) {
+		err(EXIT_FAILURE, "io_uring_enter");
+		/* NOTREACHED */
+	}
+
+	head = *RING.cqhead;
+	while (head != __atomic_load_n(RING.cqtail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &RING.cqes[head & *RING.cqmask];
+
+		/* The cancellations themselves don't count. */
+		if (cqe->user_data < (unsigned)URING_DEPTH) {
+			RING.res[cqe->user_data] = cqe->res;
+			n++;
+		}
+		head++;
+	}
+	__atomic_store_n(RING.cqhead, head, __ATOMIC_RELEASE);
+	return n;
+}
+#endif
+
+/* Submit 'num' (at most URING_DEPTH) writes of the same
+ * 'count' bytes, or reads of at most 'count' bytes into
+ * consecutive parts of the arena.  Unlike read(2) and
+ * write(2), io_uring doesn't fail a request on a full
+ * (or empty) buffer just because the fd is non-blocking,
+ * but parks it until there's room (or data).  So we
+ * take the requests that completed right away, give the
+ * others 'ms' milliseconds, and cancel whatever is still
+ * parked after that, counting those as an EAGAIN.
+ *
+ * Returns the number of bytes transferred and in 'done'
+ * the number of requests that transferred anything;
+ * like read(2), returns -1 and sets errno if none did,
+ * and 0 on EOF or an empty datagram. */
+ssize_t
+uringIO(int fd, int writing, size_t count, int num, int ms, int *done) {
+#ifdef HAVE_URING
+	ssize_t total = 0;
+	char *buf;
+	unsigned tail;
+	int i, reaped, tries, error = 0, eof = 0;
+
+	*done = 0;
+	if (num > URING_DEPTH) {
+		num = URING_DEPTH;
+	}
+	uringSetup();
+	if (RING.eof) {
+		RING.eof = 0;
+		return 0;
+	}
+	buf = getArena(writing ? count : count * num);
+	uringRegister();
+
+	tail = *RING.sqtail;
+	for (i = 0; i < num; i++) {
+		struct io_uring_sqe *sqe = uringSqe(&tail);
+
+		if (writing) {
+			sqe->opcode = RING.fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+			sqe->addr = (unsigned long)buf;
+		} else {
+			sqe->opcode = RING.fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+			sqe->addr = (unsigned long)(buf + i * count);
+		}
+		sqe->fd = fd;
+		sqe->len = count;
+		sqe->buf_index = 0;
+		sqe->user_data = i;
+		RING.res[i] = INT_MIN;
+	}
+	__atomic_store_n(RING.sqtail, tail, __ATOMIC_RELEASE);
+
+	reaped = uringEnter(num, 0, 0);
+	if (reaped < num) {
+		RING.parked += num - reaped;
+		if (ms > 0) {
+			reaped += uringEnter(0, num - reaped, ms);
+		}
+	}
+	if (reaped < num) {
+		int cancels = 0;
+
+		tail = *RING.sqtail;
+		for (i = 0; i < num; i++) {
+			if (RING.res[i] == INT_MIN) {
+				struct io_uring_sqe *sqe = uringSqe(&tail);
+
+				sqe->opcode = IORING_OP_ASYNC_CANCEL;
+				sqe->addr = i;
+				sqe->user_data = URING_DEPTH + i;
+				cancels++;
+			}
+		}
+		__atomic_store_n(RING.sqtail, tail, __ATOMIC_RELEASE);
+		RING.cancelled += cancels;
+		reaped += uringEnter(cancels, num - reaped, 1000);
+		/* A second at a time, for no more than ten. */
+		for (tries = 0; reaped < num; tries++) {
+			if (tries == 10) {
+				errx(EXIT_FAILURE, "%d io_uring requests not done 10 seconds after cancelling them.",
+						num - reaped);
+				/* NOTREACHED */
+			}
+			reaped += uringEnter(0, num - reaped, 1000);
+		}
+	}
+
+	/* Anything that went out before a request came
+	 * up empty (or got cancelled) is still data. */
+	for (i = 0; i < num; i++) {
+		int n = RING.res[i];
+
+		if (n > 0) {
+			total += n;
+			(*done)++;
+		} else if (n == 0) {
+			eof = 1;
+		} else if (!error) {
+			error = (n == -ECANCELED) ? EAGAIN : -n;
+		}
+	}
+	if (total > 0) {
+		RING.eof = !writing && eof;
+		return total;
+	}
+	if (eof) {
+		return 0;
+	}
+	errno = error;
+	return -1;
+#else
+	(void)fd; (void)writing; (void)count; (void)num; (void)ms; (void)done;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* The number of io_uring_enter(2) calls so far, and
+ * whether the arena is registered. */
+long long
+uringEnters() {
+#ifdef HAVE_URING
+	return RING.enters;
+#else
+	return 0;
+#endif
+}
+
+int
+uringFixed() {
+#ifdef HAVE_URING
+	return RING.fixed;
+#else
+	return 0;
+#endif
+}
+
+/* How many requests had to wait for room (or data), and
+ * how many of those we gave up on. */
+long long
+uringParked(int cancelled) {
+#ifdef HAVE_URING
+	return cancelled ? RING.cancelled : RING.parked;
+#else
+	(void)cancelled;
+	return 0;
+#endif
+}
+
+/* With '-v', the first chunk and the '-n' additional
+ * chunks are written with a single writev(2) (or as few
+ * as IOV_MAX allows) and read back with readv(2), rather
+ * than one call per chunk. */
+struct iovec *PATTERN = NULL;
+int PATTERN_LEN = 0;
+int PATTERN_BYTES = 0;
+
+void
+initPattern() {
+	int i, num, chunk2 = CHUNK2;
+	char *buf;
+
+	/* Same chunks as writeData() writes in chunk mode. */
+	num = NUM_CHUNKS + 1;
+	if (chunk2 < 1) {
+		chunk2 = CHUNK1;
+		num = NUM_CHUNKS > 1 ? NUM_CHUNKS : 1;
+	}
+
+	buf = getArena(chunk2 > CHUNK1 ? chunk2 : CHUNK1);
+	if ((PATTERN = realloc(PATTERN, num * sizeof(*PATTERN))) == NULL) {
+		err(EXIT_FAILURE, "realloc");
+		/* NOTREACHED */
+	}
+	PATTERN_LEN = num;
+	PATTERN_BYTES = 0;
+	for (i = 0; i < num; i++) {
+		PATTERN[i].iov_base = buf;
+		PATTERN[i].iov_len = i ? chunk2 : CHUNK1;
+		PATTERN_BYTES += PATTERN[i].iov_len;
+	}
+}
+
+/* Write all chunks of the pattern, either vectored or
+ * one at a time, until they're all written or one
+ * of them doesn't fit, counting the calls that wrote
+ * anything.  Returns the number of bytes written or -1
+ * if not even the first call succeeded. */
+ssize_t
+writePattern(int fd, int vectored, long long *calls) {
+	ssize_t total = 0;
+	int i, num;
+
+	for (i = 0; i < PATTERN_LEN; i += num) {
+		ssize_t n, want = 0;
+		int j;
+
+		num = vectored ? PATTERN_LEN - i : 1;
+		if (num > IOV_MAX) {
+			num = IOV_MAX;
+		}
+		for (j = i; j < i + num; j++) {
+			want += PATTERN[j].iov_len;
+		}
+
+		if (vectored) {
+			n = doWritev(fd, &PATTERN[i], num);
+		} else {
+			n = doWrite(fd, PATTERN[i].iov_base, PATTERN[i].iov_len);
+		}
+		if (n < 0) {
+			return total ? total : -1;
+		}
+		(*calls)++;
+		total += n;
+		if (n < want) {
+			break;
+		}
+	}
+	return total;
+}
+
+ssize_t
+readPattern(int fd) {
+	return readv(fd, PATTERN, PATTERN_LEN > IOV_MAX ? IOV_MAX : PATTERN_LEN);
+}
+
+/* Defined further down, once we know how to open
+ * a scratch channel. */
+int findMsgsize(int count);
+void openChannel(int fd[2]);
+void closeChannel(int fd[2]);
+void closeEnd(int fd);
+
+#define REMOTE_SETTLE_MS 200
+int SETTLED = 0;
+
+int
+writeChunk(int fd, int count) {
+	char *buf;
+	int n, wanted;
+	long long start, ns;
+
+	wanted = count;
+	if ((MSGSIZE > 0) && (count > MSGSIZE)) {
+		/* We already know this won't fit. */
+		count = MSGSIZE;
+	}
+	buf = getArena(count);
+	again:
+	start = nsecs();
+	n = doWrite(fd, buf, count);
+	ns = nsecs() - start;
+	WRITE_NS += ns;
+	if (n >= 0) {
+		addTiming(&WRITE_TIMES, count, ns);
+	}
+	if (n < 0) {
+		/* EAGAIN / EWOULDBLOCK: I/O would have been blocked;
+		 * EMSGSIZE:             chunk > internal buffer size;
+		 * ENOBUFS:              buffer queue is full
+		 * EINVAL:               with '-g', too many segments */
+		if ((errno == EMSGSIZE) || (errno == ENOBUFS) ||
+		    (GSO && (errno == EINVAL))) {
+			if (MSGSIZE < 0) {
+				MSGSIZE = findMsgsize(count);
+				if ((MSGSIZE > 0) && (MSGSIZE < count)) {
+					count = MSGSIZE;
+					goto again;
+				}
+			}
+			/* Even a datagram of MSGSIZE doesn't fit
+			 * anymore, so the buffer is almost full;
+			 * see if we can squeeze in a smaller one. */
+			count /= 2;
+			if (count < 1) {
+				(void)fprintf(stderr, "Unable to write even a single byte: %s\n", strerror(errno));
+				return -1;
+			}
+			goto again;
+		}
+		if ((errno == EAGAIN) && REMOTE && !SETTLED) {
+			/* Across the network, the send buffer
+			 * keeps emptying as long as the receiver
+			 * acknowledges data into its buffer, so
+			 * only give up once it has settled. */
+			struct pollfd pfd = { fd, POLLOUT, 0 };
+			if (doPoll(&pfd, REMOTE_SETTLE_MS) > 0) {
+				goto again;
+			}
+			SETTLED = 1;
+		}
+		if (errno == EAGAIN) {
+			(void)fprintf(stderr, "Unable to write %d more byte%s: %s\n",
+					count, count > 1 ? "s" : "", strerror(errno));
+			return -1;
+		} else {
+			err(EXIT_FAILURE, "write");
+		}
+	}
+
+	TOTAL += n;
+	WRITES++;
+	if (GSO) {
+		GSO_SEGS += (n + GSO_SIZE - 1) / GSO_SIZE;
+	}
+	if (!QUIET) {
+		(void)printf("Wrote %8d out of %8d byte%s. %s(Total: %8d)\n",
+				n, wanted,
+				wanted > 1 ? "s" : "",
+				wanted > 1 ? "" : " ",
+				TOTAL);
+	}
+
+	if (n > LARGEST_CHUNK) {
+		LARGEST_CHUNK = n;
+	}
+	return n;
+}
+
+/* Write 'num' datagrams of 'count' bytes via sendmmsg(2),
+ * BATCH at a time, until they're all written or the
+ * buffer is full. */
+void
+writeBatches(int fd, int count, int num) {
+	int calls = 0, sent = 0;
+
+	if ((MSGSIZE > 0) && (count > MSGSIZE)) {
+		count = MSGSIZE;
+	}
+
+	while (sent < num) {
+		int n, k = num - sent;
+
+		if (k > BATCH) {
+			k = BATCH;
+		}
+
+		calls++;
+		if ((n = writeBatch(fd, count, k)) < 0) {
+			if (((errno == EMSGSIZE) || (errno == ENOBUFS)) && (MSGSIZE < 0)) {
+				MSGSIZE = findMsgsize(count);
+				if ((MSGSIZE > 0) && (MSGSIZE < count)) {
+					count = MSGSIZE;
+					continue;
+				}
+			}
+			if ((errno == EAGAIN) || (errno == EMSGSIZE) || (errno == ENOBUFS)) {
+				(void)fprintf(stderr, "Unable to write %d more datagram%s: %s\n",
+						num - sent, num - sent > 1 ? "s" : "", strerror(errno));
+				break;
+			}
+			err(EXIT_FAILURE, "sendmmsg");
+			/* NOTREACHED */
+		}
+
+		sent += n;
+		TOTAL += n * count;
+		WRITES += n;
+		if (count > LARGEST_CHUNK) {
+			LARGEST_CHUNK = count;
+		}
+		if (!QUIET) {
+			(void)printf("Sent  %8d out of %8d datagram%s. (Total: %8d)\n",
+					n, k, k > 1 ? "s" : " ", TOTAL);
+		}
+		if (n < k) {
+			break;
+		}
+	}
+
+	if (!QUIET) {
+		(void)printf("%-15s: %8d\n", "sendmmsg calls", calls);
+		(void)printf("%-15s: %8d\n", "Datagrams", sent);
+		if (sent > 0) {
+			(void)printf("%-15s: %8.3f\n", "Calls/datagram", (double)calls / sent);
+		}
+	}
+}
+
+/* Write 'num' chunks of 'count' bytes via io_uring(7),
+ * URING_DEPTH at a time, until they're all written or
+ * the buffer is full. */
+void
+writeUring(int fd, int count, int num) {
+	long long start, ns;
+	int written = 0;
+
+	if ((MSGSIZE > 0) && (count > MSGSIZE)) {
+		count = MSGSIZE;
+	}
+
+	while (written < num) {
+		int done, k = num - written;
+		ssize_t n;
+
+		if (k > URING_DEPTH) {
+			k = URING_DEPTH;
+		}
+
+		start = nsecs();
+		n = uringIO(fd, 1, count, k, 0, &done);
+		ns = nsecs() - start;
+		WRITE_NS += ns;
+		if (n < 0) {
+			if (((errno == EMSGSIZE) || (errno == ENOBUFS)) && (MSGSIZE < 0)) {
+				MSGSIZE = findMsgsize(count);
+				if ((MSGSIZE > 0) && (MSGSIZE < count)) {
+					count = MSGSIZE;
+					continue;
+				}
+			}
+			if ((errno == EAGAIN) || (errno == EMSGSIZE) || (errno == ENOBUFS)) {
+				(void)fprintf(stderr, "Unable to write %d more chunk%s: %s\n",
+						num - written, num - written > 1 ? "s" : "",
+						strerror(errno));
+				break;
+			}
+			err(EXIT_FAILURE, "io_uring write");
+			/* NOTREACHED */
+		}
+		addTiming(&WRITE_TIMES, n, ns);
+
+		written += done;
+		TOTAL += n;
+		WRITES += done;
+		if (count > LARGEST_CHUNK) {
+			LARGEST_CHUNK = count;
+		}
+		if (!QUIET) {
+			(void)printf("Wrote %8zd out of %8d bytes in %d request%s. (Total: %8d)\n",
+					n, k * count, k, k > 1 ? "s" : "", TOTAL);
+		}
+		if (n < (ssize_t)k * count) {
+			break;
+		}
+	}
+}
+
+void
+writeVectored(int fd) {
+	long long calls = 0, start;
+	ssize_t n;
+
+	initPattern();
+	start = nsecs();
+	n = writePattern(fd, 1, &calls);
+	WRITE_NS += nsecs() - start;
+
+	if (n < 0) {
+		(void)fprintf(stderr, "Unable to write %d byte%s in %d chunk%s: %s\n",
+				PATTERN_BYTES, PATTERN_BYTES > 1 ? "s" : "",
+				PATTERN_LEN, PATTERN_LEN > 1 ? "s" : "", strerror(errno));
+		return;
+	}
+
+	TOTAL += n;
+	WRITES += calls;
+	if (n > LARGEST_CHUNK) {
+		LARGEST_CHUNK = n;
+	}
+	if (!QUIET) {
+		(void)printf("Wrote %8zd out of %8d bytes in %lld writev call%s.\n",
+				n, PATTERN_BYTES, calls, calls > 1 ? "s" : "");
+	}
+}
+
+void
+writeLoop(int fd, int count, int inc) {
+	int i = 0;
+	while (1) {
+		int n;
+
+		n = writeChunk(fd, count);
+		if ((n != count) || (n < 0)) {
+			if (n > 0) {
+				i++;
+			}
+			break;
+		}
+
+		if (inc == -1) {
+			count *= 2;
+		} else {
+			count += inc;
+		}
+		i++;
+	}
+	RESULT.iterations = i;
+	if (!QUIET) {
+		(void)printf("%-15s: %8d\n", "Iterations", i);
+	}
+}
+
+void
+usage() {
+	(void)fprintf(stderr,
+	    "usage: %s [-DEFJVacefhklquv] [-B bytes] [-C cpus] [-H host[:port]] [-I num]\n"
+	    "       [-b num] [-[PRS] bufsiz] [-d secs] [-g size] [-[LW] lowat] [-N num]\n"
+	    "       [-O opts] [-Q num] [-i num] [-j P[:C]] [-m mode] [-n num] [-o format]\n"
+	    "       [-p pct] [-r trials] [-s type] [-t type] [-w warmup] [-X w[:r]]\n"
+	    "       [-Y ms] [-Z ms[:int]] [chunk] [chunk|inc]\n"
+	    "-B bytes     in throughput mode, stop after this many bytes\n"
+	    "-C cpus      pin writers (and readers) to these CPUs, e.g. 0,2-3[:4-7]\n"
+	    "             (throughput mode only)\n"
+	    "-D           serve as the reader for '-H' on other hosts\n"
+	    "-E           count context switches, cycles, instructions, cache misses,\n"
+	    "             and page faults while writing and reading (Linux only)\n"
+	    "-F           wake up the other side via futex(2) instead of spinning\n"
+	    "             (shm only, Linux only)\n"
+	    "-H host      run the test against 'ipcbuf -D' on this host[:port]\n"
+	    "             (with -D: listen on this address)\n"
+	    "-I num       also write/read via io_uring(7), submitting num requests\n"
+	    "             at a time (chunk/throughput mode only, Linux only)\n"
+	    "-J           with -j, give each writer its own channel and reader\n"
+	    "-L lowat     try to set the SO_RCVLOWAT to this many bytes\n"
+	    "             (socket/socketpair only)\n"
+	    "-N num       in fanout mode, open this many channels (default: 1000);\n"
+	    "             in chain mode, connect this many hops (default: 3)\n"
+	    "-O opts      set TCP options: nodelay, cork, zerocopy, joined by '+'\n"
+	    "             (inet stream sockets only)\n"
+	    "-P size      try to set the pipe's size to this many bytes"
+	    " (Linux only)\n"
+	    "             or the size of the shm ring or msgq; in chain mode,\n"
+	    "             a:b:c sets the size of each hop\n"
+	    "-Q num       with -f, sample the queue size every num reads\n"
+	    "-R size      try to set the SO_RCVBUF size to this many bytes\n"
+	    "             (socket/socketpair only)\n"
+	    "-S size      try to set the SO_SNDBUF size to this many bytes\n"
+	    "             (socket/socketpair only)\n"
+	    "-V           also test vmsplice(2)/splice(2) (pipe only, Linux only);\n"
+	    "             in chain mode, also forward via splice(2) (pipe/fifo)\n"
+	    "-W lowat     try to set the SO_SNDLOWAT to this many bytes\n"
+	    "             (socket/socketpair only, not Linux)\n"
+	    "-X w[:r]     in backpressure mode, write at w and read at r bytes/s\n"
+	    "             (0: full speed; default: 10000000, and half that)\n"
+	    "-Y ms        in throughput mode, sample the socket buffers and TCP_INFO\n"
+	    "             every ms milliseconds (inet stream sockets only, Linux only)\n"
+	    "-Z ms[:int]  in backpressure mode, have the reader stall for ms\n"
+	    "             milliseconds every int ms (default: 1000)\n"
+	    "-a           page-align the read/write buffer\n"
+	    "-b num       also send/receive datagrams num at a time via\n"
+	    "             sendmmsg(2)/recvmmsg(2) (chunk/throughput mode only)\n"
+	    "-c           write two consecutive chunks\n"
+	    "-d secs      in throughput mode, write for this many seconds"
+	    " (default: 1);\n"
+	    "             with -D, the longest test to serve (default: 60)\n"
+	    "-e           have the reader wait for data via epoll(7)/kqueue(2)\n"
+	    "-f           drain without checking the queue size before every read\n"
+	    "             and report the time to empty (chunk/loop mode only)\n"
+	    "-g size      also send datagrams as segments of this size via\n"
+	    "             UDP_SEGMENT and receive them via UDP_GRO\n"
+	    "             (inet dgram sockets only, Linux only)\n"
+	    "-h           print this help\n"
+	    "-i num       in latency or chain mode, send this many messages"
+	    " (default: 10000)\n"
+	    "-j P[:C]     in throughput mode, run P writers and C readers\n"
+	    "             (default: as many readers as writers)\n"
+	    "-k           run the reader in a thread instead of a\n"
+	    "             separate process\n"
+	    "-l           write in a loop\n"
+	    "-m mode      use this mode (backpressure, chain, chunk, fanout,\n"
+	    "             latency, loop, probe, subpage, throughput, tune)\n"
+	    "-n num       write this many additional chunks\n"
+	    "-o format    report results as text, csv, or json\n"
+	    "-p pct       in tune mode, find the smallest buffer with this\n"
+	    "             percentage of the peak throughput (default: 95)\n"
+	    "-q           be quiet and only print the final number\n"
+	    "-r trials    run the test this many times and summarize the results\n"
+	    "-s type      use this type of socket"
+	    " ([inet[6]-]dgram or [inet[6]-]stream)\n"
+	    "-t type      use this type of IPC"
+	    "\n             (fifo, mqueue, msgq, pipe, shm, socket, socketpair)\n"
+	    "-u           time every read and write and report the times\n"
+	    "             by size (chunk/loop mode only)\n"
+	    "-v           also write the chunks with a single writev(2)\n"
+	    "             (chunk/throughput mode only)\n"
+	    "-w warmup    discard this many runs before the trials\n"
+	    "[chunk]      initial chunk size; 1 if not given\n"
+	    "             (in subpage mode, sizes around page boundaries)\n"
+	    "[chunk|inc]  second chunk size or loop increment\n"
+	    "             if not given, use first chunk size in chunk mode,\n"
+	    "             double first chunk size in loop mode\n"
+	    "-[LOPRSWjst] and both chunk arguments also take a comma separated list\n"
+	    "(numbers also a range a..b) to sweep across all combinations\n",
+	    PROGNAME);
+}
+
+/* Chunk sizes on and around page boundaries, for
+ * subpage mode without a chunk size; returns how many. */
+#define MAX_SUBPAGE_SIZES 16
+#define SUBPAGE_NS 100000000LL	/* writing, per size */
+int
+subpageSizes(int *sizes) {
+	int page = (int)sysconf(_SC_PAGESIZE);
+	int n = 0;
+
+	sizes[n++] = 1;
+	sizes[n++] = 16;
+	sizes[n++] = 128;
+	sizes[n++] = 512;
+	sizes[n++] = page / 2;
+	sizes[n++] = page - 1;
+	sizes[n++] = page;
+	sizes[n++] = page + 1;
+	sizes[n++] = page + page / 2;
+	sizes[n++] = 2 * page - 1;
+	sizes[n++] = 2 * page;
+	sizes[n++] = 2 * page + 1;
+	sizes[n++] = 4 * page;
+	sizes[n++] = 4 * page + 1;
+	return n;
+}
+
+/* The same as a list for a sweep. */
+char *
+subpageList() {
+	int sizes[MAX_SUBPAGE_SIZES];
+	char list[BUFSIZ], *p;
+	int i, n, len = 0;
+
+	n = subpageSizes(sizes);
+	for (i = 0; i < n; i++) {
+		len += snprintf(list + len, sizeof(list) - len, "%s%d",
+				i ? "," : "", sizes[i]);
+	}
+	if ((p = strdup(list)) == NULL) {
+		err(EXIT_FAILURE, "strdup");
+		/* NOTREACHED */
+	}
+	return p;
+}
+
+void
+setPipeSize(int fd) {
+	if (SET_PIPEBUF == -1) {
+		/* '-P size' not given */
+		return;
+	}
+
+#ifndef F_SETPIPE_SZ
+	(void)fd;
+	(void)fprintf(stderr, "Sorry, setting the pipe size is not supported on this platform.\n");
+	exit(EXIT_FAILURE);
+	/* NOTREACHED */
+#else
+	if ((fcntl(fd, F_SETPIPE_SZ, SET_PIPEBUF)) < 0) {
+		openFailed("fcntl(F_SETPIPE_SZ)");
+	}
+#endif
+}
+
+int
+inputNumber(const char *in, int threshold, const char *what) {
+	int n;
+	char *endptr;
+	if (((n = (int)strtol(in, &endptr, 10)) < threshold) ||
+	    (*endptr != '\0')) {
+		(void)fprintf(stderr, "Please provide a number >= %d for %s.\n",
+		    threshold, what);
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+	return n;
+}
+
+/* A comma separated list or an 'a..b' range asks
+ * for a sweep across all of the given values. */
+int
+isList(const char *s) {
+	return (strchr(s, ',') != NULL) || (strstr(s, "..") != NULL);
+}
+
+void
+setIpcType(const char *type) {
+	if (strcasecmp(type, "fifo") == 0) {
+		IPC_TYPE = IPC_FIFO;
+	} else if (strcasecmp(type, "pipe") == 0) {
+		IPC_TYPE = IPC_PIPE;
+	} else if (strcasecmp(type, "socket") == 0) {
+		IPC_TYPE = IPC_SOCKET;
+	} else if (strcasecmp(type, "socketpair") == 0) {
+		IPC_TYPE = IPC_SOCKETPAIR;
+	} else if (strcasecmp(type, "shm") == 0) {
+		IPC_TYPE = IPC_SHM;
+	} else if (strcasecmp(type, "mqueue") == 0) {
+		IPC_TYPE = IPC_MQUEUE;
+	} else if (strcasecmp(type, "msgq") == 0) {
+		IPC_TYPE = IPC_MSGQ;
+	} else {
+		errx(EXIT_FAILURE, "Unknown IPC type '%s'.\n"
+				   "Supported types are: fifo, mqueue, msgq, pipe, shm, socket, socketpair.", type);
+		/* NOTREACHED */
+	}
+}
+
+void
+setSockType(char *type) {
+	SET_SOCKDOMAIN = "PF_LOCAL";
+	SOCK_DOMAIN = PF_LOCAL;
+	SOCK_TYPE = SOCK_DGRAM;
+	SET_SOCKTYPE = type;
+
+	if (strncmp(SET_SOCKTYPE, "inet-", strlen("inet-")) == 0) {
+		SET_SOCKDOMAIN = "PF_INET";
+		SOCK_DOMAIN = PF_INET;
+		SET_SOCKTYPE += strlen("inet-");
+	} else if (strncmp(SET_SOCKTYPE, "inet6-", strlen("inet6-")) == 0) {
+		SET_SOCKDOMAIN = "PF_INET6";
+		SOCK_DOMAIN = PF_INET6;
+		SET_SOCKTYPE += strlen("inet6-");
+	}
+
+	if (strcasecmp(SET_SOCKTYPE, "stream") == 0) {
+		SOCK_TYPE = SOCK_STREAM;
+	} else if ((strcasecmp(SET_SOCKTYPE, "dgram") != 0)) {
+		(void)fprintf(stderr, "Invalid socket type. Please use one of [inet[6]-(dgram|stream).\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+}
+
+/* Parse '-O' options: "none" or any of "nodelay",
+ * "cork", and "zerocopy", joined by '+'. */
+int
+parseTcpOpts(const char *spec) {
+	char *copy, *opt, *next;
+	int opts = 0;
+
+	if ((copy = strdup(spec)) == NULL) {
+		err(EXIT_FAILURE, "strdup");
+		/* NOTREACHED */
+	}
+	for (opt = copy; opt != NULL; opt = next) {
+		if ((next = strchr(opt, '+')) != NULL) {
+			*next++ = '\0';
+		}
+		if (strcasecmp(opt, "nodelay") == 0) {
+			opts |= OPT_NODELAY;
+		} else if (strcasecmp(opt, "cork") == 0) {
+#ifndef TCP_CORK_OPT
+			errx(EXIT_FAILURE, "Sorry, TCP_CORK is not supported on this platform.");
+			/* NOTREACHED */
+#endif
+			opts |= OPT_CORK;
+		} else if (strcasecmp(opt, "zerocopy") == 0) {
+#ifndef HAVE_ZEROCOPY
+			errx(EXIT_FAILURE, "Sorry, MSG_ZEROCOPY is not supported on this platform.");
+			/* NOTREACHED */
+#endif
+			opts |= OPT_ZEROCOPY;
+		} else if (strcasecmp(opt, "none") != 0) {
+			errx(EXIT_FAILURE, "Unknown TCP option '%s'.\n"
+					   "Supported options are: cork, nodelay, none, zerocopy.", opt);
+			/* NOTREACHED */
+		}
+	}
+	free(copy);
+	return opts;
+}
+
+const char *
+tcpOptsName() {
+	static char name[BUFSIZ];
+
+	(void)snprintf(name, sizeof(name), "%s%s%s",
+			TCP_OPTS & OPT_NODELAY ? "+nodelay" : "",
+			TCP_OPTS & OPT_CORK ? "+cork" : "",
+			TCP_OPTS & OPT_ZEROCOPY ? "+zerocopy" : "");
+	return name[0] ? name + 1 : "none";
+}
+
+/* "a[:b]" as for '-X' and '-Z'; returns whether 'b'
+ * was given. */
+int
+parsePair(char *spec, int *a, int *b, int threshold, const char *what) {
+	char *colon;
+
+	if ((colon = strchr(spec, ':')) != NULL) {
+		*colon = '\0';
+		*b = inputNumber(colon + 1, threshold, what);
+	}
+	*a = inputNumber(spec, threshold, what);
+	return colon != NULL;
+}
+
+/* Parse "P[:C]" into the number of writers and readers;
+ * without C, use as many readers as writers. */
+void
+parseWorkers(char *spec, int *writers, int *readers) {
+	char *colon;
+
+	if ((colon = strchr(spec, ':')) != NULL) {
+		*colon = '\0';
+		*readers = inputNumber(colon + 1, 1, "-j");
+	}
+	*writers = inputNumber(spec, 1, "-j");
+	if (colon == NULL) {
+		*readers = *writers;
+	}
+}
+
+/* Parse a list of CPUs such as "0,2,4-7". */
+int *
+parseCpus(char *spec, int *num) {
+	char *item;
+	int *cpus = NULL;
+
+	*num = 0;
+	while ((item = strsep(&spec, ",")) != NULL) {
+		char *dash;
+		int lo, hi;
+
+		if ((dash = strchr(item, '-')) != NULL) {
+			*dash = '\0';
+			hi = inputNumber(dash + 1, 0, "-C");
+		}
+		lo = inputNumber(item, 0, "-C");
+		if (dash == NULL) {
+			hi = lo;
+		}
+		for (; lo <= hi; lo++) {
+			if ((cpus = realloc(cpus, (*num + 1) * sizeof(*cpus))) == NULL) {
+				err(EXIT_FAILURE, "realloc");
+				/* NOTREACHED */
+			}
+			cpus[(*num)++] = lo;
+		}
+	}
+	if (*num == 0) {
+		errx(EXIT_FAILURE, "Please provide at least one CPU for -C.");
+		/* NOTREACHED */
+	}
+	return cpus;
+}
+
+/* '-P a:b:c', the pipe sizes of the hops in chain mode. */
+int *
+parseHopSizes(char *spec, int *num) {
+	char *item;
+	int *sizes = NULL;
+
+	*num = 0;
+	while ((item = strsep(&spec, ":")) != NULL) {
+		if ((sizes = realloc(sizes, (*num + 1) * sizeof(*sizes))) == NULL) {
+			err(EXIT_FAILURE, "realloc");
+			/* NOTREACHED */
+		}
+		sizes[(*num)++] = inputNumber(item, 1, "-P");
+	}
+	return sizes;
+}
+
+void
+parseArgs(int argc, char **argv) {
+	extern char *optarg;
+	extern int optind;
+	int ch;
+	int sflag = 0, Oflag = 0, Nflag = 0, Xflag = 0, Zflag = 0, dflag = 0, pflag = 0;
+	int jreaders = 0;
+
+	char *type = NULL;
+	char *mode = NULL;
+	char *format = NULL;
+	char *cpus = NULL;
+
+	while ((ch = getopt(argc, argv, "B:C:DEFH:I:JL:N:O:P:Q:R:S:VW:X:Y:Z:ab:cd:efg:hi:j:klm:n:o:p:qr:s:t:uvw:")) != -1) {
+		switch(ch) {
+		case 'B':
+			BYTE_LIMIT = inputNumber(optarg, 1, "-B");
+			break;
+		case 'C':
+			cpus = optarg;
+			break;
+		case 'D':
+			DAEMON = 1;
+			break;
+		case 'E':
+			PERF = 1;
+			break;
+		case 'F':
+			WAKEUP = 1;
+			break;
+		case 'H':
+			REMOTE = optarg;
+			break;
+		case 'J':
+			INDEPENDENT = 1;
+			break;
+		case 'L':
+			if (isList(optarg)) {
+				SWEEP_RCVLOWATS = optarg;
+			} else {
+				SET_RCVLOWAT = inputNumber(optarg, 1, "-L");
+			}
+			break;
+		case 'I':
+			URING_DEPTH = inputNumber(optarg, 1, "-I");
+			break;
+		case 'N':
+			CHANNELS = HOPS = inputNumber(optarg, 1, "-N");
+			Nflag = 1;
+			break;
+		case 'O':
+			if (isList(optarg)) {
+				SWEEP_TCPOPTS = optarg;
+			} else {
+				TCP_OPTS = parseTcpOpts(optarg);
+			}
+			Oflag = 1;
+			break;
+		case 'P':
+			if (strchr(optarg, ':') != NULL) {
+				HOP_PIPEBUFS = parseHopSizes(optarg, &NUM_HOP_PIPEBUFS);
+				SET_PIPEBUF = HOP_PIPEBUFS[0];
+			} else if (isList(optarg)) {
+				SWEEP_PIPEBUFS = optarg;
+			} else {
+				SET_PIPEBUF = inputNumber(optarg, 1, "-P");
+			}
+			break;
+		case 'Q':
+			SAMPLE_EVERY = inputNumber(optarg, 1, "-Q");
+			break;
+		case 'R':
+			if (isList(optarg)) {
+				SWEEP_RCVBUFS = optarg;
+			} else {
+				SET_RCVBUF = inputNumber(optarg, 1, "-R");
+			}
+			break;
+		case 'S':
+			if (isList(optarg)) {
+				SWEEP_SNDBUFS = optarg;
+			} else {
+				SET_SNDBUF = inputNumber(optarg, 1, "-S");
+			}
+			break;
+		case 'V':
+			VMSPLICE = 1;
+			break;
+		case 'X':
+			(void)parsePair(optarg, &WRITE_RATE, &READ_RATE, 0, "-X");
+			Xflag = 1;
+			break;
+		case 'Y':
+			SERIES_MS = inputNumber(optarg, 1, "-Y");
+			break;
+		case 'Z':
+			(void)parsePair(optarg, &STALL_MS, &STALL_EVERY, 1, "-Z");
+			Zflag = 1;
+			break;
+		case 'W':
+			if (isList(optarg)) {
+				SWEEP_SNDLOWATS = optarg;
+			} else {
+				SET_SNDLOWAT = inputNumber(optarg, 1, "-W");
+			}
+			break;
+		case 'a':
+			ALIGN = 1;
+			break;
+		case 'b':
+			BATCH = inputNumber(optarg, 1, "-b");
+			break;
+		case 'c':
+			MODE = CHUNK;
+			break;
+		case 'd':
+			DURATION = inputNumber(optarg, 1, "-d");
+			dflag = 1;
+			break;
+		case 'e':
+			EVENTS = 1;
+			break;
+		case 'f':
+			FAST_DRAIN = 1;
+			break;
+		case 'g':
+			GSO_SIZE = inputNumber(optarg, 1, "-g");
+			break;
+		case 'k':
+			THREADED = 1;
+			break;
+		case 'h':
+			usage();
+			exit(EXIT_SUCCESS);
+			/* NOTREACHED */
+			break;
+		case 'i':
+			ITERATIONS = inputNumber(optarg, 1, "-i");
+			break;
+		case 'j':
+			if (strchr(optarg, ':') != NULL) {
+				jreaders = 1;
+			}
+			if (isList(optarg)) {
+				SWEEP_WORKERS = optarg;
+			} else {
+				parseWorkers(optarg, &WRITERS, &READERS);
+			}
+			break;
+		case 'l':
+			MODE = LOOP;
+			break;
+		case 'm':
+			mode = optarg;
+			break;
+		case 'n':
+			NUM_CHUNKS = inputNumber(optarg, 0, "-n");
+			break;
+		case 'o':
+			format = optarg;
+			break;
+		case 'p':
+			TUNE_PCT = inputNumber(optarg, 1, "-p");
+			pflag = 1;
+			break;
+		case 'q':
+			QUIET = 1;
+			break;
+		case 'r':
+			TRIALS = inputNumber(optarg, 1, "-r");
+			break;
+		case 's':
+			SET_SOCKTYPE = optarg;
+			sflag = 1;
+			break;
+		case 't':
+			type = optarg;
+			break;
+		case 'u':
+			TIMING = 1;
+			break;
+		case 'v':
+			VECTORED = 1;
+			break;
+		case 'w':
+			WARMUP = inputNumber(optarg, 0, "-w");
+			break;
+		case '?':
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 2) {
+		usage();
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (mode) {
+		if (strcasecmp(mode, "loop") == 0) {
+			MODE = LOOP;
+		} else if (strcasecmp(mode, "chunk") == 0) {
+			MODE = CHUNK;
+		} else if (strcasecmp(mode, "latency") == 0) {
+			MODE = LATENCY;
+		} else if (strcasecmp(mode, "probe") == 0) {
+			MODE = PROBE;
+		} else if (strcasecmp(mode, "throughput") == 0) {
+			MODE = THROUGHPUT;
+		} else if (strcasecmp(mode, "tune") == 0) {
+			MODE = TUNE;
+		} else if (strcasecmp(mode, "fanout") == 0) {
+			MODE = FANOUT;
+		} else if (strcasecmp(mode, "subpage") == 0) {
+			MODE = SUBPAGE;
+		} else if (strcasecmp(mode, "chain") == 0) {
+			MODE = CHAIN;
+		} else if (strcasecmp(mode, "backpressure") == 0) {
+			MODE = BACKPRESSURE;
+		} else {
+			errx(EXIT_FAILURE, "Unknown mode '%s'.\n"
+					   "Supported modes are: backpressure, chain, chunk, fanout, latency,\n"
+					   "loop, probe, subpage, throughput, tune.", mode);
+			/* NOTREACHED */
+		}
+	}
+
+	if (type) {
+		if (isList(type)) {
+			SWEEP_TYPES = type;
+		} else {
+			setIpcType(type);
+		}
+	} else if (DAEMON || REMOTE) {
+		IPC_TYPE = IPC_SOCKET;
+	}
+
+	if (isList(SET_SOCKTYPE)) {
+		SWEEP_SOCKTYPES = SET_SOCKTYPE;
+	} else {
+		setSockType(SET_SOCKTYPE);
+	}
+
+	if (argc > 0) {
+		if (isList(argv[0])) {
+			SWEEP_CHUNKS1 = argv[0];
+		} else {
+			CHUNK1 = inputNumber(argv[0], 0, "initial chunk size");
+		}
+	} else if ((MODE == THROUGHPUT) || (MODE == TUNE) || (MODE == FANOUT) ||
+	    (MODE == CHAIN) || (MODE == BACKPRESSURE)) {
+		/* Single byte writes are not what anybody
+		 * would want to measure throughput with. */
+		CHUNK1 = BUFSIZ;
+	} else if (MODE == SUBPAGE) {
+		/* All the sizes of subpageSizes(). */
+		CHUNK1 = 0;
+	}
+
+	if (argc > 1) {
+		if (isList(argv[1])) {
+			SWEEP_CHUNKS2 = argv[1];
+		} else {
+			CHUNK2 = inputNumber(argv[1], 0, "second argument");
+		}
+	}
+
+	if (format) {
+		if (strcasecmp(format, "text") == 0) {
+			FORMAT = FMT_TEXT;
+		} else if (strcasecmp(format, "csv") == 0) {
+			FORMAT = FMT_CSV;
+		} else if (strcasecmp(format, "json") == 0) {
+			FORMAT = FMT_JSON;
+		} else {
+			errx(EXIT_FAILURE, "Unknown output format '%s'.\n"
+					   "Supported formats are: csv, json, text.", format);
+			/* NOTREACHED */
+		}
+	}
+
+	if (MODE == TUNE) {
+		int sock = (IPC_TYPE == IPC_SOCKET) || (IPC_TYPE == IPC_SOCKETPAIR);
+
+		if (TUNE_PCT > 100) {
+			(void)fprintf(stderr, "'-p' takes a percentage of at most 100.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+
+		if (SWEEP_TYPES || SWEEP_SOCKTYPES || SWEEP_RCVLOWATS || SWEEP_SNDLOWATS ||
+		    SWEEP_TCPOPTS || SWEEP_CHUNKS1 || SWEEP_CHUNKS2 || SWEEP_WORKERS) {
+			(void)fprintf(stderr, "In tune mode, only '-P', '-R', and '-S' take a range.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (format) {
+			(void)fprintf(stderr, "Tune mode can only report as text.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (!isSizable() && !sock) {
+			(void)fprintf(stderr, "There's no buffer size to tune for '-t %s'.\n", ipcTypeName());
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (sock && (SET_SNDBUF > 0) && (SET_RCVBUF > 0)) {
+			(void)fprintf(stderr, "Nothing left to tune with both '-R' and '-S' given.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+#ifndef F_SETPIPE_SZ
+		if (IPC_TYPE == IPC_PIPE) {
+			(void)fprintf(stderr, "Sorry, setting the pipe size is not supported on this platform.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+#endif
+	} else if (pflag) {
+		(void)fprintf(stderr, "'-p' can only be used in tune mode.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if ((MODE != TUNE) && (SWEEP_TYPES || SWEEP_SOCKTYPES || SWEEP_PIPEBUFS || SWEEP_RCVBUFS ||
+	    SWEEP_SNDBUFS || SWEEP_RCVLOWATS || SWEEP_SNDLOWATS || SWEEP_TCPOPTS ||
+	    SWEEP_CHUNKS1 || SWEEP_CHUNKS2 || SWEEP_WORKERS)) {
+		if (format && (FORMAT == FMT_TEXT)) {
+			(void)fprintf(stderr, "A sweep can only be reported as csv or json.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (FORMAT == FMT_TEXT) {
+			FORMAT = FMT_CSV;
+		}
+	}
+
+	if (FORMAT != FMT_TEXT) {
+		QUIET = 1;
+	}
+
+	if (VMSPLICE) {
+#ifndef SPLICE_F_NONBLOCK
+		(void)fprintf(stderr, "Sorry, vmsplice(2) is not supported on this platform.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+#endif
+		if ((MODE == CHAIN) && (IPC_TYPE != IPC_PIPE) && (IPC_TYPE != IPC_FIFO) &&
+		    !SWEEP_TYPES) {
+			/* Forwarding via splice(2) needs a pipe on
+			 * one side. */
+			(void)fprintf(stderr, "In chain mode, '-V' only makes sense with '-t pipe' or '-t fifo'.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if ((MODE != CHAIN) && (IPC_TYPE != IPC_PIPE) && !SWEEP_TYPES) {
+			(void)fprintf(stderr, "Using vmsplice(2) only makes sense with '-t pipe'.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if ((MODE != LOOP) && (MODE != CHUNK) && (MODE != THROUGHPUT) && (MODE != CHAIN)) {
+			(void)fprintf(stderr, "'-V' can only be used in chain, chunk, loop, or throughput mode.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	if (BATCH) {
+#ifndef HAVE_MMSG
+		(void)fprintf(stderr, "Sorry, sendmmsg(2) is not supported on this platform.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+#endif
+		if ((MODE != CHUNK) && (MODE != THROUGHPUT)) {
+			(void)fprintf(stderr, "'-b' can only be used in chunk or throughput mode.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	if (URING_DEPTH) {
+#ifndef HAVE_URING
+		(void)fprintf(stderr, "Sorry, io_uring(7) is not supported on this platform.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+#endif
+		if ((MODE != CHUNK) && (MODE != THROUGHPUT)) {
+			(void)fprintf(stderr, "'-I' can only be used in chunk or throughput mode.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (URING_DEPTH > URING_MAX) {
+			(void)fprintf(stderr, "'-I' can't be larger than %d.\n", URING_MAX);
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (!SWEEP_TYPES && ((IPC_TYPE == IPC_SHM) || (IPC_TYPE == IPC_MQUEUE) ||
+		    (IPC_TYPE == IPC_MSGQ))) {
+			(void)fprintf(stderr, "'-I' only works with file descriptors, not '-t %s'.\n",
+					ipcTypeName());
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	if (cpus) {
+		char *colon;
+#ifndef HAVE_AFFINITY
+		(void)fprintf(stderr, "Sorry, pinning processes to CPUs is not supported on this platform.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+#endif
+		if ((colon = strchr(cpus, ':')) != NULL) {
+			*colon = '\0';
+			READER_CPUS = parseCpus(colon + 1, &NUM_READER_CPUS);
+		}
+		WRITER_CPUS = parseCpus(cpus, &NUM_WRITER_CPUS);
+	}
+
+	if ((cpus || INDEPENDENT || SWEEP_WORKERS || (WRITERS > 1) || (READERS > 1)) &&
+	    (MODE != THROUGHPUT)) {
+		(void)fprintf(stderr, "'-C', '-J', and '-j' can only be used in throughput mode.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (INDEPENDENT && jreaders) {
+		(void)fprintf(stderr, "With '-J', every channel has one writer and one reader; "
+				"'-j' takes no ':C'.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (THREADED && (cpus || INDEPENDENT || SWEEP_WORKERS || (WRITERS > 1) || (READERS > 1))) {
+		(void)fprintf(stderr, "'-k' can't be used with '-C', '-J', or '-j'.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (THREADED && URING_DEPTH) {
+		/* The ring is per process. */
+		(void)fprintf(stderr, "'-k' can't be used with '-I'.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (THREADED && (BATCH || VECTORED)) {
+		/* The message and iovec arrays and the pattern
+		 * are global and resized on every call. */
+		(void)fprintf(stderr, "'-k' can't be used with '-b' or '-v'.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (THREADED && (MODE == PROBE)) {
+		(void)fprintf(stderr, "'-k' can't be used in probe mode.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (PERF) {
+#ifndef HAVE_PERF
+		(void)fprintf(stderr, "Sorry, '-E' is only supported on Linux.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+#endif
+		if ((MODE != CHUNK) && (MODE != LOOP) && (MODE != THROUGHPUT)) {
+			(void)fprintf(stderr, "'-E' can only be used in chunk, loop, or throughput mode.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	if (Nflag && (MODE != FANOUT) && (MODE != CHAIN)) {
+		(void)fprintf(stderr, "'-N' can only be used in chain or fanout mode.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (HOP_PIPEBUFS && (MODE != CHAIN)) {
+		(void)fprintf(stderr, "'-P a:b:...' can only be used in chain mode.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if ((MODE == CHAIN) && !SWEEP_TYPES && !SWEEP_SOCKTYPES && !isChainable()) {
+		(void)fprintf(stderr, "Chain mode only works with '-t pipe', '-t fifo', or '-t socketpair -s stream'.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if ((MODE == CHAIN) && (THREADED || URING_DEPTH)) {
+		(void)fprintf(stderr, "'-I' and '-k' can't be used in chain mode.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (SERIES_MS) {
+#ifndef HAVE_TCPINFO
+		(void)fprintf(stderr, "Sorry, '-Y' is only supported on Linux.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+#endif
+		if (MODE != THROUGHPUT) {
+			(void)fprintf(stderr, "'-Y' can only be used in throughput mode.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (!SWEEP_TYPES && !SWEEP_SOCKTYPES && !isTcp()) {
+			(void)fprintf(stderr, "'-Y' only makes sense with '-t socket -s inet-stream' or '-s inet6-stream'.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (cpus || INDEPENDENT || SWEEP_WORKERS || (WRITERS > 1) || (READERS > 1)) {
+			(void)fprintf(stderr, "'-Y' can't be used with '-C', '-J', or '-j'.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	if ((Xflag || Zflag) && (MODE != BACKPRESSURE)) {
+		(void)fprintf(stderr, "'-X' and '-Z' can only be used in backpressure mode.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (READ_RATE < 0) {
+		/* Half as fast as the writer, unless the
+		 * reader stalls instead. */
+		READ_RATE = Zflag ? 0 : WRITE_RATE / 2;
+	}
+
+	if (MODE == BACKPRESSURE) {
+		if (!SWEEP_TYPES && !SWEEP_SOCKTYPES &&
+		    ((IPC_TYPE == IPC_SHM) || (IPC_TYPE == IPC_MQUEUE) ||
+		    (IPC_TYPE == IPC_MSGQ) || isUdp())) {
+			(void)fprintf(stderr, "Backpressure mode only works with pipes, fifos, and sockets other than UDP.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (THREADED) {
+			(void)fprintf(stderr, "'-k' can't be used in backpressure mode.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (STALL_MS >= STALL_EVERY) {
+			(void)fprintf(stderr, "With '-Z ms:int', ms has to be less than int.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	if (DAEMON) {
+		if (SWEEP_TYPES || SWEEP_SOCKTYPES || (IPC_TYPE != IPC_SOCKET)) {
+			(void)fprintf(stderr, "'-D' only takes a single inet or inet6 '-s'.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (SOCK_DOMAIN == PF_LOCAL) {
+			SOCK_DOMAIN = PF_INET;
+		}
+		if (!dflag) {
+			/* The longest test we serve. */
+			DURATION = 60;
+		}
+	} else if (REMOTE) {
+		if (SWEEP_TYPES || (IPC_TYPE != IPC_SOCKET) ||
+		    (!SWEEP_SOCKTYPES && (SOCK_DOMAIN == PF_LOCAL))) {
+			(void)fprintf(stderr, "'-H' needs an inet or inet6 socket, e.g. '-s inet-stream'.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if ((MODE != CHUNK) && (MODE != LOOP) && (MODE != THROUGHPUT) && (MODE != LATENCY)) {
+			(void)fprintf(stderr, "'-H' can only be used in chunk, latency, loop, or throughput mode.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (cpus || INDEPENDENT || SWEEP_WORKERS || (WRITERS > 1) || (READERS > 1) ||
+		    THREADED || BATCH || VECTORED || URING_DEPTH || GSO_SIZE || EVENTS || FAST_DRAIN) {
+			/* These change the reader, too, which is
+			 * the daemon's business. */
+			(void)fprintf(stderr, "'-H' can't be used with '-C', '-I', '-J', '-b', '-e', '-f', '-g', '-j', '-k', or '-v'.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	if ((MODE == FANOUT) && !SWEEP_TYPES && !SWEEP_SOCKTYPES &&
+	    isDgram() && (SOCK_DOMAIN != PF_LOCAL)) {
+		(void)fprintf(stderr, "UDP drops datagrams rather than block, so fanout mode can't fill it.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (MODE == SUBPAGE) {
+#if !defined(F_GETPIPE_SZ) || !defined(O_DIRECT)
+		(void)fprintf(stderr, "Sorry, subpage mode is only supported on Linux.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+#endif
+		if (SWEEP_TYPES || (IPC_TYPE != IPC_PIPE)) {
+			(void)fprintf(stderr, "Subpage mode only works with '-t pipe'.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if ((CHUNK1 < 1) && !SWEEP_CHUNKS1 && (format && (FORMAT != FMT_TEXT))) {
+			/* One record per size. */
+			SWEEP_CHUNKS1 = subpageList();
+		}
+		if ((CHUNK1 < 1) && !SWEEP_CHUNKS1 && ((TRIALS > 1) || (WARMUP > 0))) {
+			(void)fprintf(stderr, "In subpage mode, '-r' and '-w' need a chunk size.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	if ((TRIALS > 1) || (WARMUP > 0)) {
+		if (MODE == TUNE) {
+			(void)fprintf(stderr, "'-r' and '-w' can't be used in tune mode.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if ((FORMAT == FMT_TEXT) && (VMSPLICE || BATCH || VECTORED || URING_DEPTH || GSO_SIZE)) {
+			(void)fprintf(stderr, "With '-r' or '-w', '-I', '-V', '-b', '-g', and '-v' need '-o csv' or '-o json'.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	if (FAST_DRAIN && (MODE != CHUNK) && (MODE != LOOP)) {
+		(void)fprintf(stderr, "'-f' can only be used in chunk or loop mode.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (SAMPLE_EVERY && !FAST_DRAIN) {
+		(void)fprintf(stderr, "'-Q' only makes sense with '-f'.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (TIMING && (MODE != CHUNK) && (MODE != LOOP)) {
+		(void)fprintf(stderr, "'-u' can only be used in chunk or loop mode.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (TIMING && (BATCH || VECTORED)) {
+		(void)fprintf(stderr, "'-u' times single calls; it can't be used with '-b' or '-v'.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (EVENTS) {
+#if !defined(HAVE_EPOLL) && !defined(HAVE_KQUEUE)
+		(void)fprintf(stderr, "Sorry, '-e' needs epoll(7) or kqueue(2), which this platform doesn't have.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+#endif
+		if ((MODE != CHUNK) && (MODE != LOOP) && (MODE != THROUGHPUT) && (MODE != TUNE)) {
+			(void)fprintf(stderr, "'-e' can only be used in chunk, loop, throughput, or tune mode.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (!SWEEP_TYPES && ((IPC_TYPE == IPC_SHM) || (IPC_TYPE == IPC_MSGQ))) {
+			(void)fprintf(stderr, "'-e' can't be used with '-t %s'.\n", ipcTypeName());
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	if (((SET_RCVLOWAT != -1) || (SET_SNDLOWAT != -1) ||
+	     SWEEP_RCVLOWATS || SWEEP_SNDLOWATS) && !SWEEP_TYPES &&
+	    (IPC_TYPE != IPC_SOCKET) && (IPC_TYPE != IPC_SOCKETPAIR)) {
+		(void)fprintf(stderr, "Setting the low-water marks only makes sense with '-t socket' or '-t socketpair'.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+#ifdef __linux
+	if ((SET_SNDLOWAT != -1) || SWEEP_SNDLOWATS) {
+		(void)fprintf(stderr, "Sorry, Linux doesn't allow changing SO_SNDLOWAT ('-W').\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+#endif
+
+	if (WAKEUP) {
+#ifndef __linux
+		(void)fprintf(stderr, "Sorry, '-F' is only supported on Linux.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+#endif
+		if ((IPC_TYPE != IPC_SHM) && !SWEEP_TYPES) {
+			(void)fprintf(stderr, "'-F' only makes sense with '-t shm'.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+#ifndef HAVE_MQUEUE
+	if (IPC_TYPE == IPC_MQUEUE) {
+		(void)fprintf(stderr, "Sorry, '-t mqueue' is not supported on this platform.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+#endif
+
+	if (VECTORED && !SWEEP_TYPES && ((IPC_TYPE == IPC_SHM) ||
+	    (IPC_TYPE == IPC_MQUEUE) || (IPC_TYPE == IPC_MSGQ))) {
+		(void)fprintf(stderr, "'-v' can't be used with '-t %s'.\n", ipcTypeName());
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if ((IPC_TYPE == IPC_SHM) && !SWEEP_TYPES) {
+		if (!INDEPENDENT && ((WRITERS > 1) || (READERS > 1))) {
+			(void)fprintf(stderr, "A shared memory ring has a single writer and reader; use '-J'.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+	}
+
+	if (VECTORED && (MODE != CHUNK) && (MODE != THROUGHPUT)) {
+		(void)fprintf(stderr, "'-v' can only be used in chunk or throughput mode.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (!isSizable() && !SWEEP_TYPES &&
+	    ((SET_PIPEBUF != -1) || SWEEP_PIPEBUFS)) {
+		(void)fprintf(stderr, "Setting the buffer size only makes sense with '-t pipe', '-t shm', or '-t msgq'.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (sflag && !SWEEP_TYPES &&
+	    (IPC_TYPE != IPC_SOCKET) && (IPC_TYPE != IPC_SOCKETPAIR)) {
+		(void)fprintf(stderr, "Setting the socket type only makes sense with '-t socket' or '-t socketpair'.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if ((SOCK_DOMAIN != PF_LOCAL) && !SWEEP_TYPES &&
+		(IPC_TYPE != IPC_SOCKET)) {
+		(void)fprintf(stderr, "'inet/inet6' type sockets can only be specified with '-t socket'.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (Oflag && !SWEEP_TYPES && !SWEEP_SOCKTYPES && !isTcp()) {
+		(void)fprintf(stderr, "'-O' only makes sense with '-t socket' and an inet[6]-stream socket.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (GSO_SIZE) {
+#ifndef HAVE_GSO
+		(void)fprintf(stderr, "Sorry, UDP_SEGMENT is only supported on Linux.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+#else
+		if ((MODE != CHUNK) && (MODE != LOOP) && (MODE != THROUGHPUT)) {
+			(void)fprintf(stderr, "'-g' can only be used in chunk, loop, or throughput mode.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if (!SWEEP_TYPES && !SWEEP_SOCKTYPES && !isUdp()) {
+			(void)fprintf(stderr, "'-g' only makes sense with '-t socket' and an inet[6]-dgram socket.\n");
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+#endif
+	}
+
+	if (BATCH && !SWEEP_TYPES && !SWEEP_SOCKTYPES && !isDgram()) {
+		(void)fprintf(stderr, "'-b' only makes sense with datagram sockets or socketpairs.\n");
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (((MODE == THROUGHPUT) || (MODE == LATENCY) || (MODE == TUNE) ||
+	    (MODE == FANOUT) || (MODE == CHAIN) || (MODE == BACKPRESSURE)) && (CHUNK1 < 1)) {
+		(void)fprintf(stderr, "Please provide a chunk size >= 1 for %s mode.\n",
+				modeName());
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+}
+
+/* Size the arena up front for the largest chunk we're
+ * going to write, so that we don't have to grow it in
+ * the middle of the test. */
+void
+sizeArena(int fd) {
+	int size = CHUNK1;
+
+	if (MODE == CHUNK) {
+		if (CHUNK2 > size) {
+			size = CHUNK2;
+		}
+	} else {
+		/* In loop mode, we keep going until the buffer
+		 * is full, so the last chunk may be about as
+		 * large as the buffer itself. */
+		int n = 0;
+
+		if ((IPC_TYPE == IPC_SOCKET) || (IPC_TYPE == IPC_SOCKETPAIR)) {
+			socklen_t len = sizeof(n);
+			if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &n, &len) < 0) {
+				n = 0;
+			}
+		} else if (IPC_TYPE == IPC_SHM) {
+			n = ringSize();
+		} else {
+#ifdef F_GETPIPE_SZ
+			n = fcntl(fd, F_GETPIPE_SZ, 0);
+#else
+			n = PIPE_BUF * 16;
+#endif
+		}
+		if ((n > 0) && (n < INT_MAX / 2) && (2 * n > size)) {
+			size = 2 * n;
+		}
+	}
+
+	if (size < BUFSIZ) {
+		size = BUFSIZ;
+	}
+	(void)getArena(size);
+}
+
+void
+writeData(int fd, int rfd) {
+	long long kmem;
+	int queued;
+
+	sizeArena(fd);
+	WRITE_NS = 0;
+	GSO_SEGS = 0;
+	SETTLED = 0;
+
+	if (setFlags(fd, O_NONBLOCK) < 0) {
+		err(EXIT_FAILURE, "fcntl set flags");
+		/* NOTREACHED */
+	}	
+
+	(void)printFdQueueSize(fd, "space");
+	if (!QUIET) {
+		(void)printf("\n");
+	}
+
+	perfStart(&RESULT.wperf);
+	if (MODE == LOOP) {
+		writeLoop(fd, CHUNK1, CHUNK2);
+	} else {
+		int i = 0;
+		int chunk2 = CHUNK2;
+		if (chunk2 < 1) {
+			i = 1;
+			chunk2 = CHUNK1;
+		}
+		if (!QUIET) {
+			int total = CHUNK1;
+
+			(void)printf("Trying to write %d", CHUNK1);
+			if (!i) {
+				total = CHUNK1 + (NUM_CHUNKS * chunk2);
+				(void)printf(" + (%d * %d) = %d",
+					NUM_CHUNKS, chunk2, total);
+			} else if ((CHUNK1 > 1) && (NUM_CHUNKS > 1)) {
+				total = CHUNK1 * NUM_CHUNKS;
+				(void)printf(" * %d = %d",
+					NUM_CHUNKS, total);
+			}
+			(void)printf(" byte%s...\n", total > 1 ? "s" : "");
+		}
+		if (WRITEV) {
+			writeVectored(fd);
+		} else if (URING) {
+			long long enters = uringEnters();
+			long long parked = uringParked(0);
+
+			writeUring(fd, CHUNK1, 1);
+			writeUring(fd, chunk2, NUM_CHUNKS - i);
+			if (!QUIET) {
+				(void)printf("%-15s: %8lld\n", "io_uring calls",
+						uringEnters() - enters);
+				(void)printf("%-15s: %8lld\n", "Parked",
+						uringParked(0) - parked);
+				(void)printf("%-15s: %8s\n", "Fixed buffers",
+						uringFixed() ? "yes" : "no");
+			}
+		} else if (MMSG) {
+			writeChunk(fd, CHUNK1);
+			writeBatches(fd, chunk2, NUM_CHUNKS - i);
+		} else {
+			writeChunk(fd, CHUNK1);
+			for (; i<NUM_CHUNKS; i++) {
+				writeChunk(fd, chunk2);
+			}
+		}
+	}
+	perfStop(&RESULT.wperf);
+
+	reportTimings(SPLICE ? "vmsplice" : URING ? "io_uring" : "write", &WRITE_TIMES);
+	queued = printFdQueueSize(fd, "write");
+	if (!QUIET) {
+		if (MSGSIZE > 0) {
+			(void)printf("%-15s: %8d\n", "MSGSIZE", MSGSIZE);
+		}
+		if (VECTORED) {
+			(void)printf("%-15s: %8lld\n", "Write time (ns)", WRITE_NS);
+			if ((queued > 0) && (TOTAL > 0)) {
+				(void)printf("%-15s: %8.3f\n", "Queued/written",
+						(double)queued / TOTAL);
+			}
+		}
+		if (isZerocopy()) {
+			/* Pages still queued are not done yet. */
+			reapZerocopy(fd);
+			reportZerocopy();
+		}
+		if (GSO) {
+			(void)printf("%-15s: %8lld\n", "Segments", GSO_SEGS);
+			if (TOTAL > 0) {
+				(void)printf("%-15s: %8.3f\n", "Writes/MB",
+						(double)WRITES * 1000000 / TOTAL);
+			}
+		}
+		(void)printf("Observed total : %8d\n", TOTAL);
+	}
+	if ((kmem = kernelMemory(fd, rfd)) >= 0) {
+		RESULT.kmem = kmem;
+		if (!QUIET) {
+			(void)printf("%-15s: %8lld\n", "Kernel memory", kmem);
+			if (TOTAL > 0) {
+				(void)printf("%-15s: %8.3f\n", "Memory/payload",
+						(double)kmem / TOTAL);
+			}
+			if (WRITES > 0) {
+				(void)printf("%-15s: %8lld\n", "Memory/write", kmem / WRITES);
+			}
+		}
+	}
+	reportPerf("Write", &RESULT.wperf, TOTAL, WRITES);
+	if (!QUIET) {
+		(void)printf("\n");
+	} else if (FORMAT == FMT_TEXT) {
+		(void)printf("%d\n", TOTAL);
+	}
+	RESULT.total = TOTAL;
+	RESULT.writes = WRITES;
+	RESULT.largest = LARGEST_CHUNK;
+	RESULT.msgsize = MSGSIZE;
+
+	if ((IPC_TYPE == IPC_PIPE) || (IPC_TYPE == IPC_FIFO)) {
+		(void)close(fd);
+	}
+}
+
+void
+readData(int fd) {
+	int left, nr, efd = -1;
+	int total = 0, calls = 0, wakeups = 0;
+	long long msgs = 0, start, drain = 0;
+	int batch = MMSG ? BATCH : 0;
+	long long enters = uringEnters(), parked = uringParked(0);
+	char *buf;
+
+	if (!QUIET) {
+		(void)printf("Draining...\n");
+	}
+
+	int bufsiz = BUFSIZ;
+	if (LARGEST_CHUNK > bufsiz) {
+		bufsiz = LARGEST_CHUNK;
+	}
+
+	if (FAST_DRAIN) {
+		/* One look at the queue up front, so we can
+		 * read a full stream buffer in a single call. */
+		left = printFdQueueSize(fd, "read");
+		if (isDgram()) {
+#ifdef HAVE_MMSG
+			if (!batch) {
+				batch = DRAIN_BATCH;
+			}
+#endif
+		} else if (!WRITEV && (left > bufsiz)) {
+			bufsiz = left;
+		}
+	}
+
+	buf = getArena(URING ? (size_t)bufsiz * URING_DEPTH : (size_t)bufsiz);
+	if (WRITEV) {
+		initPattern();
+	}
+
+	if (setFlags(fd, O_NONBLOCK) < 0) {
+		err(EXIT_FAILURE, "fcntl set flags");
+		/* NOTREACHED */
+	}	
+
+	if (EVENTS) {
+		efd = openEvents(fd);
+	}
+
+	perfStart(&RESULT.rperf);
+	drain = nsecs();
+	while (1) {
+		if (EVENTS) {
+			/* Everything has been written already, so
+			 * if we're not readable now, we won't be.
+			 * After that, we only ask after an EAGAIN. */
+			if (calls == 0) {
+				if (!waitEvents(efd, 0)) {
+					break;
+				}
+				wakeups++;
+			}
+		} else if (!FAST_DRAIN ||
+		    ((SAMPLE_EVERY > 0) && (calls > 0) && (calls % SAMPLE_EVERY == 0))) {
+			left = printFdQueueSize(fd, "read");
+			if (left == 0) {
+				break;
+			}
+		}
+
+		calls++;
+		start = nsecs();
+		if (batch) {
+			nr = readBatch(fd, bufsiz, batch, &msgs);
+		} else if (WRITEV) {
+			nr = readPattern(fd);
+		} else if (URING) {
+			int done;
+			nr = uringIO(fd, 0, bufsiz, URING_DEPTH, 0, &done);
+			msgs += done;
+		} else {
+			nr = doRead(fd, buf, bufsiz);
+		}
+		if (nr > 0) {
+			addTiming(&READ_TIMES, nr, nsecs() - start);
+		}
+		if (nr < 0) {
+			if ((errno == EAGAIN) && EVENTS) {
+				calls--;
+				if (!waitEvents(efd, 0)) {
+					break;
+				}
+				wakeups++;
+				continue;
+			}
+			if (errno == EAGAIN) {
+				break;
+			}
+			err(EXIT_FAILURE, "read");
+			/* NOTREACHED */
+		}
+		total += nr;
+
+		if (nr == 0) {
+			/* read(2) returned EOF: all data read. */
+			break;
+		}
+	}
+	drain = nsecs() - drain;
+	perfStop(&RESULT.rperf);
+
+	if (EVENTS) {
+		/* Whatever a low-water mark held back. */
+		(void)printFdQueueSize(fd, "read");
+		(void)close(efd);
+	}
+
+	if (!QUIET) {
+		(void)printf("%-15s: %8d\n", "Read", total);
+		if (EVENTS) {
+			(void)printf("%-15s: %8d\n", "Wakeups", wakeups);
+		}
+		if (batch) {
+			(void)printf("%-15s: %8d\n", "recvmmsg calls", calls);
+			(void)printf("%-15s: %8lld\n", "Datagrams", msgs);
+		} else if (URING) {
+			(void)printf("%-15s: %8lld\n", "io_uring calls", uringEnters() - enters);
+			(void)printf("%-15s: %8lld\n", "Requests", msgs);
+			(void)printf("%-15s: %8lld\n", "Parked", uringParked(0) - parked);
+		}
+		if (FAST_DRAIN) {
+			(void)printf("%-15s: %8d\n", "Drain reads", calls);
+			(void)printf("%-15s: %8lld ns\n", "Drain time", drain);
+			(void)printf("%-15s: %8.2f\n", "Drain MB/s",
+					drain > 0 ? (double)total * 1000 / drain : 0);
+		}
+	}
+	if (FAST_DRAIN) {
+		RESULT.drained = total;
+		RESULT.drain_ns = drain;
+	}
+	reportPerf("Read", &RESULT.rperf, total, calls);
+	reportTimings(batch ? "recvmmsg" : WRITEV ? "readv" :
+			SPLICE ? "splice" : URING ? "io_uring" : "read", &READ_TIMES);
+}
+
+double
+now() {
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		err(EXIT_FAILURE, "clock_gettime");
+		/* NOTREACHED */
+	}
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* '-Y': one sample of how far autotuning has come, on
+ * the writer's end of a TCP connection; the peer's
+ * SO_RCVBUF is only known if it lives on this host. */
+void
+tcpSample(int fd, long long t, long long written) {
+#ifdef HAVE_TCPINFO
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+	struct tcpSample *s;
+	int outq, notsent;
+
+	if ((NUM_SERIES % 1024) == 0) {
+		if ((SERIES = realloc(SERIES, (NUM_SERIES + 1024) * sizeof(*SERIES))) == NULL) {
+			err(EXIT_FAILURE, "realloc");
+			/* NOTREACHED */
+		}
+	}
+	if ((getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0) ||
+	    (ioctl(fd, SIOCOUTQ, &outq) < 0) || (ioctl(fd, SIOCOUTQNSD, &notsent) < 0)) {
+		err(EXIT_FAILURE, "TCP_INFO");
+		/* NOTREACHED */
+	}
+
+	s = &SERIES[NUM_SERIES++];
+	s->t = t;
+	s->acked = written - outq;
+	s->sndbuf = sockOpt(fd, SO_SNDBUF);
+	/* With '-H', the peer is never on this host. */
+	s->rcvbuf = REMOTE ? -1 : peerRcvbuf(fd);
+	s->cwnd = ti.tcpi_snd_cwnd * ti.tcpi_snd_mss;
+	s->rtt = ti.tcpi_rtt;
+	s->unacked = outq - notsent;
+	s->notsent = notsent;
+#else
+	(void)fd; (void)t; (void)written;
+#endif
+}
+
+/* '-Y': the samples of writeSustained(), followed by
+ * when the buffers stopped growing and when the
+ * throughput first got within 90% of what it was over
+ * the second half of the test. */
+void
+reportSeries() {
+	double *rates, *sorted, steady = 0;
+	int i, n = NUM_SERIES - 1, sndat, rcvat, cwndat, cwnd;
+
+	if (NUM_SERIES < 2) {
+		return;
+	}
+
+	/* The rate at which data got acknowledged in the
+	 * interval up to each sample. */
+	if (((rates = calloc(n, sizeof(*rates))) == NULL) ||
+	    ((sorted = calloc(n, sizeof(*sorted))) == NULL)) {
+		err(EXIT_FAILURE, "calloc");
+		/* NOTREACHED */
+	}
+	for (i = 0; i < n; i++) {
+		long long ns = SERIES[i + 1].t - SERIES[i].t;
+		rates[i] = ns > 0 ? (double)(SERIES[i + 1].acked - SERIES[i].acked) * 1000 / ns : 0;
+	}
+	memcpy(sorted, rates + n / 2, (n - n / 2) * sizeof(*sorted));
+	qsort(sorted, n - n / 2, sizeof(*sorted), cmpDouble);
+	steady = sorted[(n - n / 2) / 2];
+
+	RESULT.steady_ns = -1;
+	for (i = 0; i < n; i++) {
+		if (rates[i] >= steady * 0.9) {
+			RESULT.steady_ns = SERIES[i + 1].t;
+			break;
+		}
+	}
+	RESULT.peak_sndbuf = RESULT.peak_rcvbuf = cwnd = -1;
+	sndat = rcvat = cwndat = 0;
+	for (i = 0; i < NUM_SERIES; i++) {
+		struct tcpSample *s = &SERIES[i];
+
+		if (s->sndbuf > RESULT.peak_sndbuf) {
+			RESULT.peak_sndbuf = s->sndbuf;
+			sndat = i;
+		}
+		if (s->rcvbuf > RESULT.peak_rcvbuf) {
+			RESULT.peak_rcvbuf = s->rcvbuf;
+			rcvat = i;
+		}
+		if (s->cwnd > cwnd) {
+			cwnd = s->cwnd;
+			cwndat = i;
+		}
+	}
+
+	if (!QUIET) {
+		(void)printf("\n%8s %10s %10s %10s %8s %10s %10s %8s\n", "ms", "SO_SNDBUF",
+				"SO_RCVBUF", "cwnd", "rtt us", "unacked", "notsent", "MB/s");
+		for (i = 0; i < NUM_SERIES; i++) {
+			struct tcpSample *s = &SERIES[i];
+			char rcvbuf[16] = "-";
+
+			if (s->rcvbuf >= 0) {
+				(void)snprintf(rcvbuf, sizeof(rcvbuf), "%d", s->rcvbuf);
+			}
+			(void)printf("%8.1f %10d %10s %10d %8d %10d %10d %8.2f\n", s->t / 1e6,
+					s->sndbuf, rcvbuf, s->cwnd, s->rtt, s->unacked,
+					s->notsent, i > 0 ? rates[i - 1] : 0);
+		}
+
+		(void)printf("\n%-15s: %8.2f\n", "Steady MB/s", steady);
+		if (RESULT.steady_ns >= 0) {
+			(void)printf("%-15s: %8.1f ms\n", "Time to steady", RESULT.steady_ns / 1e6);
+		}
+		(void)printf("%-15s: %8d after %.1f ms\n", "Peak SO_SNDBUF",
+				RESULT.peak_sndbuf, SERIES[sndat].t / 1e6);
+		if (RESULT.peak_rcvbuf >= 0) {
+			(void)printf("%-15s: %8d after %.1f ms\n", "Peak SO_RCVBUF",
+					RESULT.peak_rcvbuf, SERIES[rcvat].t / 1e6);
+		}
+		(void)printf("%-15s: %8d after %.1f ms\n", "Peak cwnd",
+				cwnd, SERIES[cwndat].t / 1e6);
+	}
+
+	free(rates);
+	free(sorted);
+	free(SERIES);
+	SERIES = NULL;
+	NUM_SERIES = 0;
+}
+
+/* Keep writing chunks of CHUNK1 bytes until we either
+ * hit the time limit (-d) or wrote BYTE_LIMIT bytes (-B).
+ * Whenever the buffer is full, we count the EAGAIN and
+ * wait for the reader to make room. */
+void
+writeSustained(int fd, struct xferStats *x) {
+	char *buf;
+	double start, end;
+	long long base = 0, next = 0, enters;
+	struct pollfd pfd;
+
+	memset(x, 0, sizeof(*x));
+	buf = getArena(CHUNK1);
+	if (WRITEV) {
+		initPattern();
+	}
+
+	if (setFlags(fd, O_NONBLOCK) < 0) {
+		err(EXIT_FAILURE, "fcntl set flags");
+		/* NOTREACHED */
+	}
+
+	/* The reader may go away on us. */
+	(void)signal(SIGPIPE, SIG_IGN);
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+
+	perfStart(&x->perf);
+	x->parked = uringParked(0);
+	enters = uringEnters();
+	start = now();
+	end = start + DURATION;
+	if (SERIES_MS && isTcp()) {
+		/* Sampled between writes rather than from
+		 * another thread, so that 'acked' is exact. */
+		NUM_SERIES = 0;
+		next = base = nsecs();
+		if (!REMOTE) {
+			openDiag();
+		}
+	}
+	while (1) {
+		long long ns;
+		ssize_t n;
+		double t;
+
+		if ((BYTE_LIMIT > 0) && (x->bytes >= BYTE_LIMIT)) {
+			break;
+		}
+
+		if (next && ((ns = nsecs()) >= next)) {
+			tcpSample(fd, ns - base, x->bytes);
+			/* Skip whatever we missed while blocked. */
+			while (next <= ns) {
+				next += SERIES_MS * 1000000LL;
+			}
+		}
+
+		if (MMSG) {
+			if ((n = writeBatch(fd, CHUNK1, BATCH)) > 0) {
+				x->msgs += n;
+				n *= CHUNK1;
+			}
+		} else if (URING) {
+			int done;
+			n = uringIO(fd, 1, CHUNK1, URING_DEPTH, 1000, &done);
+			x->msgs += done;
+		} else if (WRITEV) {
+			long long calls = 0;
+			/* Every writev(2) that wrote something is
+			 * a call; the one that didn't is an EAGAIN. */
+			n = writePattern(fd, 1, &calls);
+			x->ops += calls;
+		} else {
+			n = doWrite(fd, buf, CHUNK1);
+			if (GSO && (n > 0)) {
+				x->msgs += (n + GSO_SIZE - 1) / GSO_SIZE;
+			}
+		}
+		if (n < 0) {
+			if ((errno == EAGAIN) || (errno == ENOBUFS)) {
+				x->eagain++;
+				if (doPoll(&pfd, next ? SERIES_MS : 1000) < 0) {
+					err(EXIT_FAILURE, "poll");
+					/* NOTREACHED */
+				}
+			} else if (errno == EPIPE) {
+				break;
+			} else {
+				err(EXIT_FAILURE, "write");
+				/* NOTREACHED */
+			}
+		} else {
+			x->bytes += n;
+			if (!WRITEV) {
+				x->ops++;
+			}
+		}
+		if (WRITEV && (n >= 0) && (n < PATTERN_BYTES)) {
+			/* Didn't all fit, but we did write some. */
+			x->eagain++;
+		}
+
+		t = now();
+		if ((BYTE_LIMIT < 0) && (t >= end)) {
+			break;
+		}
+	}
+	x->elapsed = now() - start;
+	x->parked = uringParked(0) - x->parked;
+	if (URING) {
+		/* The calls we made, not the rounds. */
+		x->ops = uringEnters() - enters;
+	}
+	closeDiag();
+	perfStop(&x->perf);
+}
+
+/* Let the reader know that we're done: stream type IPC
+ * get an EOF when we close the fd; datagram and message
+ * queue readers get an empty message that they'll read
+ * as 0 bytes. */
+void
+endStream(int fd) {
+	if (IPC_TYPE == IPC_SHM) {
+		ringClose(ringOf(fd));
+	} else if (isMessages()) {
+		int flags;
+		if ((flags = fcntl(fd, F_GETFL, 0)) < 0) {
+			err(EXIT_FAILURE, "fcntl get flags");
+			/* NOTREACHED */
+		}
+		if (setFlags(fd, flags & ~O_NONBLOCK) < 0) {
+			err(EXIT_FAILURE, "fcntl set flags");
+			/* NOTREACHED */
+		}
+		if (!isDgram()) {
+			/* A SysV message queue never blocks. */
+			struct pollfd pfd = { fd, POLLOUT, 0 };
+			while (doWrite(fd, "", 0) < 0) {
+				if (errno != EAGAIN) {
+					err(EXIT_FAILURE, "write");
+					/* NOTREACHED */
+				}
+				(void)doPoll(&pfd, 1000);
+			}
+		} else if ((send(fd, "", 0, 0) < 0) && (errno != EPIPE) &&
+		    (errno != ECONNREFUSED)) {
+			err(EXIT_FAILURE, "send");
+			/* NOTREACHED */
+		}
+	} else {
+#ifdef TCP_CORK_OPT
+		int off = 0;
+
+		/* Don't leave a partial segment behind; the
+		 * peer may be gone already. */
+		if ((TCP_OPTS & OPT_CORK) && isTcp()) {
+			(void)setsockopt(fd, IPPROTO_TCP, TCP_CORK_OPT, &off, sizeof(off));
+		}
+#endif
+		if (isZerocopy()) {
+			drainZerocopy(fd);
+		}
+		(void)close(fd);
+	}
+}
+
+/* Read everything we get until EOF, an empty datagram,
+ * or until the writer has been quiet for a second (in
+ * case the terminating datagram got dropped). */
+void
+drainSustained(int fd, struct xferStats *x) {
+	char *buf;
+	double start, last;
+	long long woke = 0, enters;
+	struct pollfd pfd;
+	struct hist wake;
+	int efd = -1;
+
+	int bufsiz = BUFSIZ;
+	if (CHUNK1 > bufsiz) {
+		bufsiz = CHUNK1;
+	}
+
+	memset(x, 0, sizeof(*x));
+	buf = getArena(URING ? (size_t)bufsiz * URING_DEPTH : (size_t)bufsiz);
+	if (WRITEV) {
+		initPattern();
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	if (EVENTS) {
+		/* Only ever block in epoll_wait(2)/kevent(2). */
+		int flags;
+		if (((flags = fcntl(fd, F_GETFL, 0)) < 0) ||
+		    (setFlags(fd, flags | O_NONBLOCK) < 0)) {
+			err(EXIT_FAILURE, "fcntl");
+			/* NOTREACHED */
+		}
+		efd = openEvents(fd);
+	}
+	histInit(&wake, 1024);
+
+	perfStart(&x->perf);
+	x->parked = uringParked(0);
+	enters = uringEnters();
+	start = last = now();
+	while (1) {
+		ssize_t n;
+
+		if (MMSG) {
+			n = readBatch(fd, bufsiz, BATCH, &x->msgs);
+		} else if (WRITEV) {
+			n = readPattern(fd);
+		} else if (URING) {
+			int done;
+			n = uringIO(fd, 0, bufsiz, URING_DEPTH, 1000, &done);
+			x->msgs += done;
+		} else {
+			n = doRead(fd, buf, bufsiz);
+		}
+		if (n < 0) {
+			if (errno == EAGAIN) {
+				int r;
+				x->eagain++;
+				if (EVENTS) {
+					r = waitEvents(efd, 1000);
+				} else if ((r = doPoll(&pfd, 1000)) < 0) {
+					err(EXIT_FAILURE, "poll");
+					/* NOTREACHED */
+				}
+				if (r == 0) {
+					break;
+				}
+				x->wakeups++;
+				woke = nsecs();
+				continue;
+			}
+			if (errno == ECONNRESET) {
+				break;
+			}
+			err(EXIT_FAILURE, "read");
+			/* NOTREACHED */
+		}
+		if (woke) {
+			histAdd(&wake, nsecs() - woke);
+			woke = 0;
+		}
+		if (n == 0) {
+			break;
+		}
+		x->bytes += n;
+		x->ops++;
+		last = now();
+	}
+	x->elapsed = last - start;
+	x->parked = uringParked(0) - x->parked;
+	if (URING) {
+		x->ops = uringEnters() - enters;
+	}
+	perfStop(&x->perf);
+
+	qsort(wake.samples, wake.n, sizeof(*wake.samples), cmpLongLong);
+	x->wake[0] = histPercentile(&wake, 50);
+	x->wake[1] = histPercentile(&wake, 99);
+	free(wake.samples);
+	if (EVENTS) {
+		(void)close(efd);
+	}
+}
+
+void
+printXferLine(const char *which, const char *what, const char *fmt, ...) {
+	char label[BUFSIZ];
+	va_list args;
+
+	(void)snprintf(label, sizeof(label), "%s %s", which, what);
+	(void)printf("%-15s: ", label);
+	va_start(args, fmt);
+	(void)vprintf(fmt, args);
+	va_end(args);
+	(void)printf("\n");
+}
+
+/* The counters of a phase in total, per byte, and per
+ * call. */
+void
+reportPerf(const char *which, struct perfCounts *p, long long bytes, long long ops) {
+	const char *names[NUM_PERF] = { "csw", "cycles", "instrs", "misses", "faults" };
+	int i;
+
+	if (!PERF || QUIET) {
+		return;
+	}
+
+	printXferLine(which, "counting", "%s", p->kernel ? "user+kernel" : "user only");
+	for (i = 0; i < NUM_PERF; i++) {
+		if (p->v[i] < 0) {
+			continue;
+		}
+		printXferLine(which, names[i], "%8lld (%.3g/byte, %.3g/call)", p->v[i],
+				bytes > 0 ? (double)p->v[i] / bytes : 0,
+				ops > 0 ? (double)p->v[i] / ops : 0);
+	}
+}
+
+void
+reportXfer(const char *which, struct xferStats *x) {
+	double mbs = 0, ops = 0;
+
+	if (x->elapsed > 0) {
+		mbs = (double)x->bytes / x->elapsed / 1000000;
+		ops = (double)x->ops / x->elapsed;
+	}
+
+	if (QUIET) {
+		if ((FORMAT == FMT_TEXT) && (strcmp(which, "Write") == 0)) {
+			(void)printf("%.2f\n", mbs);
+		}
+		return;
+	}
+
+	printXferLine(which, "seconds", "%8.3f", x->elapsed);
+	printXferLine(which, "bytes", "%8lld", x->bytes);
+	printXferLine(which, "calls", "%8lld", x->ops);
+	printXferLine(which, "EAGAIN", "%8lld", x->eagain);
+	printXferLine(which, "MB/s", "%8.2f", mbs);
+	printXferLine(which, "calls/s", "%8.0f", ops);
+	if (x->msgs > 0) {
+		printXferLine(which, "msgs", "%8lld", x->msgs);
+		printXferLine(which, "calls/msg", "%8.3f", (double)x->ops / x->msgs);
+	}
+	if (URING) {
+		printXferLine(which, "parked", "%8lld", x->parked);
+	}
+	if (GSO) {
+		printXferLine(which, "calls/MB", "%8.3f",
+				x->bytes > 0 ? (double)x->ops * 1000000 / x->bytes : 0);
+	}
+	if (x->wakeups > 0) {
+		printXferLine(which, "wakeups", "%8lld", x->wakeups);
+		printXferLine(which, "wakeups/MB", "%8.3f",
+				x->bytes > 0 ? (double)x->wakeups * 1000000 / x->bytes : 0);
+		printXferLine(which, "wake p50", "%8lld ns", x->wake[0]);
+		printXferLine(which, "wake p99", "%8lld ns", x->wake[1]);
+	}
+	reportPerf(which, &x->perf, x->bytes, x->ops);
+}
+
+/* Defined further down. */
+void echoLoop(int rfd, int wfd);
+void setBufferSizes(int rfd, int wfd);
+
+/* The reader of a stream socket tells the writer via a
+ * pipe once it has accepted the connection and set up
+ * its end, so that the writer doesn't start writing
+ * before the receive buffer has its final size. */
+void
+signalReady(int fd) {
+	char c = 1;
+
+	if (write(fd, &c, 1) != 1) {
+		err(EXIT_FAILURE, "write");
+		/* NOTREACHED */
+	}
+	(void)close(fd);
+}
+
+void
+awaitReady(int fd) {
+	ssize_t n;
+	char c;
+
+	while (((n = read(fd, &c, 1)) < 0) && (errno == EINTR)) {
+		;
+	}
+	if (n < 0) {
+		err(EXIT_FAILURE, "read");
+		/* NOTREACHED */
+	}
+	if (n == 0) {
+		errx(EXIT_FAILURE, "The reader went away before it was ready.");
+		/* NOTREACHED */
+	}
+	(void)close(fd);
+}
+
+/* With '-k', the reader (or the echo process) runs in
+ * a thread instead of a forked child.  If given a
+ * listening socket, it first accepts the connection
+ * on it. */
+struct peer {
+	pthread_t thread;
+	int lfd;
+	int rfd;
+	int wfd;		/* where to echo to in latency mode;
+				 * -1 for the same connection */
+	int ready;
+	struct xferStats x;
+};
+
+void *
+peerMain(void *arg) {
+	struct peer *p = arg;
+
+	if (p->lfd >= 0) {
+		if ((p->rfd = accept(p->lfd, NULL, NULL)) < 0) {
+			err(EXIT_FAILURE, "accept");
+			/* NOTREACHED */
+		}
+		setBufferSizes(p->rfd, -1);
+		signalReady(p->ready);
+	}
+
+	if (MODE == THROUGHPUT) {
+		drainSustained(p->rfd, &p->x);
+	} else if (MODE == LATENCY) {
+		echoLoop(p->rfd, p->wfd < 0 ? p->rfd : p->wfd);
+	}
+	return NULL;
+}
+
+/* Both threads share the arena, so size it up front
+ * for whatever either side may ask for; it must not
+ * move under the other thread's feet. */
+void
+startPeer(struct peer *p, int lfd, int rfd, int wfd, int ready) {
+	size_t size = BUFSIZ;
+	int e;
+
+	if ((size_t)CHUNK1 > size) {
+		size = CHUNK1;
+	}
+	if ((CHUNK2 > 0) && ((size_t)CHUNK2 > size)) {
+		size = CHUNK2;
+	}
+	(void)getArena(size);
+
+	memset(p, 0, sizeof(*p));
+	p->lfd = lfd;
+	p->rfd = rfd;
+	p->wfd = wfd;
+	p->ready = ready;
+	if ((e = pthread_create(&p->thread, NULL, peerMain, p)) != 0) {
+		errno = e;
+		err(EXIT_FAILURE, "pthread_create");
+		/* NOTREACHED */
+	}
+}
+
+void
+joinPeer(struct peer *p) {
+	int e;
+
+	if ((e = pthread_join(p->thread, NULL)) != 0) {
+		errno = e;
+		err(EXIT_FAILURE, "pthread_join");
+		/* NOTREACHED */
+	}
+}
+
+/* Fork a reader to drain 'rfd' while we keep
+ * writing into 'wfd'.  The reader sends us its
+ * numbers back via a pipe so that the report is
+ * printed in one piece. */
+void
+throughput(int rfd, int wfd) {
+	struct xferStats r, w;
+	int rp[2];
+	pid_t pid;
+
+	if (THREADED) {
+		struct peer p;
+
+		startPeer(&p, -1, rfd, -1, -1);
+		writeSustained(wfd, &w);
+		endStream(wfd);
+		joinPeer(&p);
+		r = p.x;
+		goto report;
+	}
+
+	if (pipe(rp) < 0) {
+		err(EXIT_FAILURE, "pipe");
+		/* NOTREACHED */
+	}
+
+	if (fflush(stdout) == EOF) {
+		err(EXIT_FAILURE, "fflush");
+		/* NOTREACHED */
+	}
+
+	if ((pid = fork()) < 0) {
+		err(EXIT_FAILURE, "fork");
+		/* NOTREACHED */
+	}
+
+	if (pid == 0) {
+		(void)close(rp[0]);
+		if (wfd != rfd) {
+			closeEnd(wfd);
+		}
+		drainSustained(rfd, &r);
+		if (write(rp[1], &r, sizeof(r)) != sizeof(r)) {
+			err(EXIT_FAILURE, "write");
+			/* NOTREACHED */
+		}
+		_exit(EXIT_SUCCESS);
+		/* NOTREACHED */
+	}
+
+	(void)close(rp[1]);
+	if (rfd != wfd) {
+		closeEnd(rfd);
+	}
+
+	writeSustained(wfd, &w);
+	endStream(wfd);
+
+	if (read(rp[0], &r, sizeof(r)) != sizeof(r)) {
+		err(EXIT_FAILURE, "read");
+		/* NOTREACHED */
+	}
+	(void)close(rp[0]);
+	if (waitpid(pid, NULL, 0) < 0) {
+		err(EXIT_FAILURE, "waitpid");
+		/* NOTREACHED */
+	}
+
+report:
+	RESULT.w = w;
+	RESULT.r = r;
+	RESULT.wperf = w.perf;
+	RESULT.rperf = r.perf;
+	reportXfer("Write", &w);
+	reportZerocopy();
+	reportSeries();
+	if (!QUIET) {
+		(void)printf("\n");
+	}
+	reportXfer("Read", &r);
+}
+
+/* Print the percentiles followed by a log2 histogram
+ * of the samples (in nanoseconds) in microsecond
+ * buckets. */
+void
+reportHist(const char *what, struct hist *h) {
+	char label[BUFSIZ];
+	long long sum = 0;
+	size_t i;
+
+	qsort(h->samples, h->n, sizeof(*h->samples), cmpLongLong);
+
+	RESULT.rtt[0] = histPercentile(h, 50);
+	RESULT.rtt[1] = histPercentile(h, 99);
+	RESULT.rtt[2] = histPercentile(h, 99.9);
+	RESULT.rtt[3] = h->n ? h->samples[h->n - 1] : 0;
+
+	if (QUIET) {
+		if (FORMAT == FMT_TEXT) {
+			(void)printf("%lld %lld %lld %lld\n", RESULT.rtt[0],
+					RESULT.rtt[1], RESULT.rtt[2], RESULT.rtt[3]);
+		}
+		free(h->samples);
+		return;
+	}
+
+	for (i = 0; i < h->n; i++) {
+		sum += h->samples[i];
+	}
+
+	(void)printf("\n");
+	printXferLine(what, "samples", "%8zu", h->n);
+	if (h->n > 0) {
+		printXferLine(what, "min (ns)", "%8lld", h->samples[0]);
+		printXferLine(what, "mean (ns)", "%8lld", sum / (long long)h->n);
+		printXferLine(what, "p50 (ns)", "%8lld", histPercentile(h, 50));
+		printXferLine(what, "p90 (ns)", "%8lld", histPercentile(h, 90));
+		printXferLine(what, "p99 (ns)", "%8lld", histPercentile(h, 99));
+		printXferLine(what, "p99.9 (ns)", "%8lld", histPercentile(h, 99.9));
+		printXferLine(what, "max (ns)", "%8lld", h->samples[h->n - 1]);
+	}
+
+	(void)printf("\n");
+	i = 0;
+	for (long long bucket = 1; i < h->n; bucket *= 2) {
+		size_t count = 0;
+		while ((i < h->n) && (h->samples[i] <= bucket * 1000)) {
+			count++;
+			i++;
+		}
+		if (count) {
+			(void)snprintf(label, sizeof(label), "<= %lldus", bucket);
+			printXferLine(what, label, "%8zu", count);
+		}
+	}
+	free(h->samples);
+}
+
+void
+writeFull(int fd, const char *buf, int count) {
+	while (count > 0) {
+		ssize_t n;
+		if ((n = doWrite(fd, buf, count)) < 0) {
+			if (errno == EAGAIN) {
+				/* A full ring (see ringWrite()). */
+				struct pollfd pfd = { fd, POLLOUT, 0 };
+				(void)doPoll(&pfd, 1000);
+				continue;
+			}
+			err(EXIT_FAILURE, "write");
+			/* NOTREACHED */
+		}
+		buf += n;
+		count -= n;
+	}
+}
+
+/* Read one message of 'count' bytes: a single datagram,
+ * or as many reads as it takes on stream type IPC.
+ * Returns 0 on EOF or empty datagram. */
+int
+readMsg(int fd, char *buf, int count) {
+	int total = 0;
+
+	while (total < count) {
+		ssize_t n;
+		if ((n = doRead(fd, buf + total, count - total)) < 0) {
+			if (errno == ECONNRESET) {
+				return 0;
+			}
+			err(EXIT_FAILURE, "read");
+			/* NOTREACHED */
+		}
+		if ((n == 0) || isMessages()) {
+			return n ? n : total;
+		}
+		total += n;
+	}
+	return total;
+}
+
+void
+echoLoop(int rfd, int wfd) {
+	char *buf;
+	int n;
+
+	buf = getArena(CHUNK1);
+	while ((n = readMsg(rfd, buf, CHUNK1)) > 0) {
+		writeFull(wfd, buf, n);
+	}
+}
+
+void
+pingLoop(int wfd, int rfd, struct hist *h) {
+	char *buf;
+	int i;
+
+	buf = getArena(CHUNK1);
+	histInit(h, ITERATIONS);
+	for (i = 0; i < ITERATIONS; i++) {
+		long long start = nsecs();
+		writeFull(wfd, buf, CHUNK1);
+		if (readMsg(rfd, buf, CHUNK1) != CHUNK1) {
+			errx(EXIT_FAILURE, "Short or missing echo in iteration %d.", i);
+			/* NOTREACHED */
+		}
+		histAdd(h, nsecs() - start);
+	}
+}
+
+/* Fork an echo process that reads from 'rfd' and writes
+ * everything back into 'ewfd' while we send messages
+ * into 'wfd' and wait for the echo on 'erfd'. */
+void
+latency(int rfd, int wfd, int erfd, int ewfd) {
+	struct hist h;
+	pid_t pid;
+
+	if (THREADED) {
+		struct peer p;
+
+		startPeer(&p, -1, rfd, ewfd, -1);
+		pingLoop(wfd, erfd, &h);
+		endStream(wfd);
+		joinPeer(&p);
+		reportHist("RTT", &h);
+		return;
+	}
+
+	if (fflush(stdout) == EOF) {
+		err(EXIT_FAILURE, "fflush");
+		/* NOTREACHED */
+	}
+
+	if ((pid = fork()) < 0) {
+		err(EXIT_FAILURE, "fork");
+		/* NOTREACHED */
+	}
+
+	if (pid == 0) {
+		if ((wfd != rfd) && (wfd != ewfd)) {
+			closeEnd(wfd);
+		}
+		if ((erfd != rfd) && (erfd != ewfd) && (erfd != wfd)) {
+			closeEnd(erfd);
+		}
+		echoLoop(rfd, ewfd);
+		_exit(EXIT_SUCCESS);
+		/* NOTREACHED */
+	}
+
+	if ((rfd != wfd) && (rfd != erfd)) {
+		closeEnd(rfd);
+	}
+	if ((ewfd != wfd) && (ewfd != erfd) && (ewfd != rfd)) {
+		closeEnd(ewfd);
+	}
+
+	pingLoop(wfd, erfd, &h);
+	endStream(wfd);
+
+	if (waitpid(pid, NULL, 0) < 0) {
+		err(EXIT_FAILURE, "waitpid");
+		/* NOTREACHED */
+	}
+
+	reportHist("RTT", &h);
+}
+
+/* Whether to run the throughput test with more than one
+ * writer or reader (-j), on independent channels (-J),
+ * or pinned to CPUs (-C). */
+int
+isScaling() {
+	return (WRITERS > 1) || (READERS > 1) || INDEPENDENT ||
+		(NUM_WRITER_CPUS > 0);
+}
+
+struct worker {
+	int writer;
+	int index;
+	int cpu;
+	struct xferStats x;
+};
+
+/* Pin the calling process to the CPU for writer or
+ * reader number 'n', round-robin across the given
+ * list.  Returns the CPU, or -1 if not pinned. */
+int
+pinWorker(int writer, int n) {
+	int *cpus = WRITER_CPUS;
+	int num = NUM_WRITER_CPUS;
+	int cpu;
+
+	if (!writer) {
+		if (NUM_READER_CPUS > 0) {
+			cpus = READER_CPUS;
+			num = NUM_READER_CPUS;
+		} else {
+			/* A single list: readers follow the writers. */
+			n += WRITERS;
+		}
+	}
+	if (num == 0) {
+		return -1;
+	}
+	cpu = cpus[n % num];
+
+#if defined(__linux)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) < 0) {
+		err(EXIT_FAILURE, "sched_setaffinity(%d)", cpu);
+		/* NOTREACHED */
+	}
+#elif defined(__FreeBSD__)
+	cpuset_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (cpuset_setaffinity(CPU_LEVEL_WHICH, CPU_WHICH_PID, -1,
+				sizeof(set), &set) < 0) {
+		err(EXIT_FAILURE, "cpuset_setaffinity(%d)", cpu);
+		/* NOTREACHED */
+	}
+#endif
+	return cpu;
+}
+
+/* The NUMA node of the given CPU, or -1 if we can't tell. */
+int
+cpuNode(int cpu) {
+	int node = -1;
+#ifdef __linux
+	char path[PATH_MAX];
+	struct dirent *d;
+	DIR *dir;
+
+	(void)snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	if ((dir = opendir(path)) == NULL) {
+		return -1;
+	}
+	while ((d = readdir(dir)) != NULL) {
+		if (sscanf(d->d_name, "node%d", &node) == 1) {
+			break;
+		}
+	}
+	(void)closedir(dir);
+#else
+	(void)cpu;
+#endif
+	return node;
+}
+
+void
+addXfer(struct xferStats *sum, struct xferStats *x) {
+	int i;
+
+	sum->bytes += x->bytes;
+	sum->ops += x->ops;
+	sum->msgs += x->msgs;
+	sum->eagain += x->eagain;
+	sum->wakeups += x->wakeups;
+	/* The slowest reader's wakeups. */
+	if (x->wake[0] > sum->wake[0]) {
+		sum->wake[0] = x->wake[0];
+	}
+	if (x->wake[1] > sum->wake[1]) {
+		sum->wake[1] = x->wake[1];
+	}
+	if (x->elapsed > sum->elapsed) {
+		sum->elapsed = x->elapsed;
+	}
+	for (i = 0; i < NUM_PERF; i++) {
+		if (x->perf.v[i] < 0) {
+			sum->perf.v[i] = -1;
+		} else if (sum->perf.v[i] >= 0) {
+			sum->perf.v[i] += x->perf.v[i];
+		}
+	}
+	sum->perf.kernel = x->perf.kernel;
+}
+
+/* Fork WRITERS writers and READERS readers sharing the
+ * given channel, or, with '-J', WRITERS channels with
+ * one writer and one reader each.  Every worker sends
+ * its numbers back to us via a pipe; we report the
+ * aggregate: total bytes and calls over the longest
+ * time any worker took. */
+void
+scaling(int rfd, int wfd) {
+	int nchan = INDEPENDENT ? WRITERS : 1;
+	int writers = INDEPENDENT ? 1 : WRITERS;
+	int readers = INDEPENDENT ? 1 : READERS;
+	int nworkers = nchan * (writers + readers);
+	int (*chans)[2];
+	struct worker *workers;
+	struct xferStats r, w;
+	int c, i, n, rp[2], done = 0;
+
+	if (((chans = calloc(nchan, sizeof(*chans))) == NULL) ||
+	    ((workers = calloc(nworkers, sizeof(*workers))) == NULL)) {
+		err(EXIT_FAILURE, "calloc");
+		/* NOTREACHED */
+	}
+	chans[0][0] = rfd;
+	chans[0][1] = wfd;
+	for (c = 1; c < nchan; c++) {
+		openChannel(chans[c]);
+	}
+
+	if (pipe(rp) < 0) {
+		err(EXIT_FAILURE, "pipe");
+		/* NOTREACHED */
+	}
+
+	if (fflush(stdout) == EOF) {
+		err(EXIT_FAILURE, "fflush");
+		/* NOTREACHED */
+	}
+
+	/* Readers first, so that they're ready to drain
+	 * when the writers get going. */
+	for (n = 0; n < nworkers; n++) {
+		struct worker *wk = &workers[n];
+		pid_t pid;
+
+		wk->writer = (n >= nchan * readers);
+		wk->index = wk->writer ? n - nchan * readers : n;
+		c = wk->index % nchan;
+
+		if ((pid = fork()) < 0) {
+			err(EXIT_FAILURE, "fork");
+			/* NOTREACHED */
+		}
+		if (pid) {
+			continue;
+		}
+
+		(void)close(rp[0]);
+		wk->cpu = pinWorker(wk->writer, wk->index);
+		/* Readers only see EOF once every copy of the
+		 * write end is closed. */
+		for (i = 0; i < nchan; i++) {
+			int keep = (i == c) ? chans[i][wk->writer] : -1;
+			if (chans[i][0] != keep) {
+				closeEnd(chans[i][0]);
+			}
+			if ((chans[i][1] != chans[i][0]) && (chans[i][1] != keep)) {
+				closeEnd(chans[i][1]);
+			}
+		}
+
+		if (wk->writer) {
+			writeSustained(chans[c][1], &wk->x);
+			if (INDEPENDENT) {
+				endStream(chans[c][1]);
+			}
+		} else {
+			drainSustained(chans[c][0], &wk->x);
+		}
+		if (write(rp[1], wk, sizeof(*wk)) != sizeof(*wk)) {
+			err(EXIT_FAILURE, "write");
+			/* NOTREACHED */
+		}
+		_exit(EXIT_SUCCESS);
+		/* NOTREACHED */
+	}
+
+	(void)close(rp[1]);
+	for (c = 0; c < nchan; c++) {
+		if (!INDEPENDENT && isMessages()) {
+			/* We need to send the final datagrams. */
+			continue;
+		}
+		closeEnd(chans[c][0]);
+		if (chans[c][1] != chans[c][0]) {
+			closeEnd(chans[c][1]);
+		}
+	}
+
+	memset(&r, 0, sizeof(r));
+	memset(&w, 0, sizeof(w));
+	for (n = 0; n < nworkers; n++) {
+		struct worker wk;
+
+		if (read(rp[0], &wk, sizeof(wk)) != sizeof(wk)) {
+			err(EXIT_FAILURE, "read");
+			/* NOTREACHED */
+		}
+		workers[wk.writer ? nchan * readers + wk.index : wk.index] = wk;
+		addXfer(wk.writer ? &w : &r, &wk.x);
+		if (wk.writer && (++done == writers) && !INDEPENDENT && isMessages()) {
+			/* One empty datagram per reader. */
+			for (i = 0; i < readers; i++) {
+				endStream(wfd);
+			}
+		}
+	}
+	(void)close(rp[0]);
+	while (wait(NULL) > 0) {
+		;
+	}
+	if (!INDEPENDENT && isMessages()) {
+		closeEnd(rfd);
+		if (wfd != rfd) {
+			closeEnd(wfd);
+		}
+	}
+
+	if (!QUIET) {
+		(void)printf("%-15s: %8d\n", "Channels", nchan);
+		(void)printf("%-15s: %8d\n", "Writers", nchan * writers);
+		(void)printf("%-15s: %8d\n", "Readers", nchan * readers);
+		for (i = 0; i < nworkers; i++) {
+			/* Writers first. */
+			struct worker *wk = &workers[(i + nchan * readers) % nworkers];
+			char label[BUFSIZ];
+			double mbs = 0;
+
+			if (wk->x.elapsed > 0) {
+				mbs = (double)wk->x.bytes / wk->x.elapsed / 1000000;
+			}
+			(void)snprintf(label, sizeof(label), "%s %d MB/s",
+					wk->writer ? "Write" : "Read", wk->index);
+			(void)printf("%-15s: %8.2f", label, mbs);
+			if (wk->cpu >= 0) {
+				int node = cpuNode(wk->cpu);
+				(void)printf(" (CPU %d", wk->cpu);
+				if (node >= 0) {
+					(void)printf(", node %d", node);
+				}
+				(void)printf(")");
+			}
+			(void)printf("\n");
+		}
+		(void)printf("\n");
+	}
+	free(workers);
+	free(chans);
+
+	RESULT.w = w;
+	RESULT.r = r;
+	RESULT.wperf = w.perf;
+	RESULT.rperf = r.perf;
+	reportXfer("Write", &w);
+	if (!QUIET) {
+		(void)printf("\n");
+	}
+	reportXfer("Read", &r);
+}
+
+void
+runTest(int rfd, int wfd) {
+	if (MODE == THROUGHPUT) {
+		if (isScaling()) {
+			scaling(rfd, wfd);
+		} else {
+			throughput(rfd, wfd);
+		}
+		return;
+	} else if (MODE == LATENCY) {
+		/* Bidirectional IPC: echo back on the same fds. */
+		latency(rfd, wfd, wfd, rfd);
+		return;
+	}
+	writeData(wfd, rfd);
+	readData(rfd);
+}
+
+/* Run the same test again on a fresh channel with
+ * 'flag' turned on, for comparison. */
+void
+rerunTest(int *flag, const char *fmt, ...) {
+	va_list args;
+	int fd[2];
+
+	if (!QUIET) {
+		(void)printf("\nUsing ");
+		va_start(args, fmt);
+		(void)vprintf(fmt, args);
+		va_end(args);
+		(void)printf(":\n");
+	}
+	TOTAL = 0;
+	WRITES = 0;
+	LARGEST_CHUNK = 0;
+	/* Before we open the channel, so that '-g' can set
+	 * up the sockets. */
+	*flag = 1;
+	openChannel(fd);
+	runTest(fd[0], fd[1]);
+	closeChannel(fd);
+	*flag = 0;
+}
+
+void
+runComparisons() {
+	if (VMSPLICE) {
+		rerunTest(&SPLICE, "vmsplice(2) and splice(2)");
+	}
+	if (BATCH) {
+		rerunTest(&MMSG, "sendmmsg(2) and recvmmsg(2), %d datagram%s per call",
+				BATCH, BATCH > 1 ? "s" : "");
+	}
+	if (VECTORED) {
+		rerunTest(&WRITEV, "writev(2) and readv(2)");
+	}
+	if (URING_DEPTH) {
+		rerunTest(&URING, "io_uring(7), up to %d request%s per call",
+				URING_DEPTH, URING_DEPTH > 1 ? "s" : "");
+	}
+	if (GSO_SIZE) {
+		rerunTest(&GSO, "UDP_SEGMENT and UDP_GRO, %d byte segments", GSO_SIZE);
+	}
+}
+
+/* Run the test, followed by any comparisons asked for. */
+void
+runTests(int rfd, int wfd) {
+	runTest(rfd, wfd);
+	runComparisons();
+}
+
+const char *
+modeName() {
+	switch(MODE) {
+	case CHUNK:
+		return "chunk";
+	case THROUGHPUT:
+		return "throughput";
+	case LATENCY:
+		return "latency";
+	case PROBE:
+		return "probe";
+	case TUNE:
+		return "tune";
+	case FANOUT:
+		return "fanout";
+	case SUBPAGE:
+		return "subpage";
+	case CHAIN:
+		return "chain";
+	case BACKPRESSURE:
+		return "backpressure";
+	default:
+		return "loop";
+	}
+}
+
+void
+printRate(int rate) {
+	if (rate > 0) {
+		(void)printf("%d bytes/s", rate);
+	} else {
+		(void)printf("full speed");
+	}
+}
+
+void
+reportTest(const char *fmt, ...) {
+	if (QUIET) {
+		return;
+	}
+
+	va_list args;
+
+	const char *mode = modeName();
+
+	(void)printf("Testing ");
+	va_start(args, fmt);
+	(void)vprintf(fmt, args);
+	va_end(args);
+	(void)printf(" %s in %s mode.\n",
+			MODE == LATENCY ? "round-trip time" :
+			MODE == CHAIN ? "throughput and latency" :
+			MODE == BACKPRESSURE ? "stall absorption" :
+			MODE == THROUGHPUT ? "throughput" : "buffer size", mode);
+	if (MODE == LOOP) {
+		(void)printf("Loop starting with %d byte%s",
+				CHUNK1, CHUNK1 > 1 ? "s" : "");
+		if (CHUNK2 == -1) {
+			(void)printf(" and doubling each iteration.\n");
+		} else {
+			(void)printf(", increasing by %d byte%s each time.\n",
+					CHUNK2, CHUNK2 != 1 ? "s" : "");
+		}
+	} else if (MODE == THROUGHPUT) {
+		(void)printf("Writing chunks of %d byte%s ",
+				CHUNK1, CHUNK1 > 1 ? "s" : "");
+		if (BYTE_LIMIT > 0) {
+			(void)printf("until %d bytes were written.\n", BYTE_LIMIT);
+		} else {
+			(void)printf("for %d second%s.\n",
+					DURATION, DURATION > 1 ? "s" : "");
+		}
+	} else if (MODE == PROBE) {
+		/* probe() explains itself. */
+	} else if (MODE == FANOUT) {
+		(void)printf("Opening %d channels at once and filling each with chunks of %d byte%s.\n",
+				CHANNELS, CHUNK1, CHUNK1 > 1 ? "s" : "");
+	} else if (MODE == SUBPAGE) {
+		(void)printf("Filling fresh pipes with chunks of %s, normally and\n"
+				"in packet mode, then writing for %lld ms per size.\n",
+				CHUNK1 > 0 ? "one size" : "sizes around page boundaries",
+				SUBPAGE_NS / 1000000);
+	} else if (MODE == CHAIN) {
+		(void)printf("Passing chunks of %d byte%s through %d hop%s ",
+				CHUNK1, CHUNK1 > 1 ? "s" : "", HOPS, HOPS > 1 ? "s" : "");
+		if (BYTE_LIMIT > 0) {
+			(void)printf("until %d bytes were written,\n", BYTE_LIMIT);
+		} else {
+			(void)printf("for %d second%s,\n", DURATION, DURATION > 1 ? "s" : "");
+		}
+		(void)printf("then %d message%s one at a time.\n",
+				ITERATIONS, ITERATIONS > 1 ? "s" : "");
+	} else if (MODE == BACKPRESSURE) {
+		(void)printf("Writing chunks of %d byte%s at ", CHUNK1, CHUNK1 > 1 ? "s" : "");
+		printRate(WRITE_RATE);
+		if (BYTE_LIMIT > 0) {
+			(void)printf(" until %d bytes were written,\n", BYTE_LIMIT);
+		} else {
+			(void)printf(" for %d second%s,\n", DURATION, DURATION > 1 ? "s" : "");
+		}
+		(void)printf("reading them at ");
+		printRate(READ_RATE);
+		if (STALL_MS) {
+			(void)printf(", stalling for %d ms every %d ms", STALL_MS, STALL_EVERY);
+		}
+		(void)printf(".\n");
+	} else if (MODE == TUNE) {
+		(void)printf("Measuring throughput with chunks of %d byte%s ",
+				CHUNK1, CHUNK1 > 1 ? "s" : "");
+		if (BYTE_LIMIT > 0) {
+			(void)printf("for %d bytes per size.\n", BYTE_LIMIT);
+		} else {
+			(void)printf("for %d second%s per size.\n",
+					DURATION, DURATION > 1 ? "s" : "");
+		}
+		(void)printf("Looking for the smallest size with %d%% of the peak.\n",
+				TUNE_PCT);
+	} else if (MODE == LATENCY) {
+		(void)printf("Sending %d message%s of %d byte%s and waiting for the echo.\n",
+				ITERATIONS, ITERATIONS > 1 ? "s" : "",
+				CHUNK1, CHUNK1 > 1 ? "s" : "");
+	} else {
+		(void)printf("First chunk: %d byte%s, ",
+				CHUNK1, CHUNK1 > 1 ? "s" : "");
+		(void)printf("then %d more chunk%s of size %d.\n",
+				NUM_CHUNKS, NUM_CHUNKS > 1 ? "s" : "",
+				CHUNK2 < 0 ? CHUNK1 : CHUNK2);
+	}
+	(void)printf("\n");
+}
+
+void
+doPipe() {
+	int fd[2];
+
+	if (pipe(fd) < 0) {
+		err(EXIT_FAILURE, "pipe");
+		/* NOTREACHED */
+	}
+
+	setPipeSize(fd[1]);
+
+	reportTest("pipe");
+
+#ifdef PIPE_BUF
+	if (!QUIET) {
+		(void)printf("%-15s: %8d\n", "PIPE_BUF", PIPE_BUF);
+	}
+#endif
+#ifdef PIPE_MAX
+	if (!QUIET) {
+		(void)printf("%-15s: %8d\n", "PIPE_MAX", PIPE_MAX);
+	}
+#endif
+
+#ifdef F_GETPIPE_SZ
+	int s;
+	if ((s = fcntl(fd[1], F_GETPIPE_SZ, 0)) < 0) {
+		err(EXIT_FAILURE, "fcntl(F_GETPIPE_SZ)");
+		/* NOTREACHED */
+	}
+	if (!QUIET) {
+		(void)printf("%-15s: %8d\n", "F_GETPIPE_SZ", s);
+	}
+#endif
+
+	long l;
+	if ((l = fpathconf(fd[1], _PC_PIPE_BUF)) < 0) {
+		err(EXIT_FAILURE, "fpathconf");
+		/* NOTREACHED */
+	}
+	if (!QUIET) {
+		(void)printf("%-15s: %8ld\n", "_PC_PIPE_BUF", l);
+	}
+
+	if (MODE == LATENCY) {
+		int efd[2];
+		if (pipe(efd) < 0) {
+			err(EXIT_FAILURE, "pipe");
+			/* NOTREACHED */
+		}
+		setPipeSize(efd[1]);
+		latency(fd[0], fd[1], efd[0], efd[1]);
+		return;
+	}
+
+	runTests(fd[0], fd[1]);
+}
+
+#ifndef __sun
+/* The tunables that bound how much IPC buffers can
+ * hold.  We read all of them in one go rather than
+ * every time we report one: a sweep forks for every
+ * cell, and every child inherits what we already have.
+ * They also go into the structured output once, so that
+ * results can be compared across hosts. */
+const char *TUNABLES[] = {
+#  ifdef __linux
+	"fs.mqueue.msg_max",
+	"fs.mqueue.msgsize_max",
+	"fs.mqueue.queues_max",
+	"fs.pipe-max-size",
+	"fs.pipe-user-pages-hard",
+	"fs.pipe-user-pages-soft",
+	"kernel.msgmax",
+	"kernel.msgmnb",
+	"kernel.msgmni",
+	"net.core.rmem_default",
+	"net.core.rmem_max",
+	"net.core.wmem_default",
+	"net.core.wmem_max",
+	"net.ipv4.tcp_mem",
+	"net.ipv4.tcp_moderate_rcvbuf",
+	"net.ipv4.tcp_rmem",
+	"net.ipv4.tcp_wmem",
+	"net.ipv4.udp_mem",
+	"net.ipv4.udp_rmem_min",
+	"net.ipv4.udp_wmem_min",
+	"net.unix.max_dgram_qlen",
+#  elif defined(__OpenBSD__)
+	/* All that our sysctlbyname() knows about. */
+	"net.inet.udp.recvspace",
+	"net.local.dgram.recvspace",
+	"net.local.stream.recvspace",
+#  else
+	"kern.ipc.maxpipekva",
+	"kern.ipc.maxsockbuf",
+	"kern.ipc.msgmax",
+	"kern.ipc.msgmnb",
+	"kern.ipc.msgmni",
+	"kern.ipc.sockbuf_waste_factor",
+	"net.inet.tcp.recvbuf_max",
+	"net.inet.tcp.recvspace",
+	"net.inet.tcp.sendbuf_max",
+	"net.inet.tcp.sendspace",
+	"net.inet.udp.maxdgram",
+	"net.inet.udp.recvspace",
+	"net.inet6.tcp6.recvspace",
+	"net.inet6.udp6.recvspace",
+	"net.local.dgram.maxdgram",
+	"net.local.dgram.recvspace",
+	"net.local.stream.recvspace",
+	"net.local.stream.sendspace",
+#  endif
+};
+#  define NUM_TUNABLES (int)(sizeof(TUNABLES) / sizeof(TUNABLES[0]))
+
+/* The value of each of TUNABLES as a string, NULL if
+ * this system doesn't have it. */
+char *TUNABLE_VALUES[NUM_TUNABLES];
+int TUNABLES_READ = 0;
+
+/* Read a single sysctl(8) variable; Linux' vectors
+ * ("min pressure max") are returned as they are. */
+char *
+readTunable(const char *s) {
+	char sval[BUFSIZ];
+	char *p;
+
+	memset(sval, '\0', BUFSIZ);
+
+#  ifdef __linux
+	char path[PATH_MAX];
+	int fd, n;
+
+	(void)snprintf(path, sizeof(path), "/proc/sys/%s", s);
+	for (p = path + strlen("/proc/sys/"); *p != '\0'; p++) {
+		if (*p == '.') {
+			*p = '/';
+		}
+	}
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		return NULL;
+	}
+	n = read(fd, sval, BUFSIZ - 1);
+	(void)close(fd);
+	if (n <= 0) {
+		return NULL;
+	}
+	sval[strcspn(sval, "\n")] = '\0';
+	for (p = sval; *p != '\0'; p++) {
+		if (*p == '\t') {
+			*p = ' ';
+		}
+	}
+#  else
+	char raw[BUFSIZ];
+	size_t len = sizeof(raw);
+
+	if (sysctlbyname(s, raw, &len, NULL, 0) < 0) {
+		return NULL;
+	}
+	if (len == sizeof(int)) {
+		(void)snprintf(sval, BUFSIZ, "%d", *(int *)raw);
+	} else if (len == sizeof(long)) {
+		(void)snprintf(sval, BUFSIZ, "%ld", *(long *)raw);
+	} else {
+		(void)strncpy(sval, raw, MIN(len, BUFSIZ - 1));
+	}
+#  endif
+	if ((p = strdup(sval)) == NULL) {
+		err(EXIT_FAILURE, "strdup");
+		/* NOTREACHED */
+	}
+	return p;
+}
+
+void
+readTunables() {
+	int i;
+
+	if (TUNABLES_READ) {
+		return;
+	}
+	for (i = 0; i < NUM_TUNABLES; i++) {
+		TUNABLE_VALUES[i] = readTunable(TUNABLES[i]);
+	}
+	TUNABLES_READ = 1;
+}
+
+/* The cached value of a tunable; NULL if it isn't one
+ * of TUNABLES or this system doesn't have it. */
+const char *
+tunableValue(const char *s) {
+	int i;
+
+	readTunables();
+	for (i = 0; i < NUM_TUNABLES; i++) {
+		if (strcmp(TUNABLES[i], s) == 0) {
+			return TUNABLE_VALUES[i];
+		}
+	}
+	return NULL;
+}
+#endif
+
+/* The host and all of TUNABLES, once, ahead of the
+ * records: as '#' comments before the CSV header, or as
+ * a JSON object of its own. */
+void
+emitTunables() {
+	struct utsname u;
+	int i, n = 0;
+
+	if (uname(&u) < 0) {
+		err(EXIT_FAILURE, "uname");
+		/* NOTREACHED */
+	}
+
+	if (FORMAT == FMT_JSON) {
+		(void)printf("{\"host\":\"%s\",\"os\":\"%s %s %s\",\"tunables\":{",
+				u.nodename, u.sysname, u.release, u.machine);
+	} else {
+		(void)printf("# host: %s\n# os: %s %s %s\n",
+				u.nodename, u.sysname, u.release, u.machine);
+	}
+#ifndef __sun
+	readTunables();
+	for (i = 0; i < NUM_TUNABLES; i++) {
+		const char *v = TUNABLE_VALUES[i];
+
+		if (FORMAT == FMT_CSV) {
+			(void)printf("# %s: %s\n", TUNABLES[i], v ? v : "");
+			continue;
+		}
+		(void)printf("%s\"%s\":", n++ ? "," : "", TUNABLES[i]);
+		if (v == NULL) {
+			(void)printf("null");
+		} else if ((*v != '\0') && (strspn(v, "0123456789-") == strlen(v))) {
+			(void)printf("%s", v);
+		} else {
+			(void)printf("\"%s\"", v);
+		}
+	}
+#else
+	(void)i; (void)n;
+#endif
+	if (FORMAT == FMT_JSON) {
+		(void)printf("}}\n");
+	}
+}
+
+#ifndef __sun
+/* The value of a numeric sysctl(8) variable, from the
+ * snapshot if it's one of TUNABLES. */
+int
+sysctlValue(const char *s) {
+	char *sysctl, *spath;
+	const char *cached;
+	char sval[BUFSIZ];
+	int n;
+
+	if ((cached = tunableValue(s)) != NULL) {
+		if ((n = (int)strtol(cached, NULL, 10)) < 1) {
+			errx(EXIT_FAILURE, "Unexpected value '%s' for %s.", cached, s);
+			/* NOTREACHED */
+		}
+		return n;
+	}
+
+	memset(sval, '\0', BUFSIZ);
+
+	if ((sysctl = strdup(s)) == NULL) {
+		err(EXIT_FAILURE, "strdup");
+		/* NOTREACHED */
+	}
+
+	spath = sysctl;
+
+#  ifdef __linux
+	char c;
+	int fd;
+	char path[PATH_MAX];
+
+	while ((c = *sysctl) != '\0') {
+		if (c == '.') {
+			*sysctl = '/';
+		}
+		sysctl++;
+	}
+
+	memset(path, '\0', PATH_MAX);
+	(void)strcpy(path, "/proc/sys/");
+	(void)strncat(path, spath, PATH_MAX - strlen("/proc/sys/"));
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		err(EXIT_FAILURE, "open");
+		/* NOTREACHED */
+	}
+
+	if (read(fd, sval, BUFSIZ) < 0) {
+		err(EXIT_FAILURE, "read");
+		/* NOTREACHED */
+	}
+	(void)close(fd);
+
+	if ((n = (int)strtol(sval, NULL, 10)) < 1) {
+		sval[strcspn(sval, "\n")] = '\0';
+		errx(EXIT_FAILURE, "Unexpected value '%s' for %s.", sval, s);
+		/* NOTREACHED */
+	}
+#  else
+	size_t len;
+
+	if (sysctlbyname(s, NULL, &len, NULL, 0) < 0) {
+		err(EXIT_FAILURE, "sysctl");
+		/* NOTREACHED */
+	}
+
+	if (len > BUFSIZ) {
+		(void)fprintf(stderr, "sysctl value too large for %s\n", spath);
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (sysctlbyname(s, sval, &len, NULL, 0) < 0) {
+		err(EXIT_FAILURE, "sysctl");
+		/* NOTREACHED */
+	}
+	n = *(int *)sval;
+#  endif
+	free(spath);
+	return n;
+}
+#endif
+
+void
+reportSysctl(const char *s) {
+#ifdef __sun
+	(void)s;
+	return;
+#else
+	const char *sname;
+	int n;
+
+	if (QUIET || (strcmp(s, "invalid") == 0)) {
+		return;
+	}
+
+	if ( ((sname = strrchr(s, '.')) == NULL) || strlen(sname) < 2) {
+		sname = s;
+	} else {
+		sname++;
+	}
+
+	n = sysctlValue(s);
+	printf("%-15s: %8d\n", sname, n);
+#endif
+}
+
+/* Both ends of a TCP connection get the same '-O'
+ * options; TCP_CORK is TCP_NOPUSH on the BSDs. */
+void
+setTcpOptions(int fd) {
+	int on = 1;
+
+	if ((TCP_OPTS & OPT_NODELAY) &&
+	    (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) < 0)) {
+		err(EXIT_FAILURE, "setsockopt TCP_NODELAY");
+		/* NOTREACHED */
+	}
+#ifdef TCP_CORK_OPT
+	if ((TCP_OPTS & OPT_CORK) &&
+	    (setsockopt(fd, IPPROTO_TCP, TCP_CORK_OPT, &on, sizeof(on)) < 0)) {
+		err(EXIT_FAILURE, "setsockopt TCP_CORK");
+		/* NOTREACHED */
+	}
+#endif
+#ifdef HAVE_ZEROCOPY
+	if ((TCP_OPTS & OPT_ZEROCOPY) &&
+	    (setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0)) {
+		err(EXIT_FAILURE, "setsockopt SO_ZEROCOPY");
+		/* NOTREACHED */
+	}
+#endif
+}
+
+/* With '-g', the writer hands the kernel datagrams of
+ * many segments of GSO_SIZE bytes each to split up, and
+ * the reader takes them coalesced back into one, the
+ * way QUIC stacks do; on the loopback, the datagram is
+ * never split at all. */
+void
+setGso(int rfd, int wfd) {
+#ifdef HAVE_GSO
+	int on = 1;
+
+	if (!isUdp()) {
+		return;
+	}
+	if ((wfd > 0) &&
+	    (setsockopt(wfd, SOL_UDP, UDP_SEGMENT, &GSO_SIZE, sizeof(GSO_SIZE)) < 0)) {
+		err(EXIT_FAILURE, "setsockopt UDP_SEGMENT");
+		/* NOTREACHED */
+	}
+	if ((rfd > 0) && (setsockopt(rfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) < 0)) {
+		err(EXIT_FAILURE, "setsockopt UDP_GRO");
+		/* NOTREACHED */
+	}
+#else
+	(void)rfd;
+	(void)wfd;
+#endif
+}
+
+void
+setBufferSizes(int rfd, int wfd) {
+	socklen_t s = sizeof(SET_RCVBUF);
+
+	if (GSO) {
+		setGso(rfd, wfd);
+	}
+
+	if (isTcp()) {
+		if (rfd > 0) {
+			setTcpOptions(rfd);
+		}
+		if ((wfd > 0) && (wfd != rfd)) {
+			setTcpOptions(wfd);
+		}
+	}
+
+	if ((rfd > 0) && (SET_RCVBUF >= 0)) {
+		if (setsockopt(rfd, SOL_SOCKET, SO_RCVBUF, (void *)&SET_RCVBUF, s) < 0) {
+/* For unknown reasons, setsockopt(2) fails with EINVAL,
+ * yet still sets the value ?? */
+#ifndef __sun
+			err(EXIT_FAILURE, "setsockopt");
+			/* NOTREACHED */
+#endif
+		}
+	}
+
+	if ((wfd > 0) && (SET_SNDBUF >= 0)) {
+		if (setsockopt(wfd, SOL_SOCKET, SO_SNDBUF, (void *)&SET_SNDBUF, s) < 0) {
+			err(EXIT_FAILURE, "setsockopt");
+			/* NOTREACHED */
+		}
+	}
+
+	/* Linux doesn't let you change SO_SNDLOWAT. */
+	if ((rfd > 0) && (SET_RCVLOWAT >= 0)) {
+		if (setsockopt(rfd, SOL_SOCKET, SO_RCVLOWAT, (void *)&SET_RCVLOWAT, s) < 0) {
+			err(EXIT_FAILURE, "setsockopt SO_RCVLOWAT");
+			/* NOTREACHED */
+		}
+	}
+
+	if ((wfd > 0) && (SET_SNDLOWAT >= 0)) {
+		if (setsockopt(wfd, SOL_SOCKET, SO_SNDLOWAT, (void *)&SET_SNDLOWAT, s) < 0) {
+			err(EXIT_FAILURE, "setsockopt SO_SNDLOWAT");
+			/* NOTREACHED */
+		}
+	}
+}
+
+void
+doShm() {
+	int fd[2];
+
+	openChannel(fd);
+
+	reportTest("shared memory ring");
+
+	if (!QUIET) {
+		(void)printf("%-15s: %8d\n", "Ring size", ringSize());
+		(void)printf("%-15s: %8s\n", "Wakeup", WAKEUP ? "futex" : "spin");
+	}
+
+	if (MODE == LATENCY) {
+		int efd[2];
+		openChannel(efd);
+		latency(fd[0], fd[1], efd[0], efd[1]);
+		return;
+	}
+
+	runTests(fd[0], fd[1]);
+}
+
+void
+doMsgQueue() {
+	int fd[2];
+
+	openChannel(fd);
+
+	if (IPC_TYPE == IPC_MQUEUE) {
+		reportTest("POSIX message queue");
+#ifdef HAVE_MQUEUE
+		struct mq_attr attr;
+
+		if (mq_getattr(fd[0], &attr) < 0) {
+			err(EXIT_FAILURE, "mq_getattr");
+			/* NOTREACHED */
+		}
+		if (!QUIET) {
+			(void)printf("%-15s: %8ld\n", "mq_maxmsg", (long)attr.mq_maxmsg);
+			(void)printf("%-15s: %8ld\n", "mq_msgsize", (long)attr.mq_msgsize);
+		}
+		reportSysctl("fs.mqueue.msg_max");
+		reportSysctl("fs.mqueue.msgsize_max");
+		reportSysctl("fs.mqueue.queues_max");
+#endif
+	} else {
+		struct msqid_ds ds;
+
+		reportTest("SysV message queue");
+		if (msgctl(msgqOf(fd[0])->id, IPC_STAT, &ds) < 0) {
+			err(EXIT_FAILURE, "msgctl(IPC_STAT)");
+			/* NOTREACHED */
+		}
+		if (!QUIET) {
+			(void)printf("%-15s: %8lu\n", "msg_qbytes", (unsigned long)ds.msg_qbytes);
+		}
+#if defined(__linux)
+		reportSysctl("kernel.msgmnb");
+		reportSysctl("kernel.msgmax");
+#elif defined(__FreeBSD__)
+		reportSysctl("kern.ipc.msgmnb");
+		reportSysctl("kern.ipc.msgmax");
+#endif
+	}
+
+	if (MODE == LATENCY) {
+		int efd[2];
+		openChannel(efd);
+		latency(fd[0], fd[1], efd[0], efd[1]);
+		return;
+	}
+
+	runTests(fd[0], fd[1]);
+}
+
+void
+doSocketpair() {
+	int fd[2];
+
+	reportTest("socketpair %s", SET_SOCKTYPE);
+
+	if (socketpair(PF_LOCAL, SOCK_TYPE, 0, fd) < 0) {
+		err(EXIT_FAILURE, "pipe");
+		/* NOTREACHED */
+	}
+
+	setBufferSizes(fd[0], fd[1]);
+
+	/* Not the same values, but of interest either way. */
+#ifdef __linux
+	reportSysctl("net.unix.max_dgram_qlen");
+#else
+	reportSysctl("net.local.dgram.recvspace");
+#endif
+	printSockOpt(fd[0], SO_RCVBUF);
+	printSockOpt(fd[0], SO_RCVLOWAT);
+	printSockOpt(fd[1], SO_SNDBUF);
+	printSockOpt(fd[1], SO_SNDLOWAT);
+
+	runTests(fd[0], fd[1]);
+}
+
+void
+cleanup() {
+	struct msgq *q;
+
+	(void)unlink("socket");
+	(void)unlink("socket2");
+	(void)unlink("socket.tmp");
+	(void)unlink("fifo");
+	(void)unlink("fifo2");
+	(void)unlink("fifo.tmp");
+	for (q = OWNED_MSGQS; q != NULL; q = q->next) {
+		if (q->owner == getpid()) {
+			(void)msgctl(q->id, IPC_RMID, NULL);
+		}
+	}
+}
+
+void
+doFifo() {
+	int rfd, wfd;
+
+	reportTest("fifo");
+
+	if (mkfifo("fifo", 0644) < 0) {
+		err(EXIT_FAILURE, "fifo");
+		/* NOTREACHED */
+	}
+	if ((rfd = open("fifo", O_RDONLY|O_NONBLOCK)) < 0) {
+		err(EXIT_FAILURE, "open");
+		/* NOTREACHED */
+	}
+	if ((wfd = open("fifo", O_WRONLY|O_NONBLOCK)) < 0) {
+		err(EXIT_FAILURE, "open");
+		/* NOTREACHED */
+	}
+
+	if (MODE == LATENCY) {
+		int erfd, ewfd;
+		if (mkfifo("fifo2", 0644) < 0) {
+			err(EXIT_FAILURE, "fifo");
+			/* NOTREACHED */
+		}
+		if ((erfd = open("fifo2", O_RDONLY|O_NONBLOCK)) < 0) {
+			err(EXIT_FAILURE, "open");
+			/* NOTREACHED */
+		}
+		if ((ewfd = open("fifo2", O_WRONLY)) < 0) {
+			err(EXIT_FAILURE, "open");
+			/* NOTREACHED */
+		}
+		/* We opened the fifos non-blocking so as to not
+		 * hang in open(2); ping-pong wants to block. */
+		if ((setFlags(rfd, 0) < 0) || (setFlags(wfd, 0) < 0) ||
+		    (setFlags(erfd, 0) < 0)) {
+			err(EXIT_FAILURE, "fcntl set flags");
+			/* NOTREACHED */
+		}
+		latency(rfd, wfd, erfd, ewfd);
+		return;
+	}
+
+	runTests(rfd, wfd);
+}
+
+/* Fill in the address we use for our sockets: either
+ * the given path for PF_LOCAL or the given port on the
+ * loopback address for PF_INET and PF_INET6. */
+socklen_t
+setSockAddr(struct sockaddr_storage *ss, const char *path, uint16_t port) {
+	memset(ss, 0, sizeof(*ss));
+
+	if (SOCK_DOMAIN == PF_LOCAL) {
+		struct sockaddr_un *sun = (struct sockaddr_un *)ss;
+		sun->sun_family = PF_LOCAL;
+		(void)strncpy(sun->sun_path, path, sizeof(sun->sun_path) - 1);
+		return sizeof(*sun);
+	} else if (SOCK_DOMAIN == PF_INET) {
+		struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+
+		if (inet_pton(PF_INET, "127.0.0.1", &(sin->sin_addr)) != 1) {
+			err(EXIT_FAILURE, "inet_pton");
+			/* NOTREACHED */
+		}
+
+		sin->sin_family = PF_INET;
+		sin->sin_port = htons(port);
+		return sizeof(*sin);
+	} else if (SOCK_DOMAIN == PF_INET6) {
+		struct sockaddr_in6 *sin = (struct sockaddr_in6 *)ss;
+
+		if (inet_pton(PF_INET6, "::1", &(sin->sin6_addr)) != 1) {
+			err(EXIT_FAILURE, "inet_pton");
+			/* NOTREACHED */
+		}
+
+		sin->sin6_family = PF_INET6;
+		sin->sin6_port = htons(port);
+		return sizeof(*sin);
+	}
+
+	errx(EXIT_FAILURE, "Unexpected socket domain '%d'. Bailing out.\n", SOCK_DOMAIN);
+	/* NOTREACHED */
+}
+
+/* For datagram sockets, the latency test needs a second
+ * socket to send the echo to; connect the two to each
+ * other and return the new one. */
+int
+echoSocket(int fd) {
+	int efd;
+	socklen_t s_size, e_size;
+	struct sockaddr_storage s, e;
+
+	s_size = setSockAddr(&s, "socket", PORT);
+	e_size = setSockAddr(&e, "socket2", PORT + 1);
+
+	if ((efd = socket(SOCK_DOMAIN, SOCK_TYPE, 0)) < 0) {
+		err(EXIT_FAILURE, "socket");
+		/* NOTREACHED */
+	}
+	if (bind(efd, (struct sockaddr *)&e, e_size)) {
+		err(EXIT_FAILURE, "bind");
+		/* NOTREACHED */
+	}
+	/* PF_LOCAL won't let us connect to a socket that is
+	 * connected to another one, so re-target it first. */
+	if (connect(fd, (struct sockaddr *)&e, e_size) < 0) {
+		err(EXIT_FAILURE, "connect");
+		/* NOTREACHED */
+	}
+	if (connect(efd, (struct sockaddr *)&s, s_size) < 0) {
+		err(EXIT_FAILURE, "connect");
+		/* NOTREACHED */
+	}
+	setBufferSizes(fd, efd);
+	return efd;
+}
+
+/* Create a fresh channel of the requested type entirely
+ * within this process: fd[0] is the read end, fd[1] the
+ * write end (the same socket for datagram sockets, which
+ * we connect to themselves).  Any names in the file system
+ * are removed right away, so we can create as many of
+ * these as we like. */
+void
+openChannel(int fd[2]) {
+	OPEN_FAILED = NULL;
+
+	switch(IPC_TYPE) {
+	case IPC_PIPE:
+		if (pipe(fd) < 0) {
+			openFailed("pipe");
+			return;
+		}
+		setPipeSize(fd[1]);
+		if (OPEN_FAILED != NULL) {
+			(void)close(fd[0]);
+			(void)close(fd[1]);
+		}
+		break;
+	case IPC_FIFO:
+		(void)unlink("fifo.tmp");
+		if (mkfifo("fifo.tmp", 0644) < 0) {
+			openFailed("fifo");
+			return;
+		}
+		if ((fd[0] = open("fifo.tmp", O_RDONLY|O_NONBLOCK)) < 0) {
+			openFailed("open");
+			(void)unlink("fifo.tmp");
+			return;
+		}
+		if ((fd[1] = open("fifo.tmp", O_WRONLY|O_NONBLOCK)) < 0) {
+			openFailed("open");
+			(void)close(fd[0]);
+			(void)unlink("fifo.tmp");
+			return;
+		}
+		(void)unlink("fifo.tmp");
+		break;
+	case IPC_SOCKETPAIR:
+		if (socketpair(PF_LOCAL, SOCK_TYPE, 0, fd) < 0) {
+			openFailed("socketpair");
+			return;
+		}
+		setBufferSizes(fd[0], fd[1]);
+		break;
+	case IPC_SOCKET: {
+		int sfd, on = 1;
+		socklen_t s_size;
+		struct sockaddr_storage s;
+
+		s_size = setSockAddr(&s, "socket.tmp", 0);
+		(void)unlink("socket.tmp");
+
+		if ((sfd = socket(SOCK_DOMAIN, SOCK_TYPE, 0)) < 0) {
+			openFailed("socket");
+			return;
+		}
+		if (setsockopt(sfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+			err(EXIT_FAILURE, "setsockopt");
+			/* NOTREACHED */
+		}
+		if (bind(sfd, (struct sockaddr *)&s, s_size)) {
+			openFailed("bind");
+			(void)close(sfd);
+			return;
+		}
+		/* We bound to port 0; find out which one we got. */
+		if (getsockname(sfd, (struct sockaddr *)&s, &s_size) < 0) {
+			err(EXIT_FAILURE, "getsockname");
+			/* NOTREACHED */
+		}
+
+		if (SOCK_TYPE == SOCK_DGRAM) {
+			fd[0] = fd[1] = sfd;
+		} else {
+			if (listen(sfd, 1) < 0) {
+				err(EXIT_FAILURE, "listen");
+				/* NOTREACHED */
+			}
+			if ((fd[1] = socket(SOCK_DOMAIN, SOCK_TYPE, 0)) < 0) {
+				openFailed("socket");
+				(void)close(sfd);
+				return;
+			}
+		}
+		if (connect(fd[1], (struct sockaddr *)&s, s_size) < 0) {
+			openFailed("connect");
+			if (fd[1] != sfd) {
+				(void)close(fd[1]);
+			}
+			(void)close(sfd);
+			return;
+		}
+		if (SOCK_TYPE == SOCK_STREAM) {
+			if ((fd[0] = accept(sfd, NULL, NULL)) < 0) {
+				openFailed("accept");
+				(void)close(fd[1]);
+				(void)close(sfd);
+				return;
+			}
+			(void)close(sfd);
+		}
+		(void)unlink("socket.tmp");
+		setBufferSizes(fd[0], fd[1]);
+		break;
+	}
+	case IPC_SHM:
+		openRing(fd);
+		break;
+	case IPC_MQUEUE:
+		openMqueue(fd);
+		break;
+	case IPC_MSGQ:
+		openMsgq(fd);
+		break;
+	default:
+		errx(EXIT_FAILURE, "Unknown IPC type: %d", IPC_TYPE);
+		/* NOTREACHED */
+	}
+}
+
+void
+closeChannel(int fd[2]) {
+	closeRing(fd[0]);
+	closeRing(fd[1]);
+	closeMsgq(fd[0], 1);
+	closeMsgq(fd[1], 1);
+	(void)close(fd[0]);
+	if (fd[1] != fd[0]) {
+		(void)close(fd[1]);
+	}
+}
+
+/* One end of a channel, with the other still in use. */
+void
+closeEnd(int fd) {
+	closeRing(fd);
+	closeMsgq(fd, 0);
+	(void)close(fd);
+}
+
+/* A datagram of 'count' bytes was too large.  Rather
+ * than trying one byte less at a time, bisect for the
+ * largest datagram we can send on a scratch channel of
+ * the same kind, reading back each datagram that fit so
+ * that the result does not depend on how full the buffer
+ * is.  ENOBUFS and EAGAIN may only mean that the buffer
+ * was full, so 'count' itself is tried first; if it fits,
+ * there is no limit to cache and we return -1. */
+int
+findMsgsize(int count) {
+	char *buf;
+	int fd[2];
+	int lo = MSGSIZE_FITS, hi = count + 1, writes = 0;
+
+	if (count <= MSGSIZE_FITS) {
+		return -1;
+	}
+
+	buf = getArena(count);
+
+	openChannel(fd);
+	if (setFlags(fd[1], O_NONBLOCK) < 0) {
+		err(EXIT_FAILURE, "fcntl set flags");
+		/* NOTREACHED */
+	}
+	if (setFlags(fd[0], O_NONBLOCK) < 0) {
+		err(EXIT_FAILURE, "fcntl set flags");
+		/* NOTREACHED */
+	}
+
+	while (hi - lo > 1) {
+		int mid = writes ? lo + (hi - lo) / 2 : count;
+		ssize_t n;
+
+		writes++;
+		if ((n = doWrite(fd[1], buf, mid)) < 0) {
+			if ((errno != EMSGSIZE) && (errno != ENOBUFS) &&
+			    (errno != EAGAIN)) {
+				err(EXIT_FAILURE, "write");
+				/* NOTREACHED */
+			}
+			hi = mid;
+			continue;
+		}
+		/* Whatever went out, take it back out. */
+		if ((n > 0) && (doRead(fd[0], buf, mid) < 0)) {
+			err(EXIT_FAILURE, "read");
+			/* NOTREACHED */
+		}
+		if (n == mid) {
+			lo = mid;
+		} else {
+			/* A short write doesn't fit either. */
+			hi = mid;
+		}
+	}
+	closeChannel(fd);
+
+	if (lo == count) {
+		MSGSIZE_FITS = count;
+		return -1;
+	}
+
+	if (!QUIET) {
+		(void)printf("%-15s: %8d (after %d write%s)\n", "MSGSIZE", lo,
+				writes, writes != 1 ? "s" : "");
+	}
+	return lo;
+}
+
+/* Try to write 'count' bytes in one go without blocking
+ * and return how many bytes were accepted. */
+int
+probeWrite(int fd, const char *buf, int count, int *syscalls) {
+	int n;
+
+	(*syscalls)++;
+	if ((n = doWrite(fd, buf, count)) < 0) {
+		if ((errno == EAGAIN) || (errno == EMSGSIZE) ||
+		    (errno == ENOBUFS)) {
+			return 0;
+		}
+		err(EXIT_FAILURE, "write");
+		/* NOTREACHED */
+	}
+	return n;
+}
+
+/* Does a single write of 'count' bytes into a fresh
+ * channel go through in full? */
+int
+probeFits(const char *buf, int count, int *probes, int *syscalls) {
+	int fd[2];
+	int n;
+
+	openChannel(fd);
+	if (setFlags(fd[1], O_NONBLOCK) < 0) {
+		err(EXIT_FAILURE, "fcntl set flags");
+		/* NOTREACHED */
+	}
+	n = probeWrite(fd[1], buf, count, syscalls);
+	closeChannel(fd);
+	(*probes)++;
+
+	if (!QUIET) {
+		(void)printf("Probe %8d byte%s: %8d\n", count,
+				count > 1 ? "s" : " ", n);
+	}
+	return n == count;
+}
+
+/* Rather than writing ever so slightly larger chunks
+ * until something gives, find the largest single write
+ * by doubling the chunk size until it no longer fits,
+ * then bisecting.  Then fill a fresh channel with writes
+ * of that size, halving the size whenever a write fails,
+ * to find the total capacity. */
+void
+probe() {
+	char *buf;
+	int fd[2];
+	int lo = 0, hi, size, total = 0, limit = -1;
+	int probes = 0, syscalls = 0;
+
+	if (!QUIET) {
+		(void)printf("Starting with %d byte%s, doubling until a single write "
+				"no longer fits,\nthen bisecting.\n\n",
+				CHUNK1, CHUNK1 > 1 ? "s" : "");
+	}
+
+	hi = CHUNK1 > 0 ? CHUNK1 : 1;
+	buf = getArena(hi);
+
+	while (probeFits(buf, hi, &probes, &syscalls)) {
+		lo = hi;
+		if (hi > INT_MAX / 2) {
+			break;
+		}
+		hi *= 2;
+		buf = getArena(hi);
+	}
+
+	while (hi - lo > 1) {
+		int mid = lo + (hi - lo) / 2;
+		if (probeFits(buf, mid, &probes, &syscalls)) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	openChannel(fd);
+	probes++;
+	if (setFlags(fd[1], O_NONBLOCK) < 0) {
+		err(EXIT_FAILURE, "fcntl set flags");
+		/* NOTREACHED */
+	}
+	/* UDP never tells us when the receiver's buffer is
+	 * full; it just drops the datagram.  So stop after
+	 * we've written more than it could possibly hold and
+	 * count what actually arrived. */
+	if (isDgram() && (SOCK_DOMAIN != PF_LOCAL)) {
+		int rcvbuf;
+		socklen_t len = sizeof(rcvbuf);
+
+		if (getsockopt(fd[0], SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len) < 0) {
+			err(EXIT_FAILURE, "getsockopt");
+			/* NOTREACHED */
+		}
+		limit = 4 * rcvbuf;
+	}
+
+	size = lo;
+	while ((size > 0) && ((limit < 0) || (total < limit))) {
+		int n = probeWrite(fd[1], buf, size, &syscalls);
+		total += n;
+		if (n < size) {
+			size /= 2;
+		}
+	}
+
+	if (limit >= 0) {
+		int n, written = total;
+
+		total = 0;
+		while ((n = read(fd[0], buf, lo)) > 0) {
+			total += n;
+		}
+		if (!QUIET) {
+			(void)printf("%-15s: %8d\n", "Dropped", written - total);
+		}
+	}
+	closeChannel(fd);
+
+	if (!QUIET) {
+		(void)printf("\n");
+		(void)printf("%-15s: %8d\n", "Max write", lo);
+		(void)printf("%-15s: %8d\n", "Channels", probes);
+		(void)printf("%-15s: %8d\n", "Writes", syscalls);
+		(void)printf("Observed total : %8d\n", total);
+	} else if (FORMAT == FMT_TEXT) {
+		(void)printf("%d\n", total);
+	}
+	RESULT.maxwrite = lo;
+	RESULT.total = total;
+}
+
+void
+doProbe() {
+	switch(IPC_TYPE) {
+	case IPC_FIFO:
+		reportTest("fifo");
+		break;
+	case IPC_PIPE:
+		reportTest("pipe");
+		break;
+	case IPC_SOCKET:
+		reportTest("%s %s socket", SET_SOCKDOMAIN, SET_SOCKTYPE);
+		break;
+	case IPC_SOCKETPAIR:
+		reportTest("socketpair %s", SET_SOCKTYPE);
+		break;
+	case IPC_SHM:
+		reportTest("shared memory ring");
+		break;
+	case IPC_MQUEUE:
+		reportTest("POSIX message queue");
+		break;
+	case IPC_MSGQ:
+		reportTest("SysV message queue");
+		break;
+	}
+	probe();
+}
+
+/* A global limit that applies once there are many
+ * channels; unlike reportSysctl(), it's not an error if
+ * this system doesn't have it, and vectors are printed
+ * as they are.  Limits that aren't among TUNABLES are
+ * read directly. */
+void
+reportLimit(const char *s) {
+#ifdef __sun
+	(void)s;
+#else
+	const char *v, *sname;
+	char *fresh = NULL;
+
+	if (QUIET) {
+		return;
+	}
+	if (((v = tunableValue(s)) == NULL) &&
+	    ((v = fresh = readTunable(s)) == NULL)) {
+		return;
+	}
+	if ((sname = strrchr(s, '.')) != NULL) {
+		s = sname + 1;
+	}
+	(void)printf("%-15s: %8s\n", s, v);
+	free(fresh);
+#endif
+}
+
+int
+cmpInt(const void *a, const void *b) {
+	return *(const int *)a - *(const int *)b;
+}
+
+/* Write to a channel until it won't take any more,
+ * halving the chunk size whenever a write comes up
+ * short, and return how much it took. */
+int
+fillChannel(int fd, char *buf) {
+	int size = CHUNK1, total = 0, writes = 0;
+
+	if (setFlags(fd, O_NONBLOCK) < 0) {
+		err(EXIT_FAILURE, "fcntl set flags");
+		/* NOTREACHED */
+	}
+	while (size > 0) {
+		int n = probeWrite(fd, buf, size, &writes);
+		total += n;
+		if (n < size) {
+			size /= 2;
+		}
+	}
+	return total;
+}
+
+/* The limit that most likely kept fanout() from opening
+ * another channel, going by the errno it got. */
+const char *
+openLimit(int e) {
+	switch (e) {
+	case EMFILE:
+		return IPC_TYPE == IPC_MQUEUE ? "RLIMIT_NOFILE or RLIMIT_MSGQUEUE" : "RLIMIT_NOFILE";
+	case ENFILE:
+		return IPC_TYPE == IPC_PIPE ? "fs.file-max or fs.pipe-user-pages-hard" : "fs.file-max";
+	case ENOSPC:
+		if (IPC_TYPE == IPC_MQUEUE) {
+			return "fs.mqueue.queues_max";
+		}
+		return IPC_TYPE == IPC_MSGQ ? "kernel.msgmni" : "no space";
+	case EPERM:
+		return IPC_TYPE == IPC_PIPE ? "fs.pipe-user-pages-hard or fs.pipe-max-size" : "permission";
+	case ENOMEM:
+	case ENOBUFS:
+		return "kernel memory";
+	case EADDRINUSE:
+	case EADDRNOTAVAIL:
+		return "net.ipv4.ip_local_port_range";
+	default:
+		return "unknown limit";
+	}
+}
+
+/* Open '-N' channels at once and fill each of them.  A
+ * single channel only ever runs into its own buffer
+ * size, but thousands of them run into the limits the
+ * kernel puts on all of them together: a user's pipes
+ * drop to a single page once they hold more than
+ * fs.pipe-user-pages-soft, TCP goes into memory
+ * pressure past net.ipv4.tcp_mem, and so on.  So note
+ * where the channels start to get less than the first
+ * one did. */
+void
+fanout() {
+	char *buf;
+	int *fds, *caps, *sorted;
+	int i, j, n = CHANNELS, shrink = 0;
+	long long total = 0;
+	int perchan = isDgram() && (IPC_TYPE == IPC_SOCKET) ? 1 : 2;
+	long long kmem = 0;
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+		err(EXIT_FAILURE, "getrlimit");
+		/* NOTREACHED */
+	}
+	if ((rl.rlim_cur != RLIM_INFINITY) &&
+	    (rl.rlim_cur < (rlim_t)n * perchan + 32)) {
+		rl.rlim_cur = (rlim_t)n * perchan + 32;
+		if ((rl.rlim_max != RLIM_INFINITY) && (rl.rlim_cur > rl.rlim_max)) {
+			rl.rlim_cur = rl.rlim_max;
+		}
+		if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+			err(EXIT_FAILURE, "setrlimit");
+			/* NOTREACHED */
+		}
+		if (rl.rlim_cur < (rlim_t)n * perchan + 32) {
+			n = (int)((rl.rlim_cur - 32) / perchan);
+			if (n < 1) {
+				errx(EXIT_FAILURE, "RLIMIT_NOFILE too low to open any channels");
+				/* NOTREACHED */
+			}
+			(void)fprintf(stderr, "RLIMIT_NOFILE only allows %d channels.\n", n);
+		}
+	}
+
+	if (!QUIET) {
+		(void)printf("%-15s: %8d\n", "Open files", (int)rl.rlim_cur);
+		switch(IPC_TYPE) {
+		case IPC_PIPE:
+		case IPC_FIFO:
+			reportLimit("fs.pipe-max-size");
+			reportLimit("fs.pipe-user-pages-soft");
+			reportLimit("fs.pipe-user-pages-hard");
+			reportLimit("kern.ipc.maxpipekva");
+			break;
+		case IPC_SOCKET:
+		case IPC_SOCKETPAIR:
+			reportLimit("net.core.wmem_max");
+			reportLimit("net.core.rmem_max");
+			reportLimit("kern.ipc.maxsockbuf");
+			if (isTcp()) {
+				reportLimit("net.ipv4.tcp_mem");
+				reportLimit("net.ipv4.tcp_wmem");
+				reportLimit("net.ipv4.tcp_rmem");
+			} else if (isDgram()) {
+				reportLimit("net.unix.max_dgram_qlen");
+			}
+			break;
+		case IPC_MQUEUE:
+			reportLimit("fs.mqueue.queues_max");
+			reportLimit("fs.mqueue.msg_max");
+			break;
+		case IPC_MSGQ:
+			reportLimit("kernel.msgmni");
+			reportLimit("kernel.msgmnb");
+			break;
+		}
+		(void)printf("\n");
+	}
+
+	if (((fds = calloc(2 * n, sizeof(*fds))) == NULL) ||
+	    ((caps = calloc(n, sizeof(*caps))) == NULL) ||
+	    ((sorted = calloc(n, sizeof(*sorted))) == NULL)) {
+		err(EXIT_FAILURE, "calloc");
+		/* NOTREACHED */
+	}
+	buf = getArena(CHUNK1);
+
+	/* Open them all before we fill any, so that every
+	 * channel exists while the others are full.  Running
+	 * into a limit on all of them together before we
+	 * have opened them all is a result, too. */
+	SOFT_OPEN = 1;
+	for (i = 0; i < n; i++) {
+		openChannel(&fds[2 * i]);
+		if (OPEN_FAILED != NULL) {
+			break;
+		}
+	}
+	SOFT_OPEN = 0;
+	if (i < n) {
+		if (i == 0) {
+			errno = OPEN_ERRNO;
+			err(EXIT_FAILURE, "%s", OPEN_FAILED);
+			/* NOTREACHED */
+		}
+		(void)fprintf(stderr, "Only %d channels opened: %s: %s (%s).\n", i,
+				OPEN_FAILED, strerror(OPEN_ERRNO), openLimit(OPEN_ERRNO));
+		n = i;
+	}
+	for (i = 0; i < n; i++) {
+		caps[i] = fillChannel(fds[2 * i + 1], buf);
+		total += caps[i];
+		if (!shrink && (caps[i] < caps[0])) {
+			shrink = i + 1;
+		}
+		if (kmem >= 0) {
+			long long k = kernelMemory(fds[2 * i + 1], fds[2 * i]);
+			kmem = k < 0 ? -1 : kmem + k;
+		}
+	}
+
+	if (!QUIET) {
+		/* Runs of channels that took the same amount. */
+		for (i = 0; i < n; i = j) {
+			char range[BUFSIZ];
+
+			for (j = i + 1; (j < n) && (caps[j] == caps[i]); j++) {
+				;
+			}
+			(void)snprintf(range, sizeof(range), "Channels %d-%d", i + 1, j);
+			(void)printf("%-15s: %8d\n", range, caps[i]);
+		}
+		(void)printf("\n");
+	}
+
+#ifdef __linux
+	/* How much of tcp_mem (in pages) all of this costs. */
+	if (!QUIET && isTcp()) {
+		char line[BUFSIZ];
+		FILE *f;
+
+		if ((f = fopen("/proc/net/sockstat", "r")) != NULL) {
+			while (fgets(line, sizeof(line), f) != NULL) {
+				if (strncmp(line, "TCP:", 4) == 0) {
+					(void)printf("%-15s: %s", "sockstat", line);
+				}
+			}
+			(void)fclose(f);
+		}
+	}
+#endif
+
+	for (i = 0; i < n; i++) {
+		closeChannel(&fds[2 * i]);
+	}
+
+	(void)memcpy(sorted, caps, n * sizeof(*caps));
+	qsort(sorted, n, sizeof(*sorted), cmpInt);
+
+	RESULT.channels = n;
+	RESULT.chan_min = sorted[0];
+	RESULT.chan_max = sorted[n - 1];
+	RESULT.shrink_at = shrink;
+	RESULT.total = total;
+	RESULT.kmem = kmem;
+
+	if (!QUIET) {
+		(void)printf("%-15s: %8d\n", "Channels", n);
+		(void)printf("%-15s: %8d\n", "Smallest", sorted[0]);
+		(void)printf("%-15s: %8d\n", "Median", sorted[n / 2]);
+		(void)printf("%-15s: %8d\n", "Largest", sorted[n - 1]);
+		if (shrink) {
+			(void)printf("%-15s: %8d\n", "Shrinks at", shrink);
+		}
+		if (kmem >= 0) {
+			(void)printf("%-15s: %8lld\n", "Kernel memory", kmem);
+		}
+		(void)printf("Observed total : %8lld\n", total);
+	} else if (FORMAT == FMT_TEXT) {
+		(void)printf("%lld\n", total);
+	}
+
+	free(sorted);
+	free(caps);
+	free(fds);
+}
+
+void
+doFanout() {
+	switch(IPC_TYPE) {
+	case IPC_FIFO:
+		reportTest("fifo");
+		break;
+	case IPC_PIPE:
+		reportTest("pipe");
+		break;
+	case IPC_SOCKET:
+		reportTest("%s %s socket", SET_SOCKDOMAIN, SET_SOCKTYPE);
+		break;
+	case IPC_SOCKETPAIR:
+		reportTest("socketpair %s", SET_SOCKTYPE);
+		break;
+	case IPC_SHM:
+		reportTest("shared memory ring");
+		break;
+	case IPC_MQUEUE:
+		reportTest("POSIX message queue");
+		break;
+	case IPC_MSGQ:
+		reportTest("SysV message queue");
+		break;
+	}
+	fanout();
+}
+
+/* Write chunks of 'count' bytes into a non-blocking
+ * pipe until it's full; returns the total and counts
+ * the writes. */
+int
+fillPipe(int fd, char *buf, int count, int *writes, long long *ns) {
+	int total = 0;
+
+	while (1) {
+		long long start = nsecs();
+		ssize_t n = write(fd, buf, count);
+
+		*ns += nsecs() - start;
+		if (n < 0) {
+			if (errno == EAGAIN) {
+				break;
+			}
+			err(EXIT_FAILURE, "write");
+			/* NOTREACHED */
+		}
+		total += n;
+		(*writes)++;
+	}
+	return total;
+}
+
+/* A Linux pipe is a ring of page-sized slots (16 by
+ * default, or '-P' bytes' worth).  A write that fits
+ * into what's left of the last slot is merged into it,
+ * but anything else starts a new slot, so, depending on
+ * the chunk size, a pipe may be full long before it
+ * holds F_GETPIPE_SZ bytes.  In packet mode (O_DIRECT),
+ * nothing is ever merged and every write takes at least
+ * one slot of its own.
+ *
+ * For a single chunk size, fill a fresh pipe and one in
+ * packet mode, then fill and drain the pipe over and
+ * over for a while to see how fast we can write chunks
+ * of that size. */
+void
+subpageRow(int count, int pagesize) {
+	char *buf;
+	int fd[2], pfd[2];
+	int pipesz, slots, writes = 0, pwrites = 0, total, ptotal;
+	long long ns = 0, pns = 0, bytes = 0, calls = 0, until;
+
+	buf = getArena(count);
+
+	openChannel(fd);
+	if ((setFlags(fd[1], O_NONBLOCK) < 0) ||
+	    (setFlags(fd[0], O_NONBLOCK) < 0)) {
+		err(EXIT_FAILURE, "fcntl set flags");
+		/* NOTREACHED */
+	}
+	if ((pipesz = fcntl(fd[1], F_GETPIPE_SZ)) < 0) {
+		err(EXIT_FAILURE, "fcntl(F_GETPIPE_SZ)");
+		/* NOTREACHED */
+	}
+	slots = pipesz / pagesize;
+
+	total = fillPipe(fd[1], buf, count, &writes, &ns);
+
+	/* The same in packet mode. */
+	if (pipe2(pfd, O_DIRECT | O_NONBLOCK) < 0) {
+		err(EXIT_FAILURE, "pipe2");
+		/* NOTREACHED */
+	}
+	setPipeSize(pfd[1]);
+	ptotal = fillPipe(pfd[1], buf, count, &pwrites, &pns);
+	(void)close(pfd[0]);
+	(void)close(pfd[1]);
+
+	/* Only the writes count towards the MB/s; the
+	 * drain in between is ours. */
+	bytes = total;
+	calls = writes;
+	until = nsecs() + SUBPAGE_NS;
+	while (nsecs() < until) {
+		char *rbuf = getArena(pipesz > count ? pipesz : count);
+		int w = 0;
+
+		while (read(fd[0], rbuf, pipesz) > 0) {
+			;
+		}
+		bytes += fillPipe(fd[1], rbuf, count, &w, &ns);
+		calls += w;
+	}
+	closeChannel(fd);
+
+	RESULT.total = total;
+	RESULT.writes = writes;
+	RESULT.slots = slots;
+	RESULT.packet = ptotal;
+	RESULT.w.bytes = bytes;
+	RESULT.w.ops = calls;
+	RESULT.w.elapsed = (double)ns / 1e9;
+
+	if (QUIET) {
+		if (FORMAT == FMT_TEXT) {
+			(void)printf("%d %d\n", count, total);
+		}
+		return;
+	}
+	(void)printf("%8d %8d %10d %10.1f %8.1f%% %8d %10.2f\n",
+			count, writes, total, (double)total / slots,
+			100.0 * total / pipesz, ptotal,
+			ns > 0 ? (double)bytes * 1000 / ns : 0);
+}
+
+void
+subpage() {
+	int sizes[MAX_SUBPAGE_SIZES];
+	int i, n = 1, fd[2], pipesz;
+	int pagesize = (int)sysconf(_SC_PAGESIZE);
+
+	if (CHUNK1 > 0) {
+		sizes[0] = CHUNK1;
+	} else {
+		n = subpageSizes(sizes);
+	}
+
+	if (!QUIET) {
+		openChannel(fd);
+		if ((pipesz = fcntl(fd[1], F_GETPIPE_SZ)) < 0) {
+			err(EXIT_FAILURE, "fcntl(F_GETPIPE_SZ)");
+			/* NOTREACHED */
+		}
+		closeChannel(fd);
+		(void)printf("%-15s: %8d\n", "F_GETPIPE_SZ", pipesz);
+		(void)printf("%-15s: %8d\n", "Page size", pagesize);
+		(void)printf("%-15s: %8d\n", "Slots", pipesz / pagesize);
+		(void)printf("\n%8s %8s %10s %10s %9s %8s %10s\n", "Chunk", "Writes",
+				"Capacity", "Bytes/slot", "Of size", "Packet", "Write MB/s");
+	}
+	for (i = 0; i < n; i++) {
+		subpageRow(sizes[i], pagesize);
+	}
+}
+
+void
+doSubpage() {
+	reportTest("pipe");
+	subpage();
+}
+
+/* In chain mode, HOPS channels connect HOPS + 1
+ * processes like 'a | b | c' in a shell: a writer, the
+ * stages that forward whatever they read, and a reader
+ * at the end.  Each of them keeps its numbers here, in
+ * memory shared with the parent. */
+struct stage {
+	long long bytes;
+	long long calls;
+	long long read_ns;	/* waiting for (and reading) data */
+	long long write_ns;	/* waiting for room (and writing) */
+	double start;
+	double end;
+};
+
+struct chain {
+	int hops;
+	int (*fds)[2];
+	struct stage *stages;
+	long long *arrivals;	/* latency: [stage][message], ack last */
+};
+
+/* With '-P a:b:c', every hop gets its own pipe size;
+ * the last one given applies to the rest. */
+void
+chainOpen(struct chain *c) {
+	int h, set = SET_PIPEBUF;
+
+	for (h = 0; h < c->hops; h++) {
+		if (NUM_HOP_PIPEBUFS > 0) {
+			SET_PIPEBUF = HOP_PIPEBUFS[h < NUM_HOP_PIPEBUFS ? h : NUM_HOP_PIPEBUFS - 1];
+		}
+		openChannel(c->fds[h]);
+	}
+	SET_PIPEBUF = set;
+}
+
+/* Everything but our own ends of the chain; the parent
+ * only keeps the read ends, to look at the queues. */
+void
+chainClose(struct chain *c, int in, int out) {
+	int h;
+
+	for (h = 0; h < c->hops; h++) {
+		if (c->fds[h][0] != in) {
+			(void)close(c->fds[h][0]);
+		}
+		if (c->fds[h][1] != out) {
+			(void)close(c->fds[h][1]);
+		}
+	}
+}
+
+void
+setBlocking(int fd) {
+	int flags;
+
+	if (((flags = fcntl(fd, F_GETFL, 0)) < 0) ||
+	    (setFlags(fd, flags & ~O_NONBLOCK) < 0)) {
+		err(EXIT_FAILURE, "fcntl");
+		/* NOTREACHED */
+	}
+}
+
+/* Move 'count' bytes (or whatever there is, if 'count'
+ * is 0) from one stage to the next: either read into
+ * our buffer and write it out again, or, with '-V',
+ * splice(2) it over without it ever reaching us.
+ * Returns the number of bytes moved, 0 on EOF. */
+ssize_t
+forward(int in, int out, char *buf, int bufsiz, int count, struct stage *st) {
+	ssize_t total = 0;
+	long long t;
+
+	do {
+		int want = count ? count - total : bufsiz;
+		ssize_t n;
+
+		t = nsecs();
+#ifdef SPLICE_F_NONBLOCK
+		if (SPLICE) {
+			struct pollfd pfd = { in, POLLIN, 0 };
+
+			if (doPoll(&pfd, -1) < 0) {
+				err(EXIT_FAILURE, "poll");
+				/* NOTREACHED */
+			}
+			st->read_ns += nsecs() - t;
+			t = nsecs();
+			if ((n = splice(in, NULL, out, NULL, want, SPLICE_F_MOVE)) < 0) {
+				err(EXIT_FAILURE, "splice");
+				/* NOTREACHED */
+			}
+			st->write_ns += nsecs() - t;
+		} else
+#endif
+		{
+			if ((n = read(in, buf, want)) < 0) {
+				err(EXIT_FAILURE, "read");
+				/* NOTREACHED */
+			}
+			st->read_ns += nsecs() - t;
+			t = nsecs();
+			writeFull(out, buf, n);
+			st->write_ns += nsecs() - t;
+		}
+		if (n == 0) {
+			break;
+		}
+		total += n;
+		st->calls++;
+	} while (count && (total < count));
+
+	st->bytes += total;
+	return total;
+}
+
+/* One stage of the throughput test. */
+void
+chainStage(struct chain *c, int s) {
+	struct stage *st = &c->stages[s];
+	int in = s > 0 ? c->fds[s - 1][0] : -1;
+	int out = s < c->hops ? c->fds[s][1] : -1;
+	int bufsiz = CHUNK1 > BUFSIZ ? CHUNK1 : BUFSIZ;
+	char *buf;
+
+	chainClose(c, in, out);
+	buf = getArena(bufsiz);
+	if ((in < 0) || (out < 0)) {
+		/* Only the stages in between splice. */
+		SPLICE = 0;
+	}
+	if (in >= 0) {
+		setBlocking(in);
+	}
+	if (out >= 0) {
+		setBlocking(out);
+	}
+
+	st->start = now();
+	if (in < 0) {
+		double end = st->start + DURATION;
+
+		while (((BYTE_LIMIT < 0) && (now() < end)) ||
+		    ((BYTE_LIMIT > 0) && (st->bytes < BYTE_LIMIT))) {
+			long long t = nsecs();
+
+			writeFull(out, buf, CHUNK1);
+			st->write_ns += nsecs() - t;
+			st->bytes += CHUNK1;
+			st->calls++;
+		}
+		st->end = now();
+	} else if (out < 0) {
+		while (1) {
+			long long t = nsecs();
+			ssize_t n;
+
+			if ((n = read(in, buf, bufsiz)) < 0) {
+				err(EXIT_FAILURE, "read");
+				/* NOTREACHED */
+			}
+			st->read_ns += nsecs() - t;
+			if (n == 0) {
+				break;
+			}
+			st->bytes += n;
+			st->calls++;
+			st->end = now();
+		}
+	} else {
+		while (forward(in, out, buf, bufsiz, 0, st) > 0) {
+			;
+		}
+		st->end = now();
+	}
+}
+
+/* One stage of the latency test: pass on one message of
+ * CHUNK1 bytes at a time and note when it got here; the
+ * reader acks every message to the writer via 'ack'. */
+void
+chainPing(struct chain *c, int s, int ack[2]) {
+	struct stage st;
+	int in = s > 0 ? c->fds[s - 1][0] : -1;
+	int out = s < c->hops ? c->fds[s][1] : -1;
+	long long *arrivals = c->arrivals;
+	char *buf, a = 0;
+	int i;
+
+	chainClose(c, in, out);
+	if (in < 0) {
+		(void)close(ack[1]);
+	} else if (out < 0) {
+		(void)close(ack[0]);
+	} else {
+		(void)close(ack[0]);
+		(void)close(ack[1]);
+	}
+	buf = getArena(CHUNK1);
+	memset(&st, 0, sizeof(st));
+	if ((in < 0) || (out < 0)) {
+		SPLICE = 0;
+	}
+	if (in >= 0) {
+		setBlocking(in);
+	}
+	if (out >= 0) {
+		setBlocking(out);
+	}
+
+	for (i = 0; i < ITERATIONS; i++) {
+		if (in < 0) {
+			arrivals[i] = nsecs();
+			writeFull(out, buf, CHUNK1);
+			if (read(ack[0], &a, 1) != 1) {
+				errx(EXIT_FAILURE, "Missing ack for message %d.", i);
+				/* NOTREACHED */
+			}
+			arrivals[(c->hops + 1) * ITERATIONS + i] = nsecs();
+		} else if (out < 0) {
+			if (readMsg(in, buf, CHUNK1) != CHUNK1) {
+				errx(EXIT_FAILURE, "Short or missing message %d.", i);
+				/* NOTREACHED */
+			}
+			arrivals[s * ITERATIONS + i] = nsecs();
+			if (write(ack[1], &a, 1) != 1) {
+				err(EXIT_FAILURE, "write");
+				/* NOTREACHED */
+			}
+		} else {
+			struct pollfd pfd = { in, POLLIN, 0 };
+
+			/* Arrival is when we could first read it. */
+			(void)doPoll(&pfd, -1);
+			arrivals[s * ITERATIONS + i] = nsecs();
+			if (forward(in, out, buf, CHUNK1, CHUNK1, &st) != CHUNK1) {
+				errx(EXIT_FAILURE, "Short or missing message %d.", i);
+				/* NOTREACHED */
+			}
+		}
+	}
+}
+
+/* Fork a process per stage, running either the
+ * throughput or the latency test; while they run, look
+ * at how full each hop is every millisecond, so we can
+ * see where the backpressure builds up. */
+void
+chainRun(struct chain *c, int ping, double *avg, int *max, int *caps) {
+	pid_t *pids;
+	int ack[2] = { -1, -1 };
+	long long samples = 0, *sums;
+	int h, s, alive;
+
+	if (((pids = calloc(c->hops + 1, sizeof(*pids))) == NULL) ||
+	    ((sums = calloc(c->hops, sizeof(*sums))) == NULL)) {
+		err(EXIT_FAILURE, "calloc");
+		/* NOTREACHED */
+	}
+	chainOpen(c);
+	for (h = 0; h < c->hops; h++) {
+		socklen_t len = sizeof(caps[h]);
+
+		max[h] = 0;
+		caps[h] = -1;
+		if (IPC_TYPE == IPC_SOCKETPAIR) {
+			(void)getsockopt(c->fds[h][1], SOL_SOCKET, SO_SNDBUF, &caps[h], &len);
+#ifdef F_GETPIPE_SZ
+		} else {
+			caps[h] = fcntl(c->fds[h][1], F_GETPIPE_SZ);
+#endif
+		}
+	}
+	if (ping && (pipe(ack) < 0)) {
+		err(EXIT_FAILURE, "pipe");
+		/* NOTREACHED */
+	}
+
+	if (fflush(stdout) == EOF) {
+		err(EXIT_FAILURE, "fflush");
+		/* NOTREACHED */
+	}
+	(void)signal(SIGPIPE, SIG_IGN);
+	for (s = 0; s <= c->hops; s++) {
+		if ((pids[s] = fork()) < 0) {
+			err(EXIT_FAILURE, "fork");
+			/* NOTREACHED */
+		}
+		if (pids[s] == 0) {
+			if (ping) {
+				chainPing(c, s, ack);
+			} else {
+				chainStage(c, s);
+			}
+			_exit(EXIT_SUCCESS);
+			/* NOTREACHED */
+		}
+	}
+	for (h = 0; h < c->hops; h++) {
+		(void)close(c->fds[h][1]);
+	}
+	if (ping) {
+		(void)close(ack[0]);
+		(void)close(ack[1]);
+	}
+
+	alive = c->hops + 1;
+	while (alive > 0) {
+		struct timespec ts = { 0, 1000000 };
+		int status;
+		pid_t pid;
+
+		for (h = 0; h < c->hops; h++) {
+			int q;
+
+			if (ioctl(c->fds[h][0], FIONREAD, &q) < 0) {
+				continue;
+			}
+			sums[h] += q;
+			if (q > max[h]) {
+				max[h] = q;
+			}
+		}
+		samples++;
+		(void)nanosleep(&ts, NULL);
+
+		while ((alive > 0) && ((pid = waitpid(-1, &status, WNOHANG)) > 0)) {
+			alive--;
+			if (!WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+				errx(EXIT_FAILURE, "A stage of the chain failed.");
+				/* NOTREACHED */
+			}
+		}
+		if ((alive > 0) && (pid < 0) && (errno != EINTR)) {
+			err(EXIT_FAILURE, "waitpid");
+			/* NOTREACHED */
+		}
+	}
+	for (h = 0; h < c->hops; h++) {
+		(void)close(c->fds[h][0]);
+		avg[h] = samples > 0 ? (double)sums[h] / samples : 0;
+	}
+	free(sums);
+	free(pids);
+}
+
+void
+chain() {
+	struct chain c;
+	struct hist rtt;
+	double *avg, fullest = -1;
+	int *max, *caps, h, s, worst = 0;
+	size_t len;
+
+	c.hops = HOPS;
+	len = (c.hops + 1) * sizeof(*c.stages) +
+		(size_t)(c.hops + 2) * ITERATIONS * sizeof(*c.arrivals);
+	if ((c.stages = mmap(NULL, len, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_ANON, -1, 0)) == MAP_FAILED) {
+		err(EXIT_FAILURE, "mmap");
+		/* NOTREACHED */
+	}
+	c.arrivals = (long long *)(c.stages + c.hops + 1);
+	if (((c.fds = calloc(c.hops, sizeof(*c.fds))) == NULL) ||
+	    ((avg = calloc(c.hops, sizeof(*avg))) == NULL) ||
+	    ((max = calloc(c.hops, sizeof(*max))) == NULL) ||
+	    ((caps = calloc(c.hops, sizeof(*caps))) == NULL)) {
+		err(EXIT_FAILURE, "calloc");
+		/* NOTREACHED */
+	}
+
+	chainRun(&c, 0, avg, max, caps);
+
+	for (h = 0; h < c.hops; h++) {
+		double fill = caps[h] > 0 ? avg[h] / caps[h] : 0;
+		if (fill > fullest) {
+			fullest = fill;
+			worst = h + 1;
+		}
+	}
+
+	RESULT.channels = c.hops;
+	RESULT.fullest = worst;
+	RESULT.w.bytes = c.stages[0].bytes;
+	RESULT.w.ops = c.stages[0].calls;
+	RESULT.w.elapsed = c.stages[0].end - c.stages[0].start;
+	/* End to end: from the writer's first write to the
+	 * reader's last read. */
+	RESULT.r.bytes = c.stages[c.hops].bytes;
+	RESULT.r.ops = c.stages[c.hops].calls;
+	RESULT.r.elapsed = c.stages[c.hops].end - c.stages[0].start;
+
+	if (!QUIET) {
+		(void)printf("%5s %8s %14s %12s %12s\n", "Stage", "Role",
+				"Bytes", "Read (ms)", "Write (ms)");
+		for (s = 0; s <= c.hops; s++) {
+			struct stage *st = &c.stages[s];
+			(void)printf("%5d %8s %14lld %12.1f %12.1f\n", s,
+					s == 0 ? "writer" : s == c.hops ? "reader" : "forward",
+					st->bytes, st->read_ns / 1e6, st->write_ns / 1e6);
+		}
+		(void)printf("\n%5s %8s %14s %12s %12s\n", "Hop", "Size",
+				"Queued (avg)", "(max)", "Fill (avg)");
+		for (h = 0; h < c.hops; h++) {
+			(void)printf("%5d %8d %14.0f %12d %11.1f%%\n", h + 1, caps[h],
+					avg[h], max[h],
+					caps[h] > 0 ? 100 * avg[h] / caps[h] : 0);
+		}
+		(void)printf("\n");
+		(void)printf("%-15s: %8.2f\n", "End-to-end MB/s", RESULT.r.elapsed > 0 ?
+				(double)RESULT.r.bytes / RESULT.r.elapsed / 1000000 : 0);
+		(void)printf("%-15s: %8d\n", "Fullest hop", worst);
+	} else if (FORMAT == FMT_TEXT) {
+		(void)printf("%.2f\n", RESULT.r.elapsed > 0 ?
+				(double)RESULT.r.bytes / RESULT.r.elapsed / 1000000 : 0);
+	}
+
+	chainRun(&c, 1, avg, max, caps);
+
+	if (!QUIET) {
+		(void)printf("\n%5s %12s %12s %12s\n", "Hop", "p50 (ns)", "p99 (ns)", "max (ns)");
+	}
+	for (h = 1; h <= c.hops; h++) {
+		struct hist hop;
+		int i;
+
+		histInit(&hop, ITERATIONS);
+		for (i = 0; i < ITERATIONS; i++) {
+			histAdd(&hop, c.arrivals[h * ITERATIONS + i] -
+					c.arrivals[(h - 1) * ITERATIONS + i]);
+		}
+		qsort(hop.samples, hop.n, sizeof(*hop.samples), cmpLongLong);
+		if (!QUIET) {
+			(void)printf("%5d %12lld %12lld %12lld\n", h, histPercentile(&hop, 50),
+					histPercentile(&hop, 99), hop.samples[hop.n - 1]);
+		}
+		free(hop.samples);
+	}
+	histInit(&rtt, ITERATIONS);
+	for (s = 0; s < ITERATIONS; s++) {
+		histAdd(&rtt, c.arrivals[(c.hops + 1) * ITERATIONS + s] - c.arrivals[s]);
+	}
+	reportHist("RTT", &rtt);
+
+	(void)munmap(c.stages, len);
+	free(caps);
+	free(max);
+	free(avg);
+	free(c.fds);
+}
+
+void
+doChain() {
+	const char *what = "pipes";
+
+	if (IPC_TYPE == IPC_FIFO) {
+		what = "fifos";
+	} else if (IPC_TYPE == IPC_SOCKETPAIR) {
+		what = "stream socketpairs";
+	}
+	reportTest("a chain of %d %s", HOPS, what);
+	chain();
+	if (VMSPLICE) {
+		if (!QUIET) {
+			(void)printf("\nUsing splice(2) to forward:\n");
+		}
+		SPLICE = 1;
+		chain();
+		SPLICE = 0;
+	}
+}
+
+/* In backpressure mode, a blocking write that takes
+ * this long means that the buffer was full. */
+#define BLOCKED_NS 1000000LL
+
+struct backpressure {
+	int done;
+	int nsamples;
+	struct stage reader;
+	int samples[];		/* queued, once per ms */
+};
+
+void
+sleepUntil(long long t) {
+	long long left = t - nsecs();
+
+	if (left > 0) {
+		struct timespec ts = { left / 1000000000LL, left % 1000000000LL };
+		(void)nanosleep(&ts, NULL);
+	}
+}
+
+/* When to be done with 'bytes', at 'rate' bytes per
+ * second since 'start'. */
+long long
+dueAt(long long start, long long bytes, int rate) {
+	if (rate <= 0) {
+		return 0;
+	}
+	return start + (long long)((double)bytes * 1000000000LL / rate);
+}
+
+/* How much data is in flight; for TCP, that includes
+ * what the sender hasn't gotten rid of yet.  On Linux,
+ * FIONREAD on a local datagram socket only counts the
+ * next datagram, while the writer's SIOCOUTQ counts all
+ * it sent that wasn't read yet (elsewhere, it's the
+ * other way around), so take the larger of the two. */
+int
+queued(int rfd, int wfd) {
+	int n, w;
+
+	n = printFdQueueSize(rfd, "read");
+	if (isTcp() && ((w = printFdQueueSize(wfd, "write")) > 0)) {
+		n += w;
+	} else if (isDgram() && !isUdp() &&
+			((w = printFdQueueSize(wfd, "write")) > n)) {
+		n = w;
+	}
+	return n < 0 ? 0 : n;
+}
+
+void
+bpSampler(struct backpressure *bp, int max, long long start, int rfd, int wfd) {
+	int i;
+
+	QUIET = 1;
+	for (i = 0; (i < max) && !__atomic_load_n(&bp->done, __ATOMIC_SEQ_CST); i++) {
+		sleepUntil(start + i * 1000000LL);
+		bp->samples[i] = queued(rfd, wfd);
+		__atomic_store_n(&bp->nsamples, i + 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+void
+bpReader(struct backpressure *bp, long long start, int fd) {
+	struct stage *st = &bp->reader;
+	long long base = start, based = 0, stall = start + STALL_EVERY * 1000000LL;
+	char *buf = getArena(CHUNK1);
+
+	setBlocking(fd);
+	st->start = now();
+	while (1) {
+		long long t = nsecs();
+		ssize_t n;
+
+		if (STALL_MS && (t >= stall)) {
+			sleepUntil(t + STALL_MS * 1000000LL);
+			/* A stalled consumer doesn't catch up. */
+			base = nsecs();
+			based = st->bytes;
+			stall += STALL_EVERY * 1000000LL;
+		}
+		sleepUntil(dueAt(base, st->bytes - based, READ_RATE));
+
+		t = nsecs();
+		if ((n = read(fd, buf, CHUNK1)) < 0) {
+			if (errno == ECONNRESET) {
+				break;
+			}
+			err(EXIT_FAILURE, "read");
+			/* NOTREACHED */
+		}
+		st->read_ns += nsecs() - t;
+		if (n == 0) {
 			break;
-		case 'h':
-			usage();
+		}
+		st->bytes += n;
+		st->calls++;
+	}
+	st->end = now();
+}
+
+/* Against a slow or stalling reader, what matters is
+ * not the size of the buffer, but how many milliseconds
+ * of it the buffer absorbs before the writer blocks.
+ * The reader and a process sampling the queue once a
+ * millisecond get forked; we write. */
+void
+backpressure() {
+	struct backpressure *bp;
+	struct hist stalls;
+	struct xferStats w, r;
+	pid_t pids[2];
+	long long start, end, blocked = 0, full = -1;
+	int fd[2], i, max, peak = 0, p;
+	size_t len;
+	char *buf;
+
+	/* A sample per ms, with a second to spare. */
+	max = (DURATION + 1) * 1000;
+	if (BYTE_LIMIT > 0) {
+		max = 60 * 1000;
+	}
+	len = sizeof(*bp) + max * sizeof(*bp->samples);
+	if ((bp = mmap(NULL, len, PROT_READ|PROT_WRITE,
+			MAP_SHARED|MAP_ANON, -1, 0)) == MAP_FAILED) {
+		err(EXIT_FAILURE, "mmap");
+		/* NOTREACHED */
+	}
+
+	openChannel(fd);
+	memset(&w, 0, sizeof(w));
+	memset(&r, 0, sizeof(r));
+	histInit(&stalls, 1024);
+	buf = getArena(CHUNK1);
+
+	if (fflush(stdout) == EOF) {
+		err(EXIT_FAILURE, "fflush");
+		/* NOTREACHED */
+	}
+	(void)signal(SIGPIPE, SIG_IGN);
+	start = nsecs() + 10000000LL;
+	for (p = 0; p < 2; p++) {
+		if ((pids[p] = fork()) < 0) {
+			err(EXIT_FAILURE, "fork");
+			/* NOTREACHED */
+		}
+		if (pids[p] > 0) {
+			continue;
+		}
+		if (p == 0) {
+			if (fd[1] != fd[0]) {
+				(void)close(fd[1]);
+			}
+			bpReader(bp, start, fd[0]);
+		} else {
+			/* Only TCP and local datagrams need the
+			 * writer's end (see queued()); a TCP writer
+			 * shuts that down explicitly. */
+			if (!isTcp() && !(isDgram() && !isUdp()) &&
+			    (fd[1] != fd[0])) {
+				(void)close(fd[1]);
+			}
+			bpSampler(bp, max, start, fd[0], fd[1]);
+		}
+		_exit(EXIT_SUCCESS);
+		/* NOTREACHED */
+	}
+	if (fd[0] != fd[1]) {
+		(void)close(fd[0]);
+	}
+	setBlocking(fd[1]);
+
+	/* Blocking writes, at our own pace, for as long as
+	 * we're asked to; a write that takes a while means
+	 * that the buffer was full. */
+	sleepUntil(start);
+	end = start + DURATION * 1000000000LL;
+	while (((BYTE_LIMIT < 0) && (nsecs() < end)) ||
+	    ((BYTE_LIMIT > 0) && (w.bytes < BYTE_LIMIT))) {
+		long long t, ns;
+
+		sleepUntil(dueAt(start, w.bytes, WRITE_RATE));
+		t = nsecs();
+		writeFull(fd[1], buf, CHUNK1);
+		ns = nsecs() - t;
+		if (ns >= BLOCKED_NS) {
+			if (full < 0) {
+				full = t - start;
+			}
+			histAdd(&stalls, ns);
+			blocked += ns;
+		}
+		w.bytes += CHUNK1;
+		w.ops++;
+	}
+	w.elapsed = (double)(nsecs() - start) / 1e9;
+	__atomic_store_n(&bp->done, 1, __ATOMIC_SEQ_CST);
+	if (isTcp()) {
+		(void)shutdown(fd[1], SHUT_WR);
+	}
+	endStream(fd[1]);
+	/* We closed our copy of fd[0] after the forks, and
+	 * there are no rings or message queues here. */
+	(void)close(fd[1]);
+
+	for (p = 0; p < 2; p++) {
+		int status;
+
+		if (waitpid(pids[p], &status, 0) < 0) {
+			err(EXIT_FAILURE, "waitpid");
+			/* NOTREACHED */
+		}
+		if (!WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+			errx(EXIT_FAILURE, "The %s failed.", p ? "sampler" : "reader");
+			/* NOTREACHED */
+		}
+	}
+
+	for (i = 0; i < bp->nsamples; i++) {
+		if (bp->samples[i] > peak) {
+			peak = bp->samples[i];
+		}
+	}
+	qsort(stalls.samples, stalls.n, sizeof(*stalls.samples), cmpLongLong);
+
+	r.bytes = bp->reader.bytes;
+	r.ops = bp->reader.calls;
+	r.elapsed = bp->reader.end - bp->reader.start;
+	RESULT.w = w;
+	RESULT.r = r;
+	RESULT.full_ns = full;
+	RESULT.stalls = (int)stalls.n;
+	RESULT.stall[0] = histPercentile(&stalls, 50);
+	RESULT.stall[1] = histPercentile(&stalls, 99);
+	RESULT.stall[2] = stalls.n ? stalls.samples[stalls.n - 1] : 0;
+	RESULT.peak = peak;
+
+	if (QUIET) {
+		if (FORMAT == FMT_TEXT) {
+			(void)printf("%.3f %.3f\n", full / 1e6, RESULT.stall[2] / 1e6);
+		}
+	} else {
+		int step = (bp->nsamples + 19) / 20;
+
+		reportXfer("Write", &w);
+		(void)printf("\n");
+		reportXfer("Read", &r);
+		(void)printf("\n");
+		if (full < 0) {
+			(void)printf("%-15s: %8s\n", "Time to full", "never");
+		} else {
+			(void)printf("%-15s: %8.3f ms\n", "Time to full", full / 1e6);
+		}
+		(void)printf("%-15s: %8zu\n", "Writer stalls", stalls.n);
+		if (stalls.n > 0) {
+			(void)printf("%-15s: %8.3f ms\n", "Blocked", blocked / 1e6);
+			(void)printf("%-15s: %8.3f ms\n", "Stall p50", RESULT.stall[0] / 1e6);
+			(void)printf("%-15s: %8.3f ms\n", "Stall p99", RESULT.stall[1] / 1e6);
+			(void)printf("%-15s: %8.3f ms\n", "Stall max", RESULT.stall[2] / 1e6);
+		}
+		(void)printf("%-15s: %8d\n", "Peak queued", peak);
+		if (WRITE_RATE > 0) {
+			/* How long the writer can go on with a
+			 * reader that has stopped altogether. */
+			(void)printf("%-15s: %8.3f ms\n", "Absorbs",
+					(double)peak * 1000 / WRITE_RATE);
+		}
+
+		/* The most queued in every 1/20th of the run. */
+		(void)printf("\n");
+		for (i = 0; (step > 0) && (i < bp->nsamples); i += step) {
+			char label[BUFSIZ];
+			int j, most = 0;
+
+			for (j = i; (j < i + step) && (j < bp->nsamples); j++) {
+				if (bp->samples[j] > most) {
+					most = bp->samples[j];
+				}
+			}
+			(void)snprintf(label, sizeof(label), "%d ms", i);
+			printXferLine("Queued", label, "%8d", most);
+		}
+	}
+
+	free(stalls.samples);
+	(void)munmap(bp, len);
+}
+
+void
+doBackpressure() {
+	switch(IPC_TYPE) {
+	case IPC_FIFO:
+		reportTest("fifo");
+		break;
+	case IPC_PIPE:
+		reportTest("pipe");
+		break;
+	case IPC_SOCKET:
+		reportTest("%s %s socket", SET_SOCKDOMAIN, SET_SOCKTYPE);
+		break;
+	case IPC_SOCKETPAIR:
+		reportTest("socketpair %s", SET_SOCKTYPE);
+		break;
+	}
+	backpressure();
+}
+
+void
+doSocket() {
+	int rfd, wfd;
+	int pid = 0;
+	int ready[2] = { -1, -1 };
+	struct peer peer;
+	char *sysctl = "invalid";
+
+	reportTest("%s %s socket", SET_SOCKDOMAIN, SET_SOCKTYPE);
+
+	socklen_t s_size;
+	struct sockaddr_storage s;
+
+	if ((wfd = socket(SOCK_DOMAIN, SOCK_TYPE, 0)) < 0) {
+		err(EXIT_FAILURE, "socket");
+		/* NOTREACHED */
+	}
+	rfd = wfd;
+
+	s_size = setSockAddr(&s, "socket", PORT);
+
+	if (SOCK_DOMAIN == PF_LOCAL) {
+		if (SOCK_TYPE == SOCK_DGRAM) {
+/* Not the same values, but of interest either way. */
+#ifdef __linux
+			sysctl = "net.unix.max_dgram_qlen";
+#else
+			sysctl = "net.local.dgram.recvspace";
+		} else {
+			sysctl = "net.local.stream.recvspace";
+#endif
+		}
+	} else if (SOCK_DOMAIN == PF_INET) {
+#ifndef __linux
+		if (SOCK_TYPE == SOCK_DGRAM) {
+			sysctl = "net.inet.udp.recvspace";
+#  ifndef __OpenBSD__
+		} else {
+			sysctl = "net.inet.tcp.recvspace";
+#  endif
+		}
+#endif
+	} else if (SOCK_DOMAIN == PF_INET6) {
+#ifdef __NetBSD__
+		if (SOCK_TYPE == SOCK_DGRAM) {
+			sysctl = "net.inet6.udp6.recvspace";
+		} else {
+			sysctl = "net.inet6.tcp6.recvspace";
+		}
+#elif defined(__OpenBSD__)
+		/* Per https://man.openbsd.org/sysctl.2, OpenBSD reuses
+		 * net.inet.tcp and net.inet.udp for TCP/UDP over IPv6. */
+		if (SOCK_TYPE == SOCK_DGRAM) {
+			sysctl = "net.inet.udp.recvspace";
+		}
+#endif
+	}
+
+	if (bind(wfd, (struct sockaddr *)&s, s_size)) {
+		err(EXIT_FAILURE, "bind");
+		/* NOTREACHED */
+	}
+
+	reportSysctl(sysctl);
+
+	if ((SOCK_TYPE == SOCK_STREAM) && (MODE == THROUGHPUT) && isScaling()) {
+		/* More than one writer and reader; see scaling(). */
+		int fd[2];
+
+		(void)close(wfd);
+		openChannel(fd);
+		runTests(fd[0], fd[1]);
+		return;
+	}
+
+	if (SOCK_TYPE == SOCK_STREAM) {
+		/* Listen before the writer connects, and have it
+		 * wait until the reader is set up; see
+		 * awaitReady(). */
+		if (listen(wfd, 1) < 0) {
+			err(EXIT_FAILURE, "listen");
+			/* NOTREACHED */
+		}
+		if (pipe(ready) < 0) {
+			err(EXIT_FAILURE, "pipe");
+			/* NOTREACHED */
+		}
+		if (THREADED) {
+			startPeer(&peer, wfd, -1, -1, ready[1]);
+		} else {
+			if (fflush(stdout) == EOF) {
+				err(EXIT_FAILURE, "fflush");
+				/* NOTREACHED */
+			}
+			if ((pid = fork()) < 0) {
+				err(EXIT_FAILURE, "fork");
+				/* NOTREACHED */
+			}
+		}
+		if (pid) {
+			(void)close(ready[0]);
+			if ((rfd = accept(wfd, NULL, NULL)) < 0) {
+				err(EXIT_FAILURE, "accept");
+				/* NOTREACHED */
+			}
+			setBufferSizes(rfd, -1);
+			signalReady(ready[1]);
+			if (MODE == THROUGHPUT) {
+				struct xferStats r;
+				drainSustained(rfd, &r);
+				if (waitpid(pid, NULL, 0) < 0) {
+					err(EXIT_FAILURE, "waitpid");
+					/* NOTREACHED */
+				}
+				if (!QUIET) {
+					(void)printf("\n");
+				}
+				reportXfer("Read", &r);
+				runComparisons();
+				exit(EXIT_SUCCESS);
+				/* NOTREACHED */
+			}
+			if (MODE == LATENCY) {
+				echoLoop(rfd, rfd);
+				if (waitpid(pid, NULL, 0) < 0) {
+					err(EXIT_FAILURE, "waitpid");
+					/* NOTREACHED */
+				}
+				exit(EXIT_SUCCESS);
+				/* NOTREACHED */
+			}
+			if (waitpid(pid, NULL, 0) < 0) {
+				err(EXIT_FAILURE, "waitpid");
+				/* NOTREACHED */
+			}
+			readData(rfd);
+			runComparisons();
 			exit(EXIT_SUCCESS);
 			/* NOTREACHED */
-			break;
-		case 'l':
-			MODE = LOOP;
-			break;
-		case 'n':
-			NUM_CHUNKS = inputNumber(optarg, 0, "-n");
-			break;
-		case 'q':
-			QUIET = 1;
-			break;
-		case 's':
-			SET_SOCKTYPE = optarg;
-			sflag = 1;
-			break;
-		case 't':
-			type = optarg;
-			break;
-		case '?':
-		default:
-			usage();
-			exit(EXIT_FAILURE);
+		} else {
+			if (!THREADED) {
+				(void)close(ready[1]);
+			}
+			if ((wfd = socket(SOCK_DOMAIN, SOCK_TYPE, 0)) < 0) {
+				err(EXIT_FAILURE, "socket");
+				/* NOTREACHED */
+			}
+		}
+	}
+
+	if (connect(wfd, (struct sockaddr *)&s, s_size) < 0) {
+		err(EXIT_FAILURE, "connect");
+		/* NOTREACHED */
+	}
+	if (SOCK_TYPE == SOCK_STREAM) {
+		awaitReady(ready[0]);
+		if (THREADED) {
+			rfd = peer.rfd;
+		}
+	}
+
+	/* The peer thread set up its end before it started
+	 * reading; don't touch it while it does. */
+	setBufferSizes((THREADED && (SOCK_TYPE == SOCK_STREAM)) ? -1 : rfd, wfd);
+	printSockOpt(wfd, SO_SNDBUF);
+	printSockOpt(wfd, SO_SNDLOWAT);
+	printSockOpt(rfd, SO_RCVBUF);
+	printSockOpt(rfd, SO_RCVLOWAT);
+	if (isTcp() && !QUIET) {
+		(void)printf("%-15s: %s\n", "TCP options", tcpOptsName());
+	}
+
+	if (SOCK_TYPE == SOCK_DGRAM) {
+		if (MODE == LATENCY) {
+			int efd = echoSocket(wfd);
+			latency(wfd, efd, efd, wfd);
+			(void)unlink("socket2");
+		} else {
+			runTests(rfd, wfd);
+		}
+		(void)unlink("socket");
+	} else if (MODE == LATENCY) {
+		struct hist h;
+		pingLoop(wfd, wfd, &h);
+		endStream(wfd);
+		if (THREADED) {
+			joinPeer(&peer);
+		}
+		reportHist("RTT", &h);
+		reportZerocopy();
+	} else if (MODE == THROUGHPUT) {
+		struct xferStats w;
+		writeSustained(wfd, &w);
+		endStream(wfd);
+		reportXfer("Write", &w);
+		reportZerocopy();
+		reportSeries();
+		if (THREADED) {
+			joinPeer(&peer);
+			if (!QUIET) {
+				(void)printf("\n");
+			}
+			reportXfer("Read", &peer.x);
+			runComparisons();
+		}
+	} else {
+		writeData(wfd, THREADED ? rfd : -1);
+		if (THREADED) {
+			/* As if the writer had exited. */
+			endStream(wfd);
+			joinPeer(&peer);
+			readData(rfd);
+			runComparisons();
+		}
+	}
+}
+
+/* With '-D' and '-H', the writer and the reader live on
+ * different hosts, talking over a TCP control connection
+ * in lines of text: the client asks for a test, the
+ * daemon opens a data socket on a fresh port and tells
+ * the client where it is and how large its receive
+ * buffer came out, the client connects (or, for UDP,
+ * says hello so that the daemon can connect back), and
+ * at the end the daemon reports what it read. */
+#define REMOTE_VERSION 1
+
+/* How long either side waits for the other at any one
+ * step, in seconds, and the largest chunk a client may
+ * ask the daemon to read. */
+#define REMOTE_TIMEOUT 10
+#define REMOTE_MAX_CHUNK (64 * 1024 * 1024)
+
+void
+setPort(struct sockaddr_storage *ss, uint16_t port) {
+	if (ss->ss_family == PF_INET6) {
+		((struct sockaddr_in6 *)ss)->sin6_port = htons(port);
+	} else {
+		((struct sockaddr_in *)ss)->sin_port = htons(port);
+	}
+}
+
+uint16_t
+portOf(struct sockaddr_storage *ss) {
+	if (ss->ss_family == PF_INET6) {
+		return ntohs(((struct sockaddr_in6 *)ss)->sin6_port);
+	}
+	return ntohs(((struct sockaddr_in *)ss)->sin_port);
+}
+
+const char *
+addrName(struct sockaddr_storage *ss) {
+	static char host[NI_MAXHOST];
+
+	if (getnameinfo((struct sockaddr *)ss, sizeof(*ss), host, sizeof(host),
+			NULL, 0, NI_NUMERICHOST) != 0) {
+		return "unknown";
+	}
+	return host;
+}
+
+/* Resolve "host[:port]" ("[host]:port" for IPv6
+ * addresses) into 'ss'; an empty host means any
+ * address, a missing port PORT. */
+socklen_t
+resolveHost(const char *spec, int passive, struct sockaddr_storage *ss) {
+	struct addrinfo hints, *res;
+	char buf[BUFSIZ], service[16];
+	char *host = buf, *port = NULL, *p;
+	socklen_t len;
+	int n;
+
+	(void)strncpy(buf, spec, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+	if (*host == '[') {
+		host++;
+		if ((p = strchr(host, ']')) == NULL) {
+			errx(EXIT_FAILURE, "Missing ']' in '%s'.", spec);
+			/* NOTREACHED */
+		}
+		*p++ = '\0';
+		if (*p == ':') {
+			port = p + 1;
+		} else if (*p != '\0') {
+			errx(EXIT_FAILURE, "Unexpected '%s' after ']' in '%s'.", p, spec);
 			/* NOTREACHED */
 		}
+	} else if (((p = strrchr(host, ':')) != NULL) && (strchr(host, ':') == p)) {
+		/* More than one colon is an IPv6 address. */
+		*p = '\0';
+		port = p + 1;
 	}
-	argc -= optind;
-	argv += optind;
 
-	if (argc > 2) {
-		usage();
-		exit(EXIT_FAILURE);
+	n = port ? inputNumber(port, 1, "-H") : PORT;
+	if (n > 65535) {
+		errx(EXIT_FAILURE, "Invalid port '%s'.", port);
 		/* NOTREACHED */
 	}
+	(void)snprintf(service, sizeof(service), "%d", n);
 
-	if (type) {
-		if (strcasecmp(type, "fifo") == 0) {
-			IPC_TYPE = IPC_FIFO;
-		} else if (strcasecmp(type, "pipe") == 0) {
-			IPC_TYPE = IPC_PIPE;
-		} else if (strcasecmp(type, "socket") == 0) {
-			IPC_TYPE = IPC_SOCKET;
-		} else if (strcasecmp(type, "socketpair") == 0) {
-			IPC_TYPE = IPC_SOCKETPAIR;
-		} else {
-			errx(EXIT_FAILURE, "Unknown IPC type '%s'.\n"
-					   "Supported types are: fifo, pipe, socket, socketpair.", type);
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = SOCK_DOMAIN;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = passive ? AI_PASSIVE : 0;
+	if ((n = getaddrinfo(*host ? host : NULL, service, &hints, &res)) != 0) {
+		errx(EXIT_FAILURE, "Unable to resolve '%s': %s", spec, gai_strerror(n));
+		/* NOTREACHED */
+	}
+	memset(ss, 0, sizeof(*ss));
+	memcpy(ss, res->ai_addr, res->ai_addrlen);
+	len = res->ai_addrlen;
+	freeaddrinfo(res);
+	return len;
+}
+
+void
+ctlSend(int fd, const char *fmt, ...) {
+	char buf[BUFSIZ];
+	va_list args;
+	int len;
+
+	va_start(args, fmt);
+	len = vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	if (write(fd, buf, len) != len) {
+		err(EXIT_FAILURE, "write");
+		/* NOTREACHED */
+	}
+}
+
+/* Read one line from the control connection, without
+ * the newline, waiting no longer than 'secs' seconds
+ * for each byte; the other side sends "error ..." if it
+ * can't go on. */
+void
+ctlRecv(int fd, char *buf, size_t size, int secs) {
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	size_t i = 0;
+	ssize_t n;
+	char c;
+
+	while (1) {
+		if ((n = poll(&pfd, 1, secs * 1000)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			err(EXIT_FAILURE, "poll");
+			/* NOTREACHED */
+		}
+		if (n == 0) {
+			errx(EXIT_FAILURE, "Timed out waiting for the other side.");
+			/* NOTREACHED */
+		}
+		if ((n = read(fd, &c, 1)) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			err(EXIT_FAILURE, "read");
+			/* NOTREACHED */
+		}
+		if (n == 0) {
+			errx(EXIT_FAILURE, "The other side closed the control connection.");
 			/* NOTREACHED */
 		}
+		if (c == '\n') {
+			break;
+		}
+		if (i < size - 1) {
+			buf[i++] = c;
+		}
 	}
+	buf[i] = '\0';
 
-	if ((IPC_TYPE != IPC_PIPE) && (SET_PIPEBUF != -1)) {
-		(void)fprintf(stderr, "Setting the pipe size only makes sense with '-t pipe'.\n");
-		exit(EXIT_FAILURE);
+	if (strncmp(buf, "error ", 6) == 0) {
+		errx(EXIT_FAILURE, "%s", buf + 6);
 		/* NOTREACHED */
 	}
+}
 
-	if (sflag && (IPC_TYPE != IPC_SOCKET) && (IPC_TYPE != IPC_SOCKETPAIR)) {
-		(void)fprintf(stderr, "Setting the socket type only makes sense with '-t socket' or '-t socketpair'.\n");
-		exit(EXIT_FAILURE);
+void
+ctlExpect(int fd, const char *what) {
+	char line[BUFSIZ];
+
+	ctlRecv(fd, line, sizeof(line), REMOTE_TIMEOUT);
+	if (strcmp(line, what) != 0) {
+		errx(EXIT_FAILURE, "Expected '%s', but got '%s'.", what, line);
 		/* NOTREACHED */
 	}
+}
 
-	if ((strncmp(SET_SOCKTYPE, "inet", strlen("inet")) == 0) &&
-		(IPC_TYPE != IPC_SOCKET)) {
-		(void)fprintf(stderr, "'inet/inet6' type sockets can only be specified with '-t socket'.\n");
+/* The numbers of a request come off the network; check
+ * them the way inputNumber() checks ours, and tell the
+ * client if they're out of range. */
+void
+checkRequest(int cfd, const char *what, int n, int min, int max) {
+	if ((n < min) || (n > max)) {
+		ctlSend(cfd, "error Invalid %s '%d'; the daemon takes %d to %d.\n",
+				what, n, min, max);
 		exit(EXIT_FAILURE);
 		/* NOTREACHED */
 	}
+}
 
-	if (strncmp(SET_SOCKTYPE, "inet-", strlen("inet-")) == 0) {
-		SET_SOCKDOMAIN = "PF_INET";
-		SOCK_DOMAIN = PF_INET;
-		SET_SOCKTYPE += strlen("inet-");
-	} else if (strncmp(SET_SOCKTYPE, "inet6-", strlen("inet6-")) == 0) {
-		SET_SOCKDOMAIN = "PF_INET6";
-		SOCK_DOMAIN = PF_INET6;
-		SET_SOCKTYPE += strlen("inet6-");
+/* Don't let a client that went away keep a send or
+ * receive hanging. */
+void
+setTimeouts(int fd) {
+	struct timeval tv = { REMOTE_TIMEOUT, 0 };
+
+	if ((setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) ||
+	    (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) < 0)) {
+		err(EXIT_FAILURE, "setsockopt SO_RCVTIMEO");
+		/* NOTREACHED */
 	}
+}
 
-	if (strcasecmp(SET_SOCKTYPE, "stream") == 0) {
+/* The daemon's end of a single test on control
+ * connection 'cfd'. */
+void
+serve(int cfd) {
+	struct sockaddr_storage s, peer;
+	socklen_t len = sizeof(s), plen = sizeof(peer);
+	struct xferStats r;
+	char line[BUFSIZ], mode[16], type[16];
+	int version, rcvbuf, rcvlowat, opts, secs, dfd, rfd, n;
+	int queued = -1;
+	socklen_t size = sizeof(n);
+
+	ctlRecv(cfd, line, sizeof(line), REMOTE_TIMEOUT);
+	if ((sscanf(line, "ipcbuf %d %15s %15s %d %d %d %d %d", &version, mode, type,
+			&CHUNK1, &rcvbuf, &rcvlowat, &opts, &secs) != 8) ||
+	    (version != REMOTE_VERSION)) {
+		ctlSend(cfd, "error Unsupported request '%s'; the daemon speaks version %d.\n",
+				line, REMOTE_VERSION);
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+
+	if (strcmp(mode, "throughput") == 0) {
+		MODE = THROUGHPUT;
+	} else if (strcmp(mode, "latency") == 0) {
+		MODE = LATENCY;
+	} else if (strcmp(mode, "loop") == 0) {
+		MODE = LOOP;
+	} else if (strcmp(mode, "chunk") == 0) {
+		MODE = CHUNK;
+	} else {
+		ctlSend(cfd, "error The daemon doesn't serve %s mode.\n", mode);
+		exit(EXIT_FAILURE);
+		/* NOTREACHED */
+	}
+	if (strcmp(type, "stream") == 0) {
 		SOCK_TYPE = SOCK_STREAM;
-	} else if ((strcasecmp(SET_SOCKTYPE, "dgram") != 0)) {
-		(void)fprintf(stderr, "Invalid socket type. Please use one of [inet[6]-(dgram|stream).\n");
+	} else if (strcmp(type, "dgram") == 0) {
+		SOCK_TYPE = SOCK_DGRAM;
+	} else {
+		ctlSend(cfd, "error Unknown socket type '%s'.\n", type);
 		exit(EXIT_FAILURE);
 		/* NOTREACHED */
 	}
+	checkRequest(cfd, "chunk size", CHUNK1, 1, REMOTE_MAX_CHUNK);
+	if (rcvbuf != -1) {
+		checkRequest(cfd, "SO_RCVBUF", rcvbuf, 1, INT_MAX);
+	}
+	if (rcvlowat != -1) {
+		checkRequest(cfd, "SO_RCVLOWAT", rcvlowat, 1, INT_MAX);
+	}
+	/* See daemonLoop(). */
+	checkRequest(cfd, "duration", secs, 0, DURATION);
+	/* The client's '-R' and '-L' win over ours. */
+	if (rcvbuf >= 0) {
+		SET_RCVBUF = rcvbuf;
+	}
+	if (rcvlowat >= 0) {
+		SET_RCVLOWAT = rcvlowat;
+	}
+	/* Only TCP_NODELAY matters for the echoes. */
+	TCP_OPTS = opts & OPT_NODELAY;
 
-	if (argc > 0) {
-		CHUNK1 = inputNumber(argv[0], 0, "initial chunk size");
+	/* Same address as the control connection, any
+	 * port. */
+	if (getsockname(cfd, (struct sockaddr *)&s, &len) < 0) {
+		err(EXIT_FAILURE, "getsockname");
+		/* NOTREACHED */
+	}
+	SOCK_DOMAIN = s.ss_family;
+	setPort(&s, 0);
+	if ((dfd = socket(SOCK_DOMAIN, SOCK_TYPE, 0)) < 0) {
+		err(EXIT_FAILURE, "socket");
+		/* NOTREACHED */
+	}
+	/* Before listen(2), so that the window scale we
+	 * offer fits the buffer. */
+	setBufferSizes(dfd, -1);
+	if (bind(dfd, (struct sockaddr *)&s, len) < 0) {
+		err(EXIT_FAILURE, "bind");
+		/* NOTREACHED */
+	}
+	if ((SOCK_TYPE == SOCK_STREAM) && (listen(dfd, 1) < 0)) {
+		err(EXIT_FAILURE, "listen");
+		/* NOTREACHED */
+	}
+	if (getsockname(dfd, (struct sockaddr *)&s, &len) < 0) {
+		err(EXIT_FAILURE, "getsockname");
+		/* NOTREACHED */
+	}
+	if ((getsockopt(dfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, &size) < 0) ||
+	    (getsockopt(dfd, SOL_SOCKET, SO_RCVLOWAT, &rcvlowat, &size) < 0)) {
+		err(EXIT_FAILURE, "getsockopt");
+		/* NOTREACHED */
 	}
+	ctlSend(cfd, "port %d %d %d\n", portOf(&s), rcvbuf, rcvlowat);
 
-	if (argc > 1) {
-		CHUNK2 = inputNumber(argv[1], 0, "second argument");
+	if (SOCK_TYPE == SOCK_STREAM) {
+		struct pollfd pfd = { dfd, POLLIN, 0 };
+
+		if (poll(&pfd, 1, REMOTE_TIMEOUT * 1000) < 1) {
+			ctlSend(cfd, "error The client never connected to %s port %d.\n",
+					addrName(&s), portOf(&s));
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if ((rfd = accept(dfd, NULL, NULL)) < 0) {
+			err(EXIT_FAILURE, "accept");
+			/* NOTREACHED */
+		}
+		(void)close(dfd);
+		setBufferSizes(rfd, -1);
+	} else {
+		/* The hello tells us where to send the echoes
+		 * to; see remote(). */
+		struct pollfd pfd = { dfd, POLLIN, 0 };
+		char c;
+
+		if (poll(&pfd, 1, REMOTE_TIMEOUT * 1000) < 1) {
+			ctlSend(cfd, "error No datagram from the client reached %s port %d.\n",
+					addrName(&s), portOf(&s));
+			exit(EXIT_FAILURE);
+			/* NOTREACHED */
+		}
+		if ((recvfrom(dfd, &c, 1, 0, (struct sockaddr *)&peer, &plen) < 0) ||
+		    (connect(dfd, (struct sockaddr *)&peer, plen) < 0)) {
+			err(EXIT_FAILURE, "recvfrom/connect");
+			/* NOTREACHED */
+		}
+		rfd = dfd;
 	}
-}
+	ctlSend(cfd, "ready\n");
 
-void
-writeData(int fd) {
-	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+	plen = sizeof(peer);
+	if (!QUIET && (getpeername(cfd, (struct sockaddr *)&peer, &plen) == 0)) {
+		(void)printf("Serving %s port %d to %s in %s mode.\n",
+				SOCK_TYPE == SOCK_STREAM ? "TCP" : "UDP",
+				portOf(&s), addrName(&peer), modeName());
+	}
+
+	if (MODE == LATENCY) {
+		setTimeouts(rfd);
+		echoLoop(rfd, rfd);
+		ctlSend(cfd, "done\n");
+		return;
+	}
+
+	if (MODE != THROUGHPUT) {
+		/* Leave the data where it is until the client
+		 * is done writing, for as long as we let it. */
+		ctlRecv(cfd, line, sizeof(line), DURATION);
+		if (sscanf(line, "drain %d", &n) == 1) {
+			checkRequest(cfd, "chunk size", n, 1, REMOTE_MAX_CHUNK);
+			if (n > CHUNK1) {
+				CHUNK1 = n;
+			}
+		}
+		if ((SOCK_TYPE == SOCK_STREAM) && (ioctl(rfd, FIONREAD, &queued) < 0)) {
+			queued = -1;
+		}
+	}
+	/* So that drainSustained() gives up once the client
+	 * has been quiet for a second. */
+	if (setFlags(rfd, O_NONBLOCK) < 0) {
 		err(EXIT_FAILURE, "fcntl set flags");
 		/* NOTREACHED */
-	}	
+	}
+	drainSustained(rfd, &r);
+	ctlSend(cfd, "read %lld %lld %lld %.9f %d\n",
+			r.bytes, r.ops, r.eagain, r.elapsed, queued);
+	if (!QUIET) {
+		(void)printf("Read %lld bytes in %lld calls.\n", r.bytes, r.ops);
+	}
+}
 
-	(void)printFdQueueSize(fd, "space");
+/* '-D': serve one test at a time, each in a child of its
+ * own, so that a failing test (err(3) and all) doesn't
+ * take the daemon down with it; runs until killed.  A
+ * test that takes longer than DURATION seconds ('-d',
+ * which clients can't ask to exceed), give or take
+ * REMOTE_TIMEOUT, is killed, so that a client that went
+ * away can't keep the next one waiting. */
+void
+daemonLoop() {
+	struct sockaddr_storage s;
+	socklen_t len;
+	int lfd, on = 1;
+
+	len = resolveHost(REMOTE ? REMOTE : "", 1, &s);
+	if ((lfd = socket(s.ss_family, SOCK_STREAM, 0)) < 0) {
+		err(EXIT_FAILURE, "socket");
+		/* NOTREACHED */
+	}
+	if (setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
+		err(EXIT_FAILURE, "setsockopt SO_REUSEADDR");
+		/* NOTREACHED */
+	}
+	if (bind(lfd, (struct sockaddr *)&s, len) < 0) {
+		err(EXIT_FAILURE, "bind");
+		/* NOTREACHED */
+	}
+	if (listen(lfd, 8) < 0) {
+		err(EXIT_FAILURE, "listen");
+		/* NOTREACHED */
+	}
 	if (!QUIET) {
-		(void)printf("\n");
+		(void)printf("Listening on %s port %d.\n", addrName(&s), portOf(&s));
 	}
 
-	if (MODE == LOOP) {
-		writeLoop(fd, CHUNK1, CHUNK2);
-	} else {
-		int i = 0;
-		if (CHUNK2 < 1) {
-			i = 1;
-			CHUNK2 = CHUNK1;
-		}
-		if (!QUIET) {
-			int total = CHUNK1;
+	while (1) {
+		double deadline;
+		pid_t pid, w;
+		int cfd;
 
-			(void)printf("Trying to write %d", CHUNK1);
-			if (!i) {
-				total = CHUNK1 + (NUM_CHUNKS * CHUNK2);
-				(void)printf(" + (%d * %d) = %d",
-					NUM_CHUNKS, CHUNK2, total);
-			} else if ((CHUNK1 > 1) && (NUM_CHUNKS > 1)) {
-				total = CHUNK1 * NUM_CHUNKS;
-				(void)printf(" * %d = %d",
-					NUM_CHUNKS, total);
+		if (fflush(stdout) == EOF) {
+			err(EXIT_FAILURE, "fflush");
+			/* NOTREACHED */
+		}
+		if ((cfd = accept(lfd, NULL, NULL)) < 0) {
+			if (errno == EINTR) {
+				continue;
 			}
-			(void)printf(" byte%s...\n", total > 1 ? "s" : "");
+			err(EXIT_FAILURE, "accept");
+			/* NOTREACHED */
+		}
+		if ((pid = fork()) < 0) {
+			err(EXIT_FAILURE, "fork");
+			/* NOTREACHED */
+		}
+		if (pid == 0) {
+			(void)close(lfd);
+			serve(cfd);
+			exit(EXIT_SUCCESS);
+			/* NOTREACHED */
+		}
+		(void)close(cfd);
+		deadline = now() + DURATION + REMOTE_TIMEOUT;
+		while ((w = waitpid(pid, NULL, WNOHANG)) == 0) {
+			if (now() >= deadline) {
+				(void)kill(pid, SIGKILL);
+				if (!QUIET) {
+					(void)printf("Killed the test after %d seconds.\n",
+							DURATION + REMOTE_TIMEOUT);
+				}
+				w = waitpid(pid, NULL, 0);
+				break;
+			}
+			sleepUntil(nsecs() + 100000000LL);
+		}
+		if (w < 0) {
+			err(EXIT_FAILURE, "waitpid");
+			/* NOTREACHED */
 		}
-		writeChunk(fd, CHUNK1);
-		for (; i<NUM_CHUNKS; i++) {
-			writeChunk(fd, CHUNK2);
+	}
+}
+
+/* '-H': the writer's end of a test against the daemon
+ * at REMOTE. */
+void
+remote() {
+	struct sockaddr_storage s;
+	struct xferStats r;
+	socklen_t len;
+	char line[BUFSIZ];
+	int cfd, wfd, port, rcvbuf, rcvlowat, queued, hellos = 0;
+
+	len = resolveHost(REMOTE, 0, &s);
+	if ((cfd = socket(s.ss_family, SOCK_STREAM, 0)) < 0) {
+		err(EXIT_FAILURE, "socket");
+		/* NOTREACHED */
+	}
+	if (connect(cfd, (struct sockaddr *)&s, len) < 0) {
+		err(EXIT_FAILURE, "connect to %s", REMOTE);
+		/* NOTREACHED */
+	}
+	ctlSend(cfd, "ipcbuf %d %s %s %d %d %d %d %d\n", REMOTE_VERSION, modeName(),
+			SOCK_TYPE == SOCK_STREAM ? "stream" : "dgram",
+			CHUNK1, SET_RCVBUF, SET_RCVLOWAT, TCP_OPTS,
+			(MODE == THROUGHPUT) && (BYTE_LIMIT < 0) ? DURATION : 0);
+	ctlRecv(cfd, line, sizeof(line), REMOTE_TIMEOUT);
+	if (sscanf(line, "port %d %d %d", &port, &rcvbuf, &rcvlowat) != 3) {
+		errx(EXIT_FAILURE, "Unexpected reply '%s' from %s.", line, REMOTE);
+		/* NOTREACHED */
+	}
+
+	setPort(&s, port);
+	if ((wfd = socket(s.ss_family, SOCK_TYPE, 0)) < 0) {
+		err(EXIT_FAILURE, "socket");
+		/* NOTREACHED */
+	}
+	setBufferSizes(-1, wfd);
+	if (connect(wfd, (struct sockaddr *)&s, len) < 0) {
+		err(EXIT_FAILURE, "connect to %s port %d", REMOTE, port);
+		/* NOTREACHED */
+	}
+	if (SOCK_TYPE == SOCK_DGRAM) {
+		/* The hello may get lost, too. */
+		struct pollfd pfd = { cfd, POLLIN, 0 };
+
+		while (hellos < 10) {
+			if ((send(wfd, "", 1, 0) < 0) && (errno != ECONNREFUSED)) {
+				err(EXIT_FAILURE, "send");
+				/* NOTREACHED */
+			}
+			hellos++;
+			if (poll(&pfd, 1, 1000) > 0) {
+				break;
+			}
 		}
 	}
+	ctlExpect(cfd, "ready");
 
-	(void)printFdQueueSize(fd, "write");
+	printSockOpt(wfd, SO_SNDBUF);
+	printSockOpt(wfd, SO_SNDLOWAT);
 	if (!QUIET) {
-		(void)printf("Observed total : %8d\n\n", TOTAL);
+		(void)printf("%-15s: %8d\n", "SO_RCVBUF", rcvbuf);
+		(void)printf("%-15s: %8d\n", "SO_RCVLOWAT", rcvlowat);
+		if (isTcp()) {
+			(void)printf("%-15s: %s\n", "TCP options", tcpOptsName());
+		}
+	}
+
+	if (MODE == LATENCY) {
+		struct hist h;
+
+		/* A lost echo shouldn't hang us for good. */
+		setTimeouts(wfd);
+		pingLoop(wfd, wfd, &h);
+		endStream(wfd);
+		ctlExpect(cfd, "done");
+		(void)close(cfd);
+		reportHist("RTT", &h);
+		reportZerocopy();
+		return;
+	}
+
+	if (MODE == THROUGHPUT) {
+		struct xferStats w;
+
+		writeSustained(wfd, &w);
+		endStream(wfd);
+		RESULT.w = w;
+		RESULT.wperf = w.perf;
+		reportXfer("Write", &w);
+		reportZerocopy();
+		reportSeries();
 	} else {
-		(void)printf("%d\n", TOTAL);
+		writeData(wfd, -1);
+		ctlSend(cfd, "drain %d\n", LARGEST_CHUNK);
+		endStream(wfd);
 	}
 
-	if ((IPC_TYPE == IPC_PIPE) || (IPC_TYPE == IPC_FIFO)) {
-		(void)close(fd);
+	memset(&r, 0, sizeof(r));
+	ctlRecv(cfd, line, sizeof(line), REMOTE_TIMEOUT);
+	if (sscanf(line, "read %lld %lld %lld %lf %d", &r.bytes, &r.ops,
+			&r.eagain, &r.elapsed, &queued) != 5) {
+		errx(EXIT_FAILURE, "Unexpected reply '%s' from %s.", line, REMOTE);
+		/* NOTREACHED */
+	}
+	(void)close(cfd);
+	/* The daemon reads only the first hello; any others
+	 * reached it as data, unless they got lost. */
+	if (hellos > 1) {
+		r.bytes -= hellos - 1;
+		if (r.bytes < 0) {
+			r.bytes = 0;
+		}
+	}
+	/* We have no counters for the other side. */
+	r.perf = RESULT.rperf;
+	RESULT.r = r;
+
+	if (MODE == THROUGHPUT) {
+		if (!QUIET) {
+			(void)printf("\n");
+		}
+		reportXfer("Read", &r);
+	} else if (!QUIET) {
+		if (queued >= 0) {
+			(void)printf("%-15s: %8d\n", "Remote queued", queued);
+		}
+		(void)printf("%-15s: %8lld\n", "Remote read", r.bytes);
+		if (SOCK_TYPE == SOCK_DGRAM) {
+			(void)printf("%-15s: %8lld\n", "Lost bytes", TOTAL - r.bytes);
+		}
 	}
 }
 
 void
-readData(int fd) {
-	int left, nr;
-	int total = 0;
-	char *buf;
+doRemote() {
+	reportTest("%s %s socket to %s", SET_SOCKDOMAIN, SET_SOCKTYPE, REMOTE);
+	remote();
+}
 
-	if (!QUIET) {
-		(void)printf("Draining...\n");
+const char *
+ipcTypeName() {
+	switch(IPC_TYPE) {
+	case IPC_FIFO:
+		return "fifo";
+	case IPC_SOCKET:
+		return "socket";
+	case IPC_SOCKETPAIR:
+		return "socketpair";
+	case IPC_SHM:
+		return "shm";
+	case IPC_MQUEUE:
+		return "mqueue";
+	case IPC_MSGQ:
+		return "msgq";
+	default:
+		return "pipe";
 	}
+}
 
-	int bufsiz = BUFSIZ;
-	if (LARGEST_CHUNK > bufsiz) {
-		bufsiz = LARGEST_CHUNK;
+char **
+splitList(const char *spec, int *num) {
+	char *copy, *item, **list = NULL;
+
+	if ((copy = strdup(spec)) == NULL) {
+		err(EXIT_FAILURE, "strdup");
+		/* NOTREACHED */
 	}
 
-	if ((buf = malloc(bufsiz)) == NULL) {
-		err(EXIT_FAILURE, "malloc");
+	*num = 0;
+	while ((item = strsep(&copy, ",")) != NULL) {
+		if (*item == '\0') {
+			continue;
+		}
+		if ((list = realloc(list, (*num + 1) * sizeof(*list))) == NULL) {
+			err(EXIT_FAILURE, "realloc");
+			/* NOTREACHED */
+		}
+		list[(*num)++] = item;
+	}
+
+	if (*num == 0) {
+		errx(EXIT_FAILURE, "Empty list '%s'.", spec);
+		/* NOTREACHED */
+	}
+	return list;
+}
+
+/* Turn e.g. "1,3,8..64" into 1, 3, 8, 16, 32, 64.
+ * Ranges double from the lower bound and always
+ * include the upper bound.  Without a 'spec', the
+ * list is just the given 'value'. */
+int *
+expandNumbers(const char *spec, int value, int threshold, const char *what, int *num) {
+	char **items;
+	int *list = NULL;
+	int i, n, count = 0;
+
+	if (spec == NULL) {
+		if ((list = malloc(sizeof(*list))) == NULL) {
+			err(EXIT_FAILURE, "malloc");
+			/* NOTREACHED */
+		}
+		list[0] = value;
+		*num = 1;
+		return list;
 	}
 
-	if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
-		err(EXIT_FAILURE, "fcntl set flags");
-		/* NOTREACHED */
-	}	
+	items = splitList(spec, &n);
+	for (i = 0; i < n; i++) {
+		char *dots;
+		int lo, hi;
 
-	while (1) {
-		left = printFdQueueSize(fd, "read");
-		if (left == 0) {
-			break;
+		if ((dots = strstr(items[i], "..")) == NULL) {
+			lo = hi = inputNumber(items[i], threshold, what);
+		} else {
+			*dots = '\0';
+			lo = inputNumber(items[i], threshold > 1 ? threshold : 1, what);
+			hi = inputNumber(dots + strlen(".."), lo, what);
 		}
 
-		if ((nr = read(fd, buf, bufsiz)) < 0) {
-			if (errno == EAGAIN) {
+		while (1) {
+			if ((list = realloc(list, (count + 1) * sizeof(*list))) == NULL) {
+				err(EXIT_FAILURE, "realloc");
+				/* NOTREACHED */
+			}
+			list[count++] = lo;
+			if (lo >= hi) {
 				break;
 			}
-			err(EXIT_FAILURE, "read");
+			lo = (lo > hi / 2) ? hi : lo * 2;
+		}
+	}
+	free(items);
+
+	*num = count;
+	return list;
+}
+
+/* Turn e.g. "1..8:1,16" into 1:1, 2:1, 4:1, 8:1, 16:16
+ * writers and readers. */
+int *
+expandWorkers(const char *spec, int **readers, int *num) {
+	char **items;
+	int *writers = NULL;
+	int i, j, n, count = 0;
+
+	if (spec == NULL) {
+		if (((writers = malloc(sizeof(*writers))) == NULL) ||
+		    ((*readers = malloc(sizeof(**readers))) == NULL)) {
+			err(EXIT_FAILURE, "malloc");
 			/* NOTREACHED */
 		}
-		total += nr;
+		writers[0] = WRITERS;
+		(*readers)[0] = READERS;
+		*num = 1;
+		return writers;
+	}
 
-		if (nr == 0) {
-			/* read(2) returned EOF: all data read. */
-			break;
+	items = splitList(spec, &n);
+	for (i = 0; i < n; i++) {
+		char *colon;
+		int *list, k, r = -1;
+
+		if ((colon = strchr(items[i], ':')) != NULL) {
+			*colon = '\0';
+			r = inputNumber(colon + 1, 1, "-j");
+		}
+		list = expandNumbers(items[i], 0, 1, "-j", &k);
+		if (((writers = realloc(writers, (count + k) * sizeof(*writers))) == NULL) ||
+		    ((*readers = realloc(*readers, (count + k) * sizeof(**readers))) == NULL)) {
+			err(EXIT_FAILURE, "realloc");
+			/* NOTREACHED */
+		}
+		for (j = 0; j < k; j++) {
+			writers[count] = list[j];
+			(*readers)[count++] = (r > 0) ? r : list[j];
 		}
+		free(list);
 	}
-	free(buf);
-	
-	if (!QUIET) {
-		(void)printf("%-15s: %8d\n", "Read", total);
+	free(items);
+
+	*num = count;
+	return writers;
+}
+
+/* Without a 'spec', the list is a single NULL,
+ * meaning "leave as is". */
+char **
+expandNames(char *spec, int *num) {
+	char **list;
+
+	if (spec != NULL) {
+		return splitList(spec, num);
+	}
+
+	if ((list = calloc(1, sizeof(*list))) == NULL) {
+		err(EXIT_FAILURE, "calloc");
+		/* NOTREACHED */
 	}
+	*num = 1;
+	return list;
 }
 
+/* Print one field of a structured record: just the
+ * name for the CSV header, otherwise the value, empty
+ * (or null) if 'fmt' is NULL.  'quote' strings for
+ * JSON. */
 void
-reportTest(const char *fmt, ...) {
-	if (QUIET) {
+emitField(int *n, int header, const char *name, int quote, const char *fmt, ...) {
+	va_list args;
+
+	if ((*n)++ > 0) {
+		(void)printf(",");
+	}
+	if (FORMAT == FMT_JSON) {
+		(void)printf("\"%s\":", name);
+	} else if (header) {
+		(void)printf("%s", name);
 		return;
 	}
 
-	va_list args;
-
-	char *mode = "loop";
-	if (MODE == CHUNK) {
-		mode = "chunk";
+	if (fmt == NULL) {
+		if (FORMAT == FMT_JSON) {
+			(void)printf("null");
+		}
+		return;
 	}
 
-	(void)printf("Testing ");
+	if (quote && (FORMAT == FMT_JSON)) {
+		(void)printf("\"");
+	}
 	va_start(args, fmt);
 	(void)vprintf(fmt, args);
 	va_end(args);
-	(void)printf(" buffer size in %s mode.\n", mode);
-	if (MODE == LOOP) {
-		(void)printf("Loop starting with %d byte%s",
-				CHUNK1, CHUNK1 > 1 ? "s" : "");
-		if (CHUNK2 == -1) {
-			(void)printf(" and doubling each iteration.\n");
-		} else {
-			(void)printf(", increasing by %d byte%s each time.\n",
-					CHUNK2, CHUNK2 != 1 ? "s" : "");
-		}
-	} else {
-		(void)printf("First chunk: %d byte%s, ",
-				CHUNK1, CHUNK1 > 1 ? "s" : "");
-		(void)printf("then %d more chunk%s of size %d.\n",
-				NUM_CHUNKS, NUM_CHUNKS > 1 ? "s" : "",
-				CHUNK2 < 0 ? CHUNK1 : CHUNK2);
+	if (quote && (FORMAT == FMT_JSON)) {
+		(void)printf("\"");
 	}
-	(void)printf("\n");
 }
 
 void
-doPipe() {
-	int fd[2];
-
-	if (pipe(fd) < 0) {
-		err(EXIT_FAILURE, "pipe");
-		/* NOTREACHED */
-	}
+emitXfer(int *n, int header, const char *which, struct xferStats *x) {
+	char name[BUFSIZ];
+	int valid = (x->elapsed >= 0);
 
-	setPipeSize(fd[1]);
+	(void)snprintf(name, sizeof(name), "%s_seconds", which);
+	emitField(n, header, name, 0, valid ? "%.6f" : NULL, x->elapsed);
+	(void)snprintf(name, sizeof(name), "%s_bytes", which);
+	emitField(n, header, name, 0, valid ? "%lld" : NULL, x->bytes);
+	(void)snprintf(name, sizeof(name), "%s_calls", which);
+	emitField(n, header, name, 0, valid ? "%lld" : NULL, x->ops);
+	(void)snprintf(name, sizeof(name), "%s_eagain", which);
+	emitField(n, header, name, 0, valid ? "%lld" : NULL, x->eagain);
+	(void)snprintf(name, sizeof(name), "%s_mbs", which);
+	emitField(n, header, name, 0, valid ? "%.2f" : NULL,
+			x->elapsed > 0 ? (double)x->bytes / x->elapsed / 1000000 : 0);
+}
 
-	reportTest("pipe");
+/* The perf counters of the side named 'which'. */
+void
+emitPerf(int *n, int header, const char *which, struct perfCounts *p) {
+	const char *names[NUM_PERF] = { "csw", "cycles", "instructions",
+		"cache_misses", "page_faults" };
+	char name[BUFSIZ];
+	int i;
 
-#ifdef PIPE_BUF
-	if (!QUIET) {
-		(void)printf("%-15s: %8d\n", "PIPE_BUF", PIPE_BUF);
-	}
-#endif
-#ifdef PIPE_MAX
-	if (!QUIET) {
-		(void)printf("%-15s: %8d\n", "PIPE_MAX", PIPE_MAX);
+	for (i = 0; i < NUM_PERF; i++) {
+		(void)snprintf(name, sizeof(name), "%s_%s", which, names[i]);
+		emitField(n, header, name, 0, p->v[i] >= 0 ? "%lld" : NULL, p->v[i]);
 	}
-#endif
+}
 
-#ifdef F_GETPIPE_SZ
-	int s;
-	if ((s = fcntl(fd[1], F_GETPIPE_SZ, 0)) < 0) {
-		err(EXIT_FAILURE, "fcntl(F_GETPIPE_SZ)");
-		/* NOTREACHED */
-	}
-	if (!QUIET) {
-		(void)printf("%-15s: %8d\n", "F_GETPIPE_SZ", s);
-	}
-#endif
+/* Print the current test parameters and RESULT as one
+ * line of CSV or JSON; without a 'status', print the
+ * CSV header instead. */
+void
+emitRecord(const char *io, const char *status) {
+	struct result *x = &RESULT;
+	int header = (status == NULL);
+	int sock = (IPC_TYPE == IPC_SOCKET) || (IPC_TYPE == IPC_SOCKETPAIR);
+	int n = 0;
 
-	long l;
-	if ((l = fpathconf(fd[1], _PC_PIPE_BUF)) < 0) {
-		err(EXIT_FAILURE, "fpathconf");
-		/* NOTREACHED */
+	if (FORMAT == FMT_JSON) {
+		(void)printf("{");
 	}
-	if (!QUIET) {
-		(void)printf("%-15s: %8ld\n", "_PC_PIPE_BUF", l);
+	emitField(&n, header, "type", 1, "%s", ipcTypeName());
+	emitField(&n, header, "socktype", 1, sock ? "%s%s" : NULL,
+			SOCK_DOMAIN == PF_INET ? "inet-" :
+			SOCK_DOMAIN == PF_INET6 ? "inet6-" : "",
+			SOCK_TYPE == SOCK_STREAM ? "stream" : "dgram");
+	emitField(&n, header, "pipebuf", 0, SET_PIPEBUF > 0 ? "%d" : NULL, SET_PIPEBUF);
+	emitField(&n, header, "rcvbuf", 0, SET_RCVBUF > 0 ? "%d" : NULL, SET_RCVBUF);
+	emitField(&n, header, "sndbuf", 0, SET_SNDBUF > 0 ? "%d" : NULL, SET_SNDBUF);
+	emitField(&n, header, "rcvlowat", 0, SET_RCVLOWAT > 0 ? "%d" : NULL, SET_RCVLOWAT);
+	emitField(&n, header, "sndlowat", 0, SET_SNDLOWAT > 0 ? "%d" : NULL, SET_SNDLOWAT);
+	emitField(&n, header, "events", 0, "%d", EVENTS);
+	emitField(&n, header, "threaded", 0, "%d", THREADED);
+	emitField(&n, header, "tcpopts", 1, isTcp() ? "%s" : NULL, tcpOptsName());
+	emitField(&n, header, "mode", 1, "%s", modeName());
+	emitField(&n, header, "io", 1, "%s", io);
+	emitField(&n, header, "gso_size", 0, GSO ? "%d" : NULL, GSO_SIZE);
+	emitField(&n, header, "chunk1", 0, "%d", CHUNK1);
+	emitField(&n, header, "chunk2", 0, CHUNK2 >= 0 ? "%d" : NULL, CHUNK2);
+	emitField(&n, header, "chunks", 0, MODE == CHUNK ? "%d" : NULL, NUM_CHUNKS);
+	emitField(&n, header, "writers", 0, "%d", WRITERS);
+	emitField(&n, header, "readers", 0, "%d", INDEPENDENT ? WRITERS : READERS);
+	emitField(&n, header, "channels", 0, "%d", x->channels >= 0 ? x->channels :
+			INDEPENDENT ? WRITERS : 1);
+	emitField(&n, header, "trial", 0, "%d", TRIAL + 1);
+	emitField(&n, header, "status", 1, "%s", status);
+	emitField(&n, header, "total", 0, x->total >= 0 ? "%lld" : NULL, x->total);
+	emitField(&n, header, "iterations", 0, x->iterations >= 0 ? "%d" : NULL, x->iterations);
+	emitField(&n, header, "largest", 0, x->largest >= 0 ? "%d" : NULL, x->largest);
+	emitField(&n, header, "msgsize", 0, x->msgsize > 0 ? "%d" : NULL, x->msgsize);
+	emitField(&n, header, "maxwrite", 0, x->maxwrite >= 0 ? "%d" : NULL, x->maxwrite);
+	emitField(&n, header, "channel_min", 0, x->chan_min >= 0 ? "%d" : NULL, x->chan_min);
+	emitField(&n, header, "channel_max", 0, x->chan_max >= 0 ? "%d" : NULL, x->chan_max);
+	emitField(&n, header, "shrink_at", 0, x->shrink_at > 0 ? "%d" : NULL, x->shrink_at);
+	emitField(&n, header, "slots", 0, x->slots > 0 ? "%d" : NULL, x->slots);
+	emitField(&n, header, "bytes_per_slot", 0, (x->slots > 0) && (x->total >= 0) ? "%.1f" : NULL,
+			x->slots > 0 ? (double)x->total / x->slots : 0);
+	emitField(&n, header, "packet_total", 0, x->packet >= 0 ? "%d" : NULL, x->packet);
+	emitField(&n, header, "fullest_hop", 0, x->fullest > 0 ? "%d" : NULL, x->fullest);
+	emitField(&n, header, "time_to_full_ns", 0, x->full_ns >= 0 ? "%lld" : NULL, x->full_ns);
+	emitField(&n, header, "writer_stalls", 0, x->stalls >= 0 ? "%d" : NULL, x->stalls);
+	emitField(&n, header, "stall_p50_ns", 0, x->stalls > 0 ? "%lld" : NULL, x->stall[0]);
+	emitField(&n, header, "stall_p99_ns", 0, x->stalls > 0 ? "%lld" : NULL, x->stall[1]);
+	emitField(&n, header, "stall_max_ns", 0, x->stalls > 0 ? "%lld" : NULL, x->stall[2]);
+	emitField(&n, header, "peak_queued", 0, x->peak >= 0 ? "%d" : NULL, x->peak);
+	emitField(&n, header, "time_to_steady_ns", 0, x->steady_ns >= 0 ? "%lld" : NULL, x->steady_ns);
+	emitField(&n, header, "peak_sndbuf", 0, x->peak_sndbuf >= 0 ? "%d" : NULL, x->peak_sndbuf);
+	emitField(&n, header, "peak_rcvbuf", 0, x->peak_rcvbuf >= 0 ? "%d" : NULL, x->peak_rcvbuf);
+	emitField(&n, header, "kmem_bytes", 0, x->kmem >= 0 ? "%lld" : NULL, x->kmem);
+	emitField(&n, header, "kmem_ratio", 0, (x->kmem >= 0) && (x->total > 0) ? "%.3f" : NULL,
+			x->total > 0 ? (double)x->kmem / x->total : 0);
+	emitField(&n, header, "kmem_per_write", 0, (x->kmem >= 0) && (x->writes > 0) ? "%lld" : NULL,
+			x->writes > 0 ? x->kmem / x->writes : 0);
+	emitField(&n, header, "drain_bytes", 0, x->drain_ns >= 0 ? "%lld" : NULL, x->drained);
+	emitField(&n, header, "drain_ns", 0, x->drain_ns >= 0 ? "%lld" : NULL, x->drain_ns);
+	emitField(&n, header, "drain_mbs", 0, x->drain_ns > 0 ? "%.2f" : NULL,
+			x->drain_ns > 0 ? (double)x->drained * 1000 / x->drain_ns : 0);
+	emitXfer(&n, header, "write", &x->w);
+	emitXfer(&n, header, "read", &x->r);
+	emitField(&n, header, "read_wakeups", 0, x->r.elapsed >= 0 ? "%lld" : NULL, x->r.wakeups);
+	emitField(&n, header, "read_wake_p50_ns", 0, x->r.elapsed >= 0 ? "%lld" : NULL, x->r.wake[0]);
+	emitField(&n, header, "read_wake_p99_ns", 0, x->r.elapsed >= 0 ? "%lld" : NULL, x->r.wake[1]);
+	emitPerf(&n, header, "write", &x->wperf);
+	emitPerf(&n, header, "read", &x->rperf);
+	emitField(&n, header, "zerocopy_sends", 0, isZerocopy() ? "%lld" : NULL, ZC_SENDS);
+	emitField(&n, header, "zerocopy_copied", 0, isZerocopy() ? "%lld" : NULL, ZC_COPIED);
+	emitField(&n, header, "rtt_p50_ns", 0, x->rtt[0] >= 0 ? "%lld" : NULL, x->rtt[0]);
+	emitField(&n, header, "rtt_p99_ns", 0, x->rtt[1] >= 0 ? "%lld" : NULL, x->rtt[1]);
+	emitField(&n, header, "rtt_p999_ns", 0, x->rtt[2] >= 0 ? "%lld" : NULL, x->rtt[2]);
+	emitField(&n, header, "rtt_max_ns", 0, x->rtt[3] >= 0 ? "%lld" : NULL, x->rtt[3]);
+	if (FORMAT == FMT_JSON) {
+		(void)printf("}");
 	}
-
-	writeData(fd[1]);
-	readData(fd[0]);
+	(void)printf("\n");
 }
 
 void
-reportSysctl(const char *s) {
-#ifdef __sun
-	return;
-#else
-	if (QUIET || (strcmp(s, "invalid") == 0)) {
-		return;
-	}
-
-	char *sysctl, *spath, *sname;
-	char sval[BUFSIZ];
-
-	memset(sval, '\0', BUFSIZ);
+resetResult() {
+	int i;
 
-	if ((sysctl = strdup(s)) == NULL) {
-		err(EXIT_FAILURE, "strdup");
-		/* NOTREACHED */
+	RESULT.total = -1;
+	RESULT.iterations = -1;
+	RESULT.largest = -1;
+	RESULT.msgsize = -1;
+	RESULT.maxwrite = -1;
+	RESULT.w.elapsed = -1;
+	RESULT.r.elapsed = -1;
+	RESULT.writes = -1;
+	RESULT.kmem = -1;
+	RESULT.drained = -1;
+	RESULT.drain_ns = -1;
+	RESULT.channels = -1;
+	RESULT.chan_min = -1;
+	RESULT.chan_max = -1;
+	RESULT.shrink_at = -1;
+	RESULT.slots = -1;
+	RESULT.packet = -1;
+	RESULT.fullest = -1;
+	RESULT.full_ns = -1;
+	RESULT.stalls = -1;
+	RESULT.peak = -1;
+	RESULT.steady_ns = -1;
+	RESULT.peak_sndbuf = -1;
+	RESULT.peak_rcvbuf = -1;
+	for (i = 0; i < NUM_PERF; i++) {
+		RESULT.wperf.v[i] = -1;
+		RESULT.rperf.v[i] = -1;
 	}
+	for (i = 0; i < 4; i++) {
+		RESULT.rtt[i] = -1;
+	}
+}
 
-	spath = sysctl;
+/* Run the test once on fresh channels. */
+void
+runFresh() {
+	int fd[2], efd[2];
 
-	if ( ((sname = strrchr(s, '.')) == NULL) || strlen(sname) < 2) {
-		sname = spath;
+	if (REMOTE) {
+		remote();
+	} else if (MODE == PROBE) {
+		probe();
+	} else if (MODE == FANOUT) {
+		fanout();
+	} else if (MODE == SUBPAGE) {
+		subpage();
+	} else if (MODE == CHAIN) {
+		chain();
+	} else if (MODE == BACKPRESSURE) {
+		backpressure();
+	} else if (MODE == LATENCY) {
+		openChannel(fd);
+		openChannel(efd);
+		latency(fd[0], fd[1], efd[0], efd[1]);
 	} else {
-		sname++;
+		openChannel(fd);
+		runTest(fd[0], fd[1]);
 	}
+}
 
-	printf("%-15s: ", sname);
+/* How long past '-d' a cell may run before we give up
+ * on it, in seconds. */
+#define CELL_TIMEOUT 60
 
-#  ifdef __linux
-	char c;
-	int fd, n;
-	char path[PATH_MAX];
+/* Run a single test on fresh channels in a child, so
+ * that every cell starts out with a clean slate and a
+ * failing cell (err(3) and all) doesn't end the sweep.
+ * A cell that hangs is killed, along with any processes
+ * of its own, after DURATION + CELL_TIMEOUT seconds.
+ * 'flag' selects the I/O method named 'io'.  With '-r'
+ * and '-w', every trial is a record of its own, and the
+ * warm-up runs aren't reported at all. */
+void
+runCell(const char *io, int *flag) {
+	double deadline;
+	pid_t pid, w;
+	int status, killed;
 
-	while ((c = *sysctl) != '\0') {
-		if (c == '.') {
-			*sysctl = '/';
+	for (TRIAL = -WARMUP; TRIAL < TRIALS; TRIAL++) {
+		resetResult();
+		if (fflush(stdout) == EOF) {
+			err(EXIT_FAILURE, "fflush");
+			/* NOTREACHED */
 		}
-		sysctl++;
-	}
 
-	memset(path, '\0', PATH_MAX);
-	(void)strcpy(path, "/proc/sys/");
-	(void)strncat(path, spath, PATH_MAX - strlen("/proc/sys/"));
+		if ((pid = fork()) < 0) {
+			err(EXIT_FAILURE, "fork");
+			/* NOTREACHED */
+		}
 
-	if ((fd = open(path, O_RDONLY)) < 0) {
-		err(EXIT_FAILURE, "open");
-		/* NOTREACHED */
-	}
+		if (pid == 0) {
+			(void)setpgid(0, 0);
+			if (flag) {
+				*flag = 1;
+			}
+			runFresh();
+			if (TRIAL >= 0) {
+				emitRecord(io, "ok");
+			}
+			exit(EXIT_SUCCESS);
+			/* NOTREACHED */
+		}
 
-	if (read(fd, sval, BUFSIZ) < 0) {
-		err(EXIT_FAILURE, "read");
-		/* NOTREACHED */
+		(void)setpgid(pid, pid);
+		deadline = now() + DURATION + CELL_TIMEOUT;
+		killed = 0;
+		while ((w = waitpid(pid, &status, WNOHANG)) == 0) {
+			if (now() >= deadline) {
+				(void)kill(-pid, SIGKILL);
+				killed = 1;
+				w = waitpid(pid, &status, 0);
+				break;
+			}
+			sleepUntil(nsecs() + 10000000LL);
+		}
+		if (w < 0) {
+			err(EXIT_FAILURE, "waitpid");
+			/* NOTREACHED */
+		}
+		if (TRIAL < 0) {
+			continue;
+		}
+		if (killed) {
+			emitRecord(io, "timeout");
+		} else if (!WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+			emitRecord(io, "error");
+		}
 	}
-	(void)close(fd);
+}
 
-	if ((n = (int)strtol(sval, NULL, 10)) < 1) {
-		err(EXIT_FAILURE, "strtol");
-		/* NOTREACHED */
+/* Run the test for every combination of the values
+ * given for -t, -s, -P, -R, -S, -L, -W, -O, -j, and the chunk sizes,
+ * skipping those that don't apply (e.g. -P for a
+ * socket), and report one record per test. */
+void
+sweep() {
+	char **types, **socktypes, **tcpopts;
+	int *pipebufs, *rcvbufs, *sndbufs, *rcvlowats, *sndlowats, *chunks1, *chunks2;
+	int *writers, *readers = NULL;
+	int ntypes, nsocktypes, npipebufs, nrcvbufs, nsndbufs, nchunks1, nchunks2;
+	int nrcvlowats, nsndlowats, ntcpopts, nworkers;
+	int i, cells, threshold = 0;
+
+	if ((MODE == THROUGHPUT) || (MODE == LATENCY)) {
+		threshold = 1;
 	}
 
-	printf("%8d\n", n);
-#  else
-	size_t len;
+	types = expandNames(SWEEP_TYPES, &ntypes);
+	socktypes = expandNames(SWEEP_SOCKTYPES, &nsocktypes);
+	tcpopts = expandNames(SWEEP_TCPOPTS, &ntcpopts);
+	pipebufs = expandNumbers(SWEEP_PIPEBUFS, SET_PIPEBUF, 1, "-P", &npipebufs);
+	rcvbufs = expandNumbers(SWEEP_RCVBUFS, SET_RCVBUF, 1, "-R", &nrcvbufs);
+	sndbufs = expandNumbers(SWEEP_SNDBUFS, SET_SNDBUF, 1, "-S", &nsndbufs);
+	rcvlowats = expandNumbers(SWEEP_RCVLOWATS, SET_RCVLOWAT, 1, "-L", &nrcvlowats);
+	sndlowats = expandNumbers(SWEEP_SNDLOWATS, SET_SNDLOWAT, 1, "-W", &nsndlowats);
+	chunks1 = expandNumbers(SWEEP_CHUNKS1, CHUNK1, threshold, "initial chunk size", &nchunks1);
+	chunks2 = expandNumbers(SWEEP_CHUNKS2, CHUNK2, 0, "second argument", &nchunks2);
+	writers = expandWorkers(SWEEP_WORKERS, &readers, &nworkers);
 
-	if (sysctlbyname(s, NULL, &len, NULL, 0) < 0) {
-		err(EXIT_FAILURE, "sysctl");
-		/* NOTREACHED */
+	/* Catch typos before we spend any time testing. */
+	for (i = 0; i < ntypes; i++) {
+		if (types[i]) {
+			setIpcType(types[i]);
+		}
+	}
+	for (i = 0; i < nsocktypes; i++) {
+		if (socktypes[i]) {
+			setSockType(socktypes[i]);
+		}
+	}
+	for (i = 0; i < ntcpopts; i++) {
+		if (tcpopts[i]) {
+			(void)parseTcpOpts(tcpopts[i]);
+		}
 	}
 
-	if (len > BUFSIZ) {
-		(void)fprintf(stderr, "sysctl value too large for %s\n", spath);
-		exit(EXIT_FAILURE);
-		/* NOTREACHED */
+	/* Read the tunables before we fork for the first
+	 * cell. */
+	emitTunables();
+	if (FORMAT == FMT_CSV) {
+		emitRecord(NULL, NULL);
 	}
 
-	if (sysctlbyname(s, sval, &len, NULL, 0) < 0) {
-		err(EXIT_FAILURE, "sysctl");
-		/* NOTREACHED */
+	cells = ntypes * nsocktypes * npipebufs * nrcvbufs * nsndbufs *
+		nrcvlowats * nsndlowats * ntcpopts * nchunks1 * nchunks2 * nworkers;
+	for (i = 0; i < cells; i++) {
+		int k = i, sock;
+		int j = k % nworkers;
+		int o = (k /= nworkers) % ntcpopts;
+		int c2 = (k /= ntcpopts) % nchunks2;
+		int c1 = (k /= nchunks2) % nchunks1;
+		int wl = (k /= nchunks1) % nsndlowats;
+		int rl = (k /= nsndlowats) % nrcvlowats;
+		int w = (k /= nrcvlowats) % nsndbufs;
+		int r = (k /= nsndbufs) % nrcvbufs;
+		int p = (k /= nrcvbufs) % npipebufs;
+		int s = (k /= npipebufs) % nsocktypes;
+		int t = k / nsocktypes;
+
+		if (types[t]) {
+			setIpcType(types[t]);
+		}
+		sock = (IPC_TYPE == IPC_SOCKET) || (IPC_TYPE == IPC_SOCKETPAIR);
+		if ((!sock && (s || r || w || rl || wl)) || (!isSizable() && p)) {
+			continue;
+		}
+		if (sock && socktypes[s]) {
+			setSockType(socktypes[s]);
+		}
+		if (sock && (SOCK_DOMAIN != PF_LOCAL) && (IPC_TYPE != IPC_SOCKET)) {
+			continue;
+		}
+		if (REMOTE && (SOCK_DOMAIN == PF_LOCAL)) {
+			continue;
+		}
+		if (!isTcp() && o) {
+			continue;
+		}
+		if (tcpopts[o]) {
+			TCP_OPTS = parseTcpOpts(tcpopts[o]);
+		}
+
+		SET_PIPEBUF = isSizable() ? pipebufs[p] : -1;
+		SET_RCVBUF = sock ? rcvbufs[r] : -1;
+		SET_SNDBUF = sock ? sndbufs[w] : -1;
+		SET_RCVLOWAT = sock ? rcvlowats[rl] : -1;
+		SET_SNDLOWAT = sock ? sndlowats[wl] : -1;
+		CHUNK1 = chunks1[c1];
+		CHUNK2 = chunks2[c2];
+		WRITERS = writers[j];
+		READERS = readers[j];
+		if ((IPC_TYPE == IPC_SHM) && !INDEPENDENT &&
+		    ((WRITERS > 1) || (READERS > 1))) {
+			continue;
+		}
+		if (EVENTS && ((IPC_TYPE == IPC_SHM) || (IPC_TYPE == IPC_MSGQ))) {
+			continue;
+		}
+
+		if ((MODE == CHAIN) && !isChainable()) {
+			continue;
+		}
+		if ((MODE == BACKPRESSURE) && ((IPC_TYPE == IPC_SHM) ||
+		    (IPC_TYPE == IPC_MQUEUE) || (IPC_TYPE == IPC_MSGQ) || isUdp())) {
+			continue;
+		}
+
+		runCell("write", NULL);
+		if (VMSPLICE && ((IPC_TYPE == IPC_PIPE) ||
+		    ((MODE == CHAIN) && (IPC_TYPE == IPC_FIFO)))) {
+			runCell(MODE == CHAIN ? "splice" : "vmsplice", &SPLICE);
+		}
+		if (BATCH && isDgram()) {
+			runCell("mmsg", &MMSG);
+		}
+		if (VECTORED && (IPC_TYPE != IPC_SHM) &&
+		    (IPC_TYPE != IPC_MQUEUE) && (IPC_TYPE != IPC_MSGQ)) {
+			runCell("writev", &WRITEV);
+		}
+		if (URING_DEPTH && (IPC_TYPE != IPC_SHM) &&
+		    (IPC_TYPE != IPC_MQUEUE) && (IPC_TYPE != IPC_MSGQ)) {
+			runCell("io_uring", &URING);
+		}
+		if (GSO_SIZE && isUdp()) {
+			runCell("gso", &GSO);
+		}
 	}
-	printf("%8d\n", *(int *)sval);
-#  endif
-	free(spath);
-#endif
 }
 
+/* In tune mode, one throughput test at a buffer size:
+ * the size we asked for, what the kernel made of it,
+ * and the MB/s the reader got. */
+struct tuneStep {
+	int size;
+	int sndbuf;
+	int rcvbuf;
+	double mbs;
+};
+
+/* The buffer sizes the kernel actually gave us, which
+ * need not be what we asked for: Linux doubles
+ * SO_SNDBUF and SO_RCVBUF and caps them at
+ * net.core.[wr]mem_max, and pipes are rounded up to a
+ * power of two pages. */
 void
-setBufferSizes(int rfd, int wfd) {
-	socklen_t s = sizeof(SET_RCVBUF);
+effectiveSizes(int fd[2], int *snd, int *rcv) {
+	socklen_t len = sizeof(*snd);
 
-	if ((rfd > 0) && (SET_RCVBUF >= 0)) {
-		if (setsockopt(rfd, SOL_SOCKET, SO_RCVBUF, (void *)&SET_RCVBUF, s) < 0) {
-/* For unknown reasons, setsockopt(2) fails with EINVAL,
- * yet still sets the value ?? */
-#ifndef __sun
-			err(EXIT_FAILURE, "setsockopt");
+	*snd = *rcv = -1;
+	switch(IPC_TYPE) {
+	case IPC_PIPE:
+#ifdef F_GETPIPE_SZ
+		if ((*snd = fcntl(fd[1], F_GETPIPE_SZ)) < 0) {
+			err(EXIT_FAILURE, "fcntl(F_GETPIPE_SZ)");
 			/* NOTREACHED */
+		}
 #endif
+		*rcv = *snd;
+		break;
+	case IPC_SHM:
+		*snd = *rcv = ringOf(fd[0])->size;
+		break;
+	case IPC_MSGQ:
+		*snd = *rcv = msgqOf(fd[0])->qbytes;
+		break;
+	case IPC_SOCKET:
+	case IPC_SOCKETPAIR:
+		if (getsockopt(fd[1], SOL_SOCKET, SO_SNDBUF, snd, &len) < 0) {
+			err(EXIT_FAILURE, "getsockopt");
+			/* NOTREACHED */
 		}
-	}
-
-	if ((wfd > 0) && (SET_SNDBUF >= 0)) {
-		if (setsockopt(wfd, SOL_SOCKET, SO_SNDBUF, (void *)&SET_SNDBUF, s) < 0) {
-			err(EXIT_FAILURE, "setsockopt");
+		len = sizeof(*rcv);
+		if (getsockopt(fd[0], SOL_SOCKET, SO_RCVBUF, rcv, &len) < 0) {
+			err(EXIT_FAILURE, "getsockopt");
 			/* NOTREACHED */
 		}
+		break;
 	}
 }
 
-void
-doSocketpair() {
-	int fd[2];
+/* Run one throughput test on a fresh channel of the
+ * given size in a child.  Sockets get both SO_SNDBUF
+ * and SO_RCVBUF set, unless one of them was fixed via
+ * '-S' or '-R'.  Returns -1 if the test failed, e.g.
+ * because we're not allowed a buffer that large. */
+int
+tuneMeasure(int size, struct tuneStep *st) {
+	int rp[2], status;
+	ssize_t n;
+	pid_t pid;
 
-	reportTest("socketpair %s", SET_SOCKTYPE);
+	memset(st, 0, sizeof(*st));
+	st->size = size;
 
-	if (socketpair(PF_LOCAL, SOCK_TYPE, 0, fd) < 0) {
+	if (pipe(rp) < 0) {
 		err(EXIT_FAILURE, "pipe");
 		/* NOTREACHED */
 	}
+	if (fflush(stdout) == EOF) {
+		err(EXIT_FAILURE, "fflush");
+		/* NOTREACHED */
+	}
+	if ((pid = fork()) < 0) {
+		err(EXIT_FAILURE, "fork");
+		/* NOTREACHED */
+	}
+
+	if (pid == 0) {
+		int fd[2];
+
+		(void)close(rp[0]);
+		if (isSizable()) {
+			SET_PIPEBUF = size;
+		} else {
+			if (SET_SNDBUF < 0) {
+				SET_SNDBUF = size;
+			}
+			if (SET_RCVBUF < 0) {
+				SET_RCVBUF = size;
+			}
+		}
+		/* As in a sweep, keep throughput() quiet. */
+		QUIET = 1;
+		FORMAT = FMT_CSV;
+		MODE = THROUGHPUT;
+
+		openChannel(fd);
+		effectiveSizes(fd, &st->sndbuf, &st->rcvbuf);
+		throughput(fd[0], fd[1]);
+		if (RESULT.r.elapsed > 0) {
+			st->mbs = (double)RESULT.r.bytes / RESULT.r.elapsed / 1000000;
+		}
+		if (write(rp[1], st, sizeof(*st)) != sizeof(*st)) {
+			err(EXIT_FAILURE, "write");
+			/* NOTREACHED */
+		}
+		exit(EXIT_SUCCESS);
+		/* NOTREACHED */
+	}
 
-	setBufferSizes(fd[0], fd[1]);
-
-	/* Not the same values, but of interest either way. */
-#ifdef __linux
-	reportSysctl("net.unix.max_dgram_qlen");
-#else
-	reportSysctl("net.local.dgram.recvspace");
-#endif
-	printSockOpt(fd[0], SO_RCVBUF);
-	printSockOpt(fd[1], SO_SNDBUF);
+	(void)close(rp[1]);
+	n = read(rp[0], st, sizeof(*st));
+	(void)close(rp[0]);
+	if (waitpid(pid, &status, 0) < 0) {
+		err(EXIT_FAILURE, "waitpid");
+		/* NOTREACHED */
+	}
+	if ((n != sizeof(*st)) || !WIFEXITED(status) ||
+	    (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+		return -1;
+	}
 
-	writeData(fd[1]);
-	readData(fd[0]);
+	if (!QUIET) {
+		if (isSizable()) {
+			(void)printf("%10d %10d %10.2f\n", st->size, st->sndbuf, st->mbs);
+		} else {
+			(void)printf("%10d %10d %10d %10.2f\n", st->size,
+					st->sndbuf, st->rcvbuf, st->mbs);
+		}
+	}
+	return 0;
 }
 
-void
-cleanup() {
-	(void)unlink("socket");
-	(void)unlink("fifo");
+/* The largest size worth trying by default: beyond the
+ * system limit, we'd only measure the same buffer
+ * again (or not be allowed to set it). */
+int
+tuneLimit() {
+	int limit = 4 * 1024 * 1024;
+#if defined(__linux)
+	if (IPC_TYPE == IPC_PIPE) {
+		limit = sysctlValue("fs.pipe-max-size");
+	} else if (IPC_TYPE == IPC_MSGQ) {
+		limit = sysctlValue("kernel.msgmnb");
+	} else if (!isSizable()) {
+		int wmem = sysctlValue("net.core.wmem_max");
+		int rmem = sysctlValue("net.core.rmem_max");
+		limit = wmem > rmem ? wmem : rmem;
+	}
+#elif defined(__FreeBSD__) || defined(__APPLE__)
+	if (!isSizable()) {
+		/* Includes the mbuf overhead, so a bit generous. */
+		limit = sysctlValue("kern.ipc.maxsockbuf");
+	}
+#endif
+	return limit;
 }
 
+/* Find the smallest buffer that gets us TUNE_PCT
+ * percent of the peak throughput: measure doubling
+ * sizes from 'lo' up to 'hi' (or until the kernel no
+ * longer gives us a larger buffer) to find the peak,
+ * then bisect between the last size that fell short
+ * and the first that reached the target. */
 void
-doFifo() {
-	int rfd, wfd;
+tuneSearch(int lo, int hi) {
+	struct tuneStep steps[64], st, *best = NULL;
+	double peak = 0, target;
+	int i, num = 0, fail = -1, pass, size;
 
-	reportTest("fifo");
+	for (size = lo; num < 64; size *= 2) {
+		if (size > hi) {
+			size = hi;
+		}
+		if (tuneMeasure(size, &steps[num]) < 0) {
+			/* Too small for a single message, or larger
+			 * than we're allowed. */
+			if (!QUIET) {
+				(void)printf("%10d: test failed%s\n", size,
+						num > 0 ? ", stopping here" : "");
+			}
+			if ((num > 0) || (size >= hi) || (size > INT_MAX / 2)) {
+				break;
+			}
+			continue;
+		}
+		if ((num > 0) && (steps[num].sndbuf == steps[num - 1].sndbuf) &&
+		    (steps[num].rcvbuf == steps[num - 1].rcvbuf)) {
+			if (!QUIET) {
+				(void)printf("%10d: capped by the kernel\n", size);
+			}
+			break;
+		}
+		if (steps[num].mbs > peak) {
+			peak = steps[num].mbs;
+		}
+		num++;
+		if ((size >= hi) || (size > INT_MAX / 2)) {
+			break;
+		}
+	}
 
-	if (mkfifo("fifo", 0644) < 0) {
-		err(EXIT_FAILURE, "fifo");
+	if ((num == 0) || (peak <= 0)) {
+		(void)fprintf(stderr, "Unable to measure any throughput.\n");
+		exit(EXIT_FAILURE);
 		/* NOTREACHED */
 	}
-	if ((rfd = open("fifo", O_RDONLY|O_NONBLOCK)) < 0) {
-		err(EXIT_FAILURE, "open");
-		/* NOTREACHED */
+
+	target = peak * TUNE_PCT / 100;
+	for (i = 0; i < num; i++) {
+		if (steps[i].mbs >= target) {
+			break;
+		}
 	}
-	if ((wfd = open("fifo", O_WRONLY|O_NONBLOCK)) < 0) {
-		err(EXIT_FAILURE, "open");
-		/* NOTREACHED */
+	best = &steps[i];
+	if (i > 0) {
+		fail = steps[i - 1].size;
 	}
 
-	writeData(wfd);
-	readData(rfd);
+	/* Pipes only come in powers of two pages, which
+	 * we've already tried. */
+	pass = best->size;
+	while ((fail > 0) && (IPC_TYPE != IPC_PIPE) &&
+	       (pass - fail > (int)sysconf(_SC_PAGESIZE)) && (pass - fail > pass / 16)) {
+		size = fail + (pass - fail) / 2;
+		if (tuneMeasure(size, &st) < 0) {
+			break;
+		}
+		if (st.mbs >= target) {
+			pass = size;
+			steps[i] = st;
+		} else {
+			fail = size;
+		}
+	}
+
+	if (QUIET) {
+		(void)printf("%d\n", best->size);
+		return;
+	}
+
+	(void)printf("\n");
+	(void)printf("%-15s: %8.2f\n", "Peak MB/s", peak);
+	(void)printf("%-15s: %8.2f\n", "Target MB/s", target);
+	(void)printf("%-15s: %8.2f\n", "Got MB/s", best->mbs);
+	(void)printf("%-15s: %8d\n", "Smallest size", best->size);
+	if (isSizable()) {
+		(void)printf("%-15s: %8d\n", "Effective size", best->sndbuf);
+	} else {
+		(void)printf("%-15s: %8d\n", "SO_SNDBUF", best->sndbuf);
+		(void)printf("%-15s: %8d\n", "SO_RCVBUF", best->rcvbuf);
+	}
 }
 
 void
-doSocket() {
-	int rfd, wfd;
-	int pid = 0;
-	uint16_t port = 12345;
-	char *sysctl = "invalid";
+doTune() {
+	int *range, num, lo = 4096, hi;
 
-	reportTest("%s %s socket", SET_SOCKDOMAIN, SET_SOCKTYPE);
+	switch(IPC_TYPE) {
+	case IPC_PIPE:
+		reportTest("pipe");
+		reportSysctl("fs.pipe-max-size");
+		break;
+	case IPC_SOCKET:
+		reportTest("%s %s socket", SET_SOCKDOMAIN, SET_SOCKTYPE);
+		break;
+	case IPC_SOCKETPAIR:
+		reportTest("socketpair %s", SET_SOCKTYPE);
+		break;
+	case IPC_SHM:
+		reportTest("shared memory ring");
+		break;
+	case IPC_MSGQ:
+		reportTest("SysV message queue");
+#ifdef __linux
+		reportSysctl("kernel.msgmnb");
+#endif
+		break;
+	}
+#ifdef __linux
+	if (!isSizable()) {
+		reportSysctl("net.core.wmem_max");
+		reportSysctl("net.core.rmem_max");
+	}
+#endif
 
-	void *s;
-	socklen_t s_size;
-	struct sockaddr_storage netsock;
-	struct sockaddr_un localsock;
+	/* A range given via '-P', '-S', or '-R' is the range
+	 * to search; a single '-P' size is where we start. */
+	hi = tuneLimit();
+	if (SWEEP_PIPEBUFS || SWEEP_SNDBUFS || SWEEP_RCVBUFS) {
+		int i;
 
-	if ((wfd = socket(SOCK_DOMAIN, SOCK_TYPE, 0)) < 0) {
-		err(EXIT_FAILURE, "socket");
-		/* NOTREACHED */
+		range = SWEEP_PIPEBUFS ?
+			expandNumbers(SWEEP_PIPEBUFS, -1, 1, "-P", &num) :
+			SWEEP_SNDBUFS ?
+			expandNumbers(SWEEP_SNDBUFS, -1, 1, "-S", &num) :
+			expandNumbers(SWEEP_RCVBUFS, -1, 1, "-R", &num);
+		lo = hi = range[0];
+		for (i = 1; i < num; i++) {
+			if (range[i] < lo) {
+				lo = range[i];
+			}
+			if (range[i] > hi) {
+				hi = range[i];
+			}
+		}
+		free(range);
+	} else if (SET_PIPEBUF > 0) {
+		lo = SET_PIPEBUF;
+	}
+	if (hi < lo) {
+		hi = lo;
 	}
-	rfd = wfd;
-
-	if (SOCK_DOMAIN == PF_LOCAL) {
-		localsock.sun_family = PF_LOCAL;
-		(void)strncpy(localsock.sun_path, "socket", sizeof(localsock.sun_path));
-		s = &localsock;
-		s_size = sizeof(localsock);
 
-		if (SOCK_TYPE == SOCK_DGRAM) {
-/* Not the same values, but of interest either way. */
-#ifdef __linux
-			sysctl = "net.unix.max_dgram_qlen";
-#else
-			sysctl = "net.local.dgram.recvspace";
+	if (!QUIET) {
+		(void)printf("\n");
+		if (isSizable()) {
+			(void)printf("%10s %10s %10s\n", "Requested", "Size", "MB/s");
 		} else {
-			sysctl = "net.local.stream.recvspace";
-#endif
+			(void)printf("%10s %10s %10s %10s\n", "Requested",
+					"SO_SNDBUF", "SO_RCVBUF", "MB/s");
 		}
-	} else if (SOCK_DOMAIN == PF_INET) {
-		struct sockaddr_in *sin = (struct sockaddr_in *)&netsock;
-		memset(sin, 0, sizeof(*sin));
+	}
+	tuneSearch(lo, hi);
+}
 
-		if (inet_pton(PF_INET, "127.0.0.1", &(sin->sin_addr)) != 1) {
-			err(EXIT_FAILURE, "inet_pton");
-			/* NOTREACHED */
-		}
+int
+cmpDouble(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
 
-		sin->sin_family = PF_INET;
-		sin->sin_port = htons(port);
-		s = sin;
-		s_size = sizeof(*sin);
+	return (x > y) - (x < y);
+}
 
-#ifndef __linux
-		if (SOCK_TYPE == SOCK_DGRAM) {
-			sysctl = "net.inet.udp.recvspace";
-#  ifndef __OpenBSD__
-		} else {
-			sysctl = "net.inet.tcp.recvspace";
-#  endif
-		}
-#endif
-	} else if (SOCK_DOMAIN == PF_INET6) {
-		struct sockaddr_in6 *sin = (struct sockaddr_in6 *)&netsock;
-		memset(sin, 0, sizeof(*sin));
+/* What a trial measured: capacity, throughput, or
+ * round-trip times, depending on the mode.  Every trial
+ * of a mode has the same metrics, in the same order;
+ * those a trial couldn't measure are NAN, and 'ints'
+ * tells which metrics are counts rather than rates. */
+#define MAX_METRICS 3
 
-		if (inet_pton(PF_INET6, "::1", &(sin->sin6_addr)) != 1) {
-			err(EXIT_FAILURE, "inet_pton");
-			/* NOTREACHED */
-		}
+int
+trialMetrics(const char **names, double *v, int *ints) {
+	struct result *x = &RESULT;
+	int n = 0;
 
-		sin->sin6_family = PF_INET6;
-		sin->sin6_port = htons(port);
-		s = sin;
-		s_size = sizeof(*sin);
+	switch (MODE) {
+	case THROUGHPUT:
+		names[n] = "Write MB/s";
+		ints[n] = 0;
+		v[n++] = x->w.elapsed > 0 ? (double)x->w.bytes / x->w.elapsed / 1000000 : 0;
+		names[n] = "Read MB/s";
+		ints[n] = 0;
+		v[n++] = x->r.elapsed > 0 ? (double)x->r.bytes / x->r.elapsed / 1000000 : 0;
+		names[n] = "Steady (ms)";
+		ints[n] = 0;
+		v[n++] = x->steady_ns >= 0 ? x->steady_ns / 1e6 : NAN;
+		break;
+	case LATENCY:
+		names[n] = "RTT p50 (ns)";
+		ints[n] = 1;
+		v[n++] = x->rtt[0];
+		names[n] = "RTT p99 (ns)";
+		ints[n] = 1;
+		v[n++] = x->rtt[1];
+		names[n] = "RTT p99.9 (ns)";
+		ints[n] = 1;
+		v[n++] = x->rtt[2];
+		break;
+	case FANOUT:
+		names[n] = "Total";
+		ints[n] = 1;
+		v[n++] = x->total;
+		names[n] = "Smallest";
+		ints[n] = 1;
+		v[n++] = x->chan_min;
+		break;
+	case CHAIN:
+		names[n] = "End-to-end MB/s";
+		ints[n] = 0;
+		v[n++] = x->r.elapsed > 0 ? (double)x->r.bytes / x->r.elapsed / 1000000 : 0;
+		names[n] = "RTT p50 (ns)";
+		ints[n] = 1;
+		v[n++] = x->rtt[0];
+		names[n] = "RTT p99 (ns)";
+		ints[n] = 1;
+		v[n++] = x->rtt[1];
+		break;
+	case BACKPRESSURE:
+		names[n] = "Time to full (ms)";
+		ints[n] = 0;
+		v[n++] = x->full_ns >= 0 ? x->full_ns / 1e6 : NAN;
+		names[n] = "Writer stalls";
+		ints[n] = 1;
+		v[n++] = x->stalls;
+		names[n] = "Stall max (ms)";
+		ints[n] = 0;
+		v[n++] = x->stall[2] / 1e6;
+		break;
+	case SUBPAGE:
+		names[n] = "Capacity";
+		ints[n] = 1;
+		v[n++] = x->total;
+		names[n] = "Packet";
+		ints[n] = 1;
+		v[n++] = x->packet >= 0 ? x->packet : NAN;
+		names[n] = "Write MB/s";
+		ints[n] = 0;
+		v[n++] = x->w.elapsed > 0 ? (double)x->w.bytes / x->w.elapsed / 1000000 : 0;
+		break;
+	case PROBE:
+		names[n] = "Largest write";
+		ints[n] = 1;
+		v[n++] = x->maxwrite;
+		names[n] = "Total";
+		ints[n] = 1;
+		v[n++] = x->total;
+		break;
+	default:
+		names[n] = "Total";
+		ints[n] = 1;
+		v[n++] = x->total;
+		names[n] = "Kernel memory";
+		ints[n] = 1;
+		v[n++] = x->kmem >= 0 ? x->kmem : NAN;
+	}
+	return n;
+}
 
-#ifdef __NetBSD__
-		if (SOCK_TYPE == SOCK_DGRAM) {
-			sysctl = "net.inet6.udp6.recvspace";
-		} else {
-			sysctl = "net.inet6.tcp6.recvspace";
-		}
-#elif defined(__OpenBSD__)
-		/* Per https://man.openbsd.org/sysctl.2, OpenBSD reuses
-		 * net.inet.tcp and net.inet.udp for TCP/UDP over IPv6. */
-		if (SOCK_TYPE == SOCK_DGRAM) {
-			sysctl = "net.inet.udp.recvspace";
+/* With '-r' or '-w', run the test in a quiet child for
+ * every trial, as a sweep would, and summarize. */
+void
+doTrials() {
+	const char *names[MAX_METRICS];
+	double *samples[MAX_METRICS];
+	int ints[MAX_METRICS], valid[MAX_METRICS] = { 0 };
+	int i, m, num = 0, failed = 0, nmetrics = 0;
+
+	switch (IPC_TYPE) {
+	case IPC_SOCKET:
+		reportTest("%s %s socket%s%s", SET_SOCKDOMAIN, SET_SOCKTYPE,
+				REMOTE ? " to " : "", REMOTE ? REMOTE : "");
+		break;
+	case IPC_SOCKETPAIR:
+		reportTest("socketpair %s", SET_SOCKTYPE);
+		break;
+	default:
+		reportTest("%s", ipcTypeName());
+	}
+
+	for (m = 0; m < MAX_METRICS; m++) {
+		if ((samples[m] = calloc(TRIALS, sizeof(double))) == NULL) {
+			err(EXIT_FAILURE, "calloc");
+			/* NOTREACHED */
 		}
-#endif
-	} else {
-		errx(EXIT_FAILURE, "Unexpected socket domain '%d'. Bailing out.\n", SOCK_DOMAIN);
-		/* NOTREACHED */
 	}
 
-	if (bind(wfd, (struct sockaddr *)s, s_size)) {
-		err(EXIT_FAILURE, "bind");
-		/* NOTREACHED */
+	if (!QUIET) {
+		(void)printf("Running %d trial%s", TRIALS, TRIALS > 1 ? "s" : "");
+		if (WARMUP) {
+			(void)printf(" after %d warm-up run%s", WARMUP, WARMUP > 1 ? "s" : "");
+		}
+		(void)printf("...\n");
 	}
 
-	reportSysctl(sysctl);
+	for (TRIAL = -WARMUP; TRIAL < TRIALS; TRIAL++) {
+		double v[MAX_METRICS];
+		int rp[2], status;
+		ssize_t n;
+		pid_t pid;
 
-	if (SOCK_TYPE == SOCK_STREAM) {
+		resetResult();
+		if (pipe(rp) < 0) {
+			err(EXIT_FAILURE, "pipe");
+			/* NOTREACHED */
+		}
 		if (fflush(stdout) == EOF) {
 			err(EXIT_FAILURE, "fflush");
 			/* NOTREACHED */
@@ -951,47 +9772,122 @@ doSocket() {
 			err(EXIT_FAILURE, "fork");
 			/* NOTREACHED */
 		}
-		if (pid) {
-			if (listen(wfd, 1) < 0) {
-				err(EXIT_FAILURE, "listen");
-				/* NOTREACHED */
-			}
-			if ((rfd = accept(wfd, NULL, NULL)) < 0) {
-				err(EXIT_FAILURE, "accept");
-				/* NOTREACHED */
-			}
-			setBufferSizes(rfd, -1);
-			if (waitpid(pid, NULL, 0) < 0) {
-				err(EXIT_FAILURE, "waitpid");
+
+		if (pid == 0) {
+			(void)close(rp[0]);
+			QUIET = 1;
+			FORMAT = FMT_CSV;
+			runFresh();
+			if (write(rp[1], &RESULT, sizeof(RESULT)) != sizeof(RESULT)) {
+				err(EXIT_FAILURE, "write");
 				/* NOTREACHED */
 			}
-			readData(rfd);
 			exit(EXIT_SUCCESS);
 			/* NOTREACHED */
-		} else {
-			/* Parent needs a chance to listen.
-			 * This is a poor approach, but hey... */
-			usleep(500);
-			if ((wfd = socket(SOCK_DOMAIN, SOCK_TYPE, 0)) < 0) {
-				err(EXIT_FAILURE, "socket");
-				/* NOTREACHED */
+		}
+
+		(void)close(rp[1]);
+		n = read(rp[0], &RESULT, sizeof(RESULT));
+		(void)close(rp[0]);
+		if (waitpid(pid, &status, 0) < 0) {
+			err(EXIT_FAILURE, "waitpid");
+			/* NOTREACHED */
+		}
+		if ((n != sizeof(RESULT)) || !WIFEXITED(status) ||
+		    (WEXITSTATUS(status) != EXIT_SUCCESS)) {
+			if (TRIAL >= 0) {
+				failed++;
+			}
+			continue;
+		}
+		if (TRIAL < 0) {
+			continue;
+		}
+
+		nmetrics = trialMetrics(names, v, ints);
+		if (!QUIET) {
+			char label[BUFSIZ];
+
+			(void)snprintf(label, sizeof(label), "Trial %d", TRIAL + 1);
+			(void)printf("%-15s:", label);
+			for (m = 0; m < nmetrics; m++) {
+				if (isnan(v[m])) {
+					(void)printf(" %s -", names[m]);
+				} else {
+					(void)printf(ints[m] ? " %s %.0f" : " %s %.2f",
+							names[m], v[m]);
+				}
+			}
+			(void)printf("\n");
+		}
+		for (m = 0; m < nmetrics; m++) {
+			if (!isnan(v[m])) {
+				samples[m][valid[m]++] = v[m];
 			}
 		}
+		num++;
 	}
 
-	if (connect(wfd, (struct sockaddr *)s, s_size) < 0) {
-		err(EXIT_FAILURE, "connect");
+	if (num == 0) {
+		errx(EXIT_FAILURE, "All %d trials failed.", TRIALS);
 		/* NOTREACHED */
 	}
 
-	setBufferSizes(rfd, wfd);
-	printSockOpt(wfd, SO_SNDBUF);
-	printSockOpt(rfd, SO_RCVBUF);
-	writeData(wfd);
+	if (!QUIET) {
+		(void)printf("\n%-15s: %12s %12s %12s %12s %12s\n", "",
+				"min", "median", "mean", "stddev", "max");
+	}
+	for (m = 0; m < nmetrics; m++) {
+		double *x = samples[m], sum = 0, var = 0, mean, median;
+		int k = valid[m];
 
-	if (SOCK_TYPE == SOCK_DGRAM) {
-		readData(rfd);
-		(void)unlink("socket");
+		if (k == 0) {
+			/* Not measured in any trial. */
+			if (QUIET) {
+				if (m == 0) {
+					(void)printf("-\n");
+				}
+			} else {
+				(void)printf("%-15s: %12s %12s %12s %12s %12s\n", names[m],
+						"-", "-", "-", "-", "-");
+			}
+			continue;
+		}
+
+		qsort(x, k, sizeof(*x), cmpDouble);
+		for (i = 0; i < k; i++) {
+			sum += x[i];
+		}
+		mean = sum / k;
+		for (i = 0; i < k; i++) {
+			var += (x[i] - mean) * (x[i] - mean);
+		}
+		if (k > 1) {
+			var /= k - 1;
+		}
+		median = (k % 2) ? x[k / 2] : (x[k / 2 - 1] + x[k / 2]) / 2;
+
+		if (QUIET) {
+			/* Just the median of what matters most. */
+			if (m == 0) {
+				(void)printf(ints[m] ? "%.0f\n" : "%.2f\n", median);
+			}
+			continue;
+		}
+		if (ints[m]) {
+			(void)printf("%-15s: %12.0f %12.0f %12.2f %12.2f %12.0f\n", names[m],
+					x[0], median, mean, sqrt(var), x[k - 1]);
+		} else {
+			(void)printf("%-15s: %12.2f %12.2f %12.2f %12.2f %12.2f\n", names[m],
+					x[0], median, mean, sqrt(var), x[k - 1]);
+		}
+	}
+	if (failed && !QUIET) {
+		(void)printf("%-15s: %8d\n", "Failed trials", failed);
+	}
+
+	for (m = 0; m < MAX_METRICS; m++) {
+		free(samples[m]);
 	}
 }
 
@@ -1004,6 +9900,56 @@ main(int argc, char **argv) {
 		/* NOTREACHED */
 	}
 
+	if (DAEMON) {
+		daemonLoop();
+		/* NOTREACHED */
+	}
+
+	if (FORMAT != FMT_TEXT) {
+		sweep();
+		return EXIT_SUCCESS;
+	}
+
+	if ((TRIALS > 1) || (WARMUP > 0)) {
+		doTrials();
+		return EXIT_SUCCESS;
+	}
+
+	if (REMOTE) {
+		doRemote();
+		return EXIT_SUCCESS;
+	}
+
+	if (MODE == PROBE) {
+		doProbe();
+		return EXIT_SUCCESS;
+	}
+
+	if (MODE == FANOUT) {
+		doFanout();
+		return EXIT_SUCCESS;
+	}
+
+	if (MODE == SUBPAGE) {
+		doSubpage();
+		return EXIT_SUCCESS;
+	}
+
+	if (MODE == CHAIN) {
+		doChain();
+		return EXIT_SUCCESS;
+	}
+
+	if (MODE == BACKPRESSURE) {
+		doBackpressure();
+		return EXIT_SUCCESS;
+	}
+
+	if (MODE == TUNE) {
+		doTune();
+		return EXIT_SUCCESS;
+	}
+
 	switch(IPC_TYPE) {
 	case IPC_FIFO:
 		doFifo();
@@ -1017,6 +9963,13 @@ main(int argc, char **argv) {
 	case IPC_SOCKETPAIR:
 		doSocketpair();
 		break;
+	case IPC_SHM:
+		doShm();
+		break;
+	case IPC_MQUEUE:
+	case IPC_MSGQ:
+		doMsgQueue();
+		break;
 	default:
 		/* This should never happen. */
 		(void)fprintf(stderr, "Unknown IPC type: %d\n", IPC_TYPE);